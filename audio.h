@@ -3,11 +3,14 @@
 
 #include "audio_buffer.h"
 
-typedef struct
+typedef struct AudioDescriptor
 {
     void (*audio_open)(AudioBuffer_t *buffer);
     void (*audio_pause)(int paused);
     void (*audio_close)(void);
 } AudioDescriptor_t;
 
+// No device: the samples are left in the AudioBuffer_t (null_audio.c)
+extern const AudioDescriptor_t NULL_AUDIO;
+
 #endif
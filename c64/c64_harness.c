@@ -6,6 +6,31 @@
 
 #define LOG(...) _LOG(C64, __VA_ARGS__)
 
+#define C64_MEM_SIZE (0xffff + 1)
+
+// Flat 64K machine; hung off cpu->mem_ctx so that each harness owns its memory
+typedef struct
+{
+    uint8_t mem[C64_MEM_SIZE];
+    N6502PageTable_t pages;
+
+    int override_pending;
+} C64Harness_t;
+
+static uint8_t
+c64_read_mem(void *ctx, uint16_t addr)
+{
+    C64Harness_t *c64 = (C64Harness_t *) ctx;
+    return c64->mem[addr];
+}
+
+static void
+c64_write_mem(void *ctx, uint16_t addr, uint8_t data)
+{
+    C64Harness_t *c64 = (C64Harness_t *) ctx;
+    c64->mem[addr] = data;
+}
+
 unsigned char
 pet2ascii(unsigned char c)
 {
@@ -123,13 +148,13 @@ c64_trap(N6502_t *cpu)
             filename[length] = 0;
             if(cpu->options.override)
             {
-                static int first = 1;
-                if(first)
+                C64Harness_t *c64 = (C64Harness_t *) cpu->mem_ctx;
+                if(c64->override_pending)
                 {
                     printf("\nNOTE: Overriding '%s' with '%s'\n", filename, cpu->options.override);
 
                     sprintf(filename, "%s", cpu->options.override);
-                    first = 0;
+                    c64->override_pending = 0;
                 }
             }
             if(cpu->options.skip)
@@ -207,8 +232,35 @@ c64_trap(N6502_t *cpu)
 void
 c64_install_harness(N6502_t *cpu)
 {
-    cpu->debug_trap = c64_trap;
+    C64Harness_t *c64 = calloc(1, sizeof(C64Harness_t));
+    unsigned page;
+
+    ASSERT(c64, "Could not allocate c64 memory\n");
+
+    c64->override_pending = 1;
+
+    // Everything is plain RAM; traps are opcodes in memory, so the handlers are
+    // only a fallback
+    for(page = 0; page < N6502_NUM_PAGES; page++)
+    {
+        c64->pages.read[page] = c64->mem + page * N6502_PAGE_SIZE;
+        c64->pages.write[page] = c64->mem + page * N6502_PAGE_SIZE;
+    }
+
+    cpu->read_mem = c64_read_mem;
+    cpu->write_mem = c64_write_mem;
+    cpu->mem_ctx = c64;
+    cpu->pages = &c64->pages;
+
+    // Generic 6502: selects the decimal-mode core at reset
     cpu->enable_decimal = 1;
+
+    n6502_reset(cpu);
+
+    // Set the first instruction to a trap so that if no instruction is programmed we will trap instead of BRK
+    WRITE_MEM(0000, OP_DEBUG_TRAP);
+
+    cpu->debug_trap = c64_trap;
     cpu->options.skip = 1;
 
     c64_load_program(cpu, " start");
@@ -249,8 +301,20 @@ c64_install_harness(N6502_t *cpu)
     WRITE_MEM(0xA474, OP_DEBUG_TRAP);
 
     cpu->regs.S = 0xFD;
-    cpu->regs.P.word = 0x04;
+    n6502_set_p(&cpu->regs, 0x04);
     cpu->regs.PC = 0x0801;
 
     printf("Install c64 harness\n");
 }
+
+void
+c64_remove_harness(N6502_t *cpu)
+{
+    free(cpu->mem_ctx);
+
+    cpu->read_mem = NULL;
+    cpu->write_mem = NULL;
+    cpu->mem_ctx = NULL;
+    cpu->pages = NULL;
+    cpu->debug_trap = NULL;
+}
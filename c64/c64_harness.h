@@ -5,6 +5,8 @@
 
 #define C64_TESTSUITE_PATH "test/testsuite-2.15/bin"
 
+// Installs a private 64K bus on the CPU and resets it into the test loader
 void c64_install_harness(N6502_t *cpu);
+void c64_remove_harness(N6502_t *cpu);
 
 #endif
@@ -22,3 +22,19 @@ unsigned htoi (const char *ptr)
     }
 }
 
+
+uint32_t crc32_update (uint32_t crc, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    int i;
+
+    crc = ~crc;
+
+    while (len--) {
+        crc ^= *p++;
+        for (i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+
+    return ~crc;
+}
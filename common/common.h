@@ -1,6 +1,12 @@
 #ifndef __common_h__
 #define __common_h__
 
+#include <stddef.h>
+#include <stdint.h>
+
 unsigned htoi (const char *ptr);
 
+// CRC-32 (zip/iNES databases); pass 0 for the first buffer
+uint32_t crc32_update (uint32_t crc, const void *buf, size_t len);
+
 #endif
@@ -135,7 +135,7 @@ menubar_mousedown(Display_t *display, MenuBar_t *menubar, int x, int y)
         {
             if(highlighted->on_select)
             {
-                highlighted->on_select(highlighted);
+                highlighted->on_select(highlighted, menubar->p);
             }
 
             menubar_deselect(menubar);
@@ -231,13 +231,13 @@ menubar_mousemove(Display_t *display, MenuBar_t *menubar, int x, int y)
 }
 
 static int
-menuitem_check_key(MenuItem_t *menu, int key)
+menuitem_check_key(MenuItem_t *menu, int key, void *p)
 {
     if(menu->key_accelerator == key)
     {
         if(menu->on_select)
         {
-            menu->on_select(menu);
+            menu->on_select(menu, p);
         }
 
         return 1;
@@ -245,7 +245,7 @@ menuitem_check_key(MenuItem_t *menu, int key)
 
     if(menu->child_menu)
     {
-        if(menuitem_check_key(menu->child_menu, key))
+        if(menuitem_check_key(menu->child_menu, key, p))
         {
             return 1;
         }
@@ -253,7 +253,7 @@ menuitem_check_key(MenuItem_t *menu, int key)
 
     if(menu->next)
     {
-        if(menuitem_check_key(menu->next, key))
+        if(menuitem_check_key(menu->next, key, p))
         {
             return 1;
         }
@@ -265,5 +265,5 @@ menuitem_check_key(MenuItem_t *menu, int key)
 int
 menubar_key_accelerator(MenuBar_t *menubar, int key)
 {
-    return menuitem_check_key(menubar->menu, key);
+    return menuitem_check_key(menubar->menu, key, menubar->p);
 }
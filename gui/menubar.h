@@ -21,7 +21,7 @@ typedef struct MenuItem
 
     int key_accelerator;
 
-    void (*on_select)(struct MenuItem *menu);
+    void (*on_select)(struct MenuItem *menu, void *p);
 
     MenuItemType_t type;
     struct MenuItem *next; // Next MenuItem after this (forms a linked list)
@@ -34,6 +34,8 @@ typedef struct
 
     MenuItem_t *menu;
     MenuItem_t *highlighted;
+
+    void *p; // User pointer, passed to on_select
 } MenuBar_t;
 
 #include "display.h"
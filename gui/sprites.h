@@ -10,6 +10,6 @@ typedef struct
     int height;
 } Sprite_t;
 
-Sprite_t SPRITE_X;
+extern Sprite_t SPRITE_X;
 
 #endif
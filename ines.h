@@ -1,6 +1,8 @@
 #ifndef __ines_h__
 #define __ines_h__
 
+#include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 
 #define DUMP4(A) A[0], A[1], A[2], A[3]
@@ -74,7 +76,7 @@ ines_load(iNES_t *ines, FILE *fp)
 }
 
 static inline int
-ines_mapper_num(iNES_t *ines)
+ines_mapper_num(const iNES_t *ines)
 {
     int mapper = (ines->rom_control_byte1 >> 4);
     int last_4bytes = (ines->reserved_0Ch |
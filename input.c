@@ -0,0 +1,239 @@
+#include "nes.h"
+#include "input.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // strncasecmp
+
+// Joypad buttons in the order the NES shifts them out, from bit 0
+static const char *INPUT_BUTTON_NAMES[] =
+{
+    "a", "b", "select", "start", "up", "down", "left", "right"
+};
+
+#define INPUT_NUM_BUTTONS (sizeof(INPUT_BUTTON_NAMES) / sizeof(INPUT_BUTTON_NAMES[0]))
+
+typedef struct
+{
+    uint32_t frame;
+    uint8_t buttons[2];
+} InputScriptEvent_t;
+
+struct InputScript
+{
+    InputScriptEvent_t *events;
+    unsigned num_events;
+    unsigned next;
+};
+
+void
+input_latch_joypads(NES_t *nes)
+{
+    uint8_t *pad1 = &nes->joypad_latch1;
+    uint8_t *pad2 = &nes->joypad_latch2;
+    uint8_t *mousedown = &nes->paddle_buttondown;
+
+    *pad1 =
+        ((nes->input.key[0].right & nes->input.key[0].mask.right) << 7) |
+        ((nes->input.key[0].left  & nes->input.key[0].mask.left ) << 6) |
+        ((nes->input.key[0].down  & nes->input.key[0].mask.down ) << 5) |
+        ((nes->input.key[0].up    & nes->input.key[0].mask.up   ) << 4) |
+        (nes->input.key[0].start  << 3) |
+        (nes->input.key[0].select << 2) |
+        (nes->input.key[0].b      << 1) |
+        (nes->input.key[0].a      << 0);
+
+    *pad2 =
+        (nes->input.key[1].right  << 7) |
+        (nes->input.key[1].left   << 6) |
+        (nes->input.key[1].down   << 5) |
+        (nes->input.key[1].up     << 4) |
+        (nes->input.key[1].start  << 3) |
+        (nes->input.key[1].select << 2) |
+        (nes->input.key[1].b      << 1) |
+        (nes->input.key[1].a      << 0);
+
+#if 1
+    if(nes->ppu.options.enable_paddle)
+    {
+        /*
+        Paddle support
+
+        The paddle position is read via D1 of $4017; the read data is inverted (0=1, 1=0). The first value read is
+        the MSB, and the 8th value read is (obviously) the LSB. Valid value ranges are 98 to 242, where 98 represents
+        the paddle being turned completely counter-clockwise.
+
+        For example, if %01101011 is read, the value would be NOT'd, making %10010100 which is 146. The paddle also
+        contains one button, which is read via D1 of $4016. A value of 1 specifies that the button is being pressed.
+        */
+
+        static const int NES_PADDLE_MAX = 242;
+        static const int NES_PADDLE_MIN = 98;
+
+        static const int NES_PADDLE_RANGE = NES_PADDLE_MAX - NES_PADDLE_MIN + 1;
+
+#define NES_WINDOW_WIDTH 512
+        float pos = (float) (nes->input.mousex * 3/2 - 30) / (NES_WINDOW_WIDTH * 3/4);
+        if(pos > 1.0) pos = 1.0;
+        if(pos < 0) pos = 0.0;
+
+        unsigned v = (unsigned) (pos * NES_PADDLE_RANGE) + NES_PADDLE_MIN;
+        // Bit reversal
+        v = ((v & 0x01) << 7) |
+            ((v & 0x02) << 5) |
+            ((v & 0x04) << 3) |
+            ((v & 0x08) << 1) |
+            ((v & 0x10) >> 1) |
+            ((v & 0x20) >> 3) |
+            ((v & 0x40) >> 5) |
+            ((v & 0x80) >> 7);
+        *pad2 = ~v;
+        *mousedown = nes->input.mousedown;
+    }
+#else
+    (void) mousedown;
+#endif
+}
+
+void
+input_set_joypad(NES_t *nes, unsigned port, unsigned buttons)
+{
+    ASSERT(port < 2, "Bad joypad port: %u\n", port);
+
+    nes->input.key[port].a      = (buttons >> 0) & 1;
+    nes->input.key[port].b      = (buttons >> 1) & 1;
+    nes->input.key[port].select = (buttons >> 2) & 1;
+    nes->input.key[port].start  = (buttons >> 3) & 1;
+    nes->input.key[port].up     = (buttons >> 4) & 1;
+    nes->input.key[port].down   = (buttons >> 5) & 1;
+    nes->input.key[port].left   = (buttons >> 6) & 1;
+    nes->input.key[port].right  = (buttons >> 7) & 1;
+
+    // The keyboard masks opposite directions; here the caller decides
+    nes->input.key[port].mask.up    = 1;
+    nes->input.key[port].mask.down  = 1;
+    nes->input.key[port].mask.left  = 1;
+    nes->input.key[port].mask.right = 1;
+}
+
+// --------------------------------------------------------------------------------
+
+// "-" or button names joined by '+', eg. "start" or "right+a"
+static unsigned
+input_script_parse_buttons(const char *token, const char *path, unsigned line_num)
+{
+    unsigned buttons = 0;
+    unsigned i;
+
+    if(strcmp(token, "-") == 0)
+        return 0;
+
+    while(*token)
+    {
+        size_t len = strcspn(token, "+");
+
+        for(i = 0; i < INPUT_NUM_BUTTONS; i++)
+        {
+            if(len == strlen(INPUT_BUTTON_NAMES[i]) && strncasecmp(token, INPUT_BUTTON_NAMES[i], len) == 0)
+                break;
+        }
+
+        ASSERT(i < INPUT_NUM_BUTTONS, "%s:%u: bad button '%.*s'\n", path, line_num, (int) len, token);
+        buttons |= 1 << i;
+
+        token += len;
+        if(*token == '+')
+            token++;
+    }
+
+    return buttons;
+}
+
+void
+input_script_load(NES_t *nes, const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    InputScript_t *script;
+    char line[256];
+    unsigned line_num = 0;
+    unsigned max_events = 0;
+
+    ASSERT(fp, "Could not open '%s'\n", path);
+
+    script = calloc(1, sizeof(*script));
+    ASSERT(script, "Failed to allocate an input script\n");
+
+    while(fgets(line, sizeof(line), fp))
+    {
+        InputScriptEvent_t *event;
+        char pad1[64] = "-";
+        char pad2[64] = "-";
+        unsigned frame;
+        int fields;
+
+        line_num++;
+        line[strcspn(line, "#\r\n")] = 0;
+
+        // Blank or a comment
+        if(line[strspn(line, " \t")] == 0)
+            continue;
+
+        fields = sscanf(line, "%u %63s %63s", &frame, pad1, pad2);
+        ASSERT(fields >= 2, "%s:%u: expected FRAME PAD1 [PAD2]\n", path, line_num);
+        ASSERT(script->num_events == 0 || frame > script->events[script->num_events - 1].frame,
+               "%s:%u: frame %u is out of order\n", path, line_num, frame);
+
+        if(script->num_events == max_events)
+        {
+            max_events = max_events ? max_events * 2 : 64;
+            script->events = realloc(script->events, max_events * sizeof(InputScriptEvent_t));
+            ASSERT(script->events, "Failed to allocate %u input events\n", max_events);
+        }
+
+        event = &script->events[script->num_events++];
+        event->frame = frame;
+        event->buttons[0] = input_script_parse_buttons(pad1, path, line_num);
+        event->buttons[1] = input_script_parse_buttons(pad2, path, line_num);
+    }
+
+    fclose(fp);
+
+    NOTIFY("Input script %s: %u events\n", path, script->num_events);
+
+    input_script_destroy(nes);
+    nes->input.script = script;
+}
+
+void
+input_script_update(NES_t *nes)
+{
+    InputScript_t *script = nes->input.script;
+    const InputScriptEvent_t *event = NULL;
+
+    if(! script)
+        return;
+
+    while(script->next < script->num_events && script->events[script->next].frame <= nes->ppu.frame_count)
+        event = &script->events[script->next++];
+
+    if(event)
+    {
+        input_set_joypad(nes, 0, event->buttons[0]);
+        input_set_joypad(nes, 1, event->buttons[1]);
+    }
+}
+
+void
+input_script_destroy(NES_t *nes)
+{
+    InputScript_t *script = nes->input.script;
+
+    if(! script)
+        return;
+
+    free(script->events);
+    free(script);
+    nes->input.script = NULL;
+}
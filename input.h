@@ -3,9 +3,29 @@
 
 #include "nes.h"
 
+// Platform: fills in nes->input from the platform's events, once a frame
 void input_update(NES_t *nes);
+
+// Common (input.c): latches nes->input into the joypad shift registers
 void input_latch_joypads(NES_t *nes);
+// Holds buttons (bit 0 = A ... bit 7 = Right, the NES shift order) on port 0/1
+void input_set_joypad(NES_t *nes, unsigned port, unsigned buttons);
+
+// Scripted joypads (--input), replayed by input_update().  One line per change:
+//
+//     # frame  pad1       [pad2]
+//     0        -
+//     120      start
+//     125      -
+//     300      right+a    left
+//
+// The buttons are held from once that many frames have run until the next
+// line; "-" releases them all.  Frames must be in increasing order.
+void input_script_load(NES_t *nes, const char *path);
+void input_script_update(NES_t *nes);
+void input_script_destroy(NES_t *nes);
 
+// Platform
 unsigned input_time_ms(void);
 void input_delay(unsigned delay_ms);
 
@@ -0,0 +1,6 @@
+#include "log.h"
+
+// Logging vars
+FILE *debug_fp = NULL;
+FILE *info_fp = NULL;
+uint32_t log_zone_mask = 0;
@@ -5,8 +5,15 @@
 #include "common.h"
 
 #include "nes.h"
+#include "input.h"
+#include "n6502_profile.h"
+#include "n6502_trace.h"
+#include "n6502_watch.h"
+#include "n6502_aot.h"
+#include "n6502_lockstep.h"
 #include "c64/c64_harness.h"
 #include "nsf.h"
+#include "nestest.h"
 
 #define LOG(...)  _LOG(MAIN, __VA_ARGS__)
 #define INFO(...) _INFO(MAIN, __VA_ARGS__)
@@ -17,14 +24,20 @@
 
 static const char *APP_NAME = "NEStalgia emulator build " VERSION;
 
-// Logging vars
-FILE *debug_fp = NULL;
-FILE *info_fp = NULL;
-uint32_t log_zone_mask = 0;
+#define MAX_WATCHES 64
 
 static struct
 {
     char *rom_path;
+    const char *nestest_log;
+    const char *input_script;
+
+    // Armed once the bus is up (see n6502_watch_parse() for the syntax)
+    const char *watches[MAX_WATCHES];
+    unsigned num_watches;
+    int watch_log;
+
+    int footprint;
 } nestalgia_state = {0};
 
 #ifndef WIN32
@@ -43,6 +56,23 @@ enum
     OPT_WAV,
     OPT_PC,
     OPT_FS,
+    OPT_BLOCKS,
+    OPT_IDLE,
+    OPT_PROFILE,
+    OPT_TRACE,
+    OPT_TRACE_LAST,
+    OPT_NESTEST,
+    OPT_FUSE,
+    OPT_BREAK,
+    OPT_WATCH,
+    OPT_WATCH_LOG,
+    OPT_AOT,
+    OPT_LOCKSTEP,
+    OPT_FOOTPRINT,
+    OPT_HEADLESS,
+    OPT_INPUT,
+    OPT_TILE_KERNELS,
+    OPT_NO_SPRITE_LIMIT,
 };
 
 static struct argp_option options[] =
@@ -67,6 +97,23 @@ static struct argp_option options[] =
     {"wav",         OPT_WAV, 0,          0, "Dump an audio wav file" },
     {"pc",          OPT_PC, "PC",        0, "Force the 6502 PC to a different reset address" },
     {"fullscreen",  OPT_FS, 0,           0, "Start in fullscreen, rather than windowed mode" },
+    {"blocks",      OPT_BLOCKS, 0,       0, "Execute through the pre-decoded basic-block cache" },
+    {"idle-skip",   OPT_IDLE, 0,         0, "Fast-forward through vblank polling loops" },
+    {"fuse",        OPT_FUSE, 0,         0, "Fuse common instruction pairs and countdown loops (implies --blocks)" },
+    {"profile",     OPT_PROFILE, "FILE", 0, "Profile the 6502 and write folded call stacks to FILE" },
+    {"trace",       OPT_TRACE, "FILE",   0, "Write a binary 6502 instruction trace to FILE" },
+    {"trace-last",  OPT_TRACE_LAST, "N", 0, "Only keep the last N traced instructions" },
+    {"break",       OPT_BREAK, "ADDR",   0, "Stop in the debugger before executing ADDR (repeatable)" },
+    {"watch",       OPT_WATCH, "SPEC",   0, "Stop on [ppu:]rwx:ADDR[-ADDR] accesses (repeatable)" },
+    {"watch-log",   OPT_WATCH_LOG, 0,    0, "Log breakpoint and watchpoint hits instead of stopping" },
+    {"aot",         OPT_AOT, "DIR",      0, "Run translated PRG ROM from DIR/<CRC>.so (see tools/n6502_recompile.c)" },
+    {"lockstep",    OPT_LOCKSTEP, "N",   OPTION_ARG_OPTIONAL, "Check the CPU against the reference core every N instructions (default 16)" },
+    {"footprint",   OPT_FOOTPRINT, 0,    0, "Report per-instance memory use once the ROM is loaded" },
+    {"headless",    OPT_HEADLESS, 0,     0, "No window or audio device: run as fast as possible" },
+    {"input",       OPT_INPUT, "FILE",   0, "Replay the joypads from FILE (see input.h)" },
+    {"tile-kernels", OPT_TILE_KERNELS, "NAME", 0, "Force the PPU tile kernels: scalar, sse2 or avx2 (default: the best the CPU supports)" },
+    {"no-sprite-limit", OPT_NO_SPRITE_LIMIT, 0, 0, "Draw every sprite on a line, not only the first 8 (less flicker)" },
+    {"nestest",     OPT_NESTEST, "LOG",  OPTION_ARG_OPTIONAL, "Check the ROM against a nestest log (default " NESTEST_DEFAULT_LOG ")" },
     { 0 }
 };
 
@@ -166,7 +213,7 @@ nes_parse_opt (int key, char *arg, struct argp_state *state)
             break;
 
         case OPT_FS:
-            nes->gui.display.fullscreen = 1;
+            nes->ppu.options.display_fullscreen = 1;
             break;
 
         case OPT_DELAY:
@@ -216,6 +263,78 @@ nes_parse_opt (int key, char *arg, struct argp_state *state)
             NOTIFY("Set the Reset PC to %04X\n", nes->options.reset_pc);
             break;
 
+        case OPT_BLOCKS:
+            nes->cpu.options.block_cache = 1;
+            break;
+
+        case OPT_IDLE:
+            nes->cpu.options.idle_skip = 1;
+            break;
+
+        case OPT_FUSE:
+            nes->cpu.options.block_cache = 1;
+            nes->cpu.options.fuse = 1;
+            break;
+
+        case OPT_PROFILE:
+            nes->cpu.options.profile = arg;
+            break;
+
+        case OPT_TRACE:
+            nes->cpu.options.trace = arg;
+            break;
+
+        case OPT_TRACE_LAST:
+            nes->cpu.options.trace_last = strtoul(arg, NULL, 0);
+            break;
+
+        case OPT_BREAK:
+        case OPT_WATCH:
+            ASSERT(nestalgia_state.num_watches < MAX_WATCHES, "Too many watches\n");
+            nestalgia_state.watches[nestalgia_state.num_watches++] = arg;
+            break;
+
+        case OPT_WATCH_LOG:
+            nestalgia_state.watch_log = 1;
+            break;
+
+        case OPT_AOT:
+            nes->cpu.options.aot = arg;
+            break;
+
+        case OPT_LOCKSTEP:
+            nes->cpu.options.lockstep = arg ? strtoul(arg, NULL, 0) : N6502_LOCKSTEP_CHUNK;
+            ASSERT(nes->cpu.options.lockstep > 0, "Bad lockstep chunk: %s\n", arg);
+            break;
+
+        case OPT_FOOTPRINT:
+            nestalgia_state.footprint = 1;
+            break;
+
+        case OPT_HEADLESS:
+            nes->options.headless = 1;
+            nes->ppu.options.no_vsync = 1;
+            break;
+
+        case OPT_INPUT:
+            nestalgia_state.input_script = arg;
+            break;
+
+        case OPT_TILE_KERNELS:
+            nes->ppu.options.tile_kernels = arg;
+            break;
+
+        case OPT_NO_SPRITE_LIMIT:
+            nes->ppu.options.no_sprite_limit = 1;
+            NOTIFY("Disabled the 8 sprites per line limit\n");
+            break;
+
+        case OPT_NESTEST:
+            nestalgia_state.nestest_log = arg ? arg : NESTEST_DEFAULT_LOG;
+            nes->options.disable_audio = 1;
+            nes->ppu.options.no_vsync = 1;
+            break;
+
         case ARGP_KEY_ARG:
             ASSERT(nestalgia_state.rom_path == NULL, "Can only specify one ROM: [%s]\n", arg);
             nestalgia_state.rom_path = arg;
@@ -244,17 +363,53 @@ parse_options(NES_t *nes, int argc, char *argv[])
     //nes->ppu.options.crop_ntsc = 1; // FIXME: NTSC cropping is a bit pessimistic
     nes->ppu.options.trigger_hack = 1; // FIXME: hack for Double Dragon
 
+#ifdef HEADLESS
+    // Built without SDL: there is nothing else to run on
+    nes->options.headless = 1;
+    nes->ppu.options.no_vsync = 1;
+#endif
+
     argp_parse(&argp, argc, argv, 0, 0, nes);
 }
 #endif
 
+static void
+arm_watches(N6502_t *cpu)
+{
+    unsigned i;
+
+    for(i = 0; i < nestalgia_state.num_watches; i++)
+    {
+        const char *spec = nestalgia_state.watches[i];
+        int ok = n6502_watch_parse(cpu, spec, 0);
+
+        ASSERT(ok, "Bad breakpoint/watch: %s\n", spec);
+    }
+
+    if(nestalgia_state.watch_log && cpu->watch)
+        n6502_watch_set_log_only(cpu, 1);
+}
+
+static void
+arm_lockstep(N6502_t *cpu)
+{
+    if(! cpu->options.lockstep)
+        return;
+
+    ASSERT(nestalgia_state.num_watches == 0, "--lockstep does not work with breakpoints or watches\n");
+    n6502_lockstep_attach(cpu, cpu->options.lockstep);
+}
+
+#ifndef HEADLESS
 // OSX-only
 #include <SDL/SDL.h>
+#endif
 
 int
 main(int argc, char *argv[])
 {
     NES_t *nes;
+    int status = 0;
 
     nes = calloc(1, sizeof(NES_t));
 
@@ -277,7 +432,7 @@ main(int argc, char *argv[])
         NOTIFY("%s\n", APP_NAME);
     }
 
-    nes->gui.display.title = APP_NAME;
+    nes->options.title = APP_NAME;
 
     if(nes->ppu.options.display_windowed)
     {
@@ -319,23 +474,47 @@ main(int argc, char *argv[])
         nes_init(nes, 1);
         nsf_play(nes, nestalgia_state.rom_path);
     }
+    else if(nestalgia_state.nestest_log)
+    {
+        nes->options.headless = 1;
+
+        status = nestest_run(nes, nestalgia_state.rom_path, nestalgia_state.nestest_log);
+        free(nes);
+        return status;
+    }
     else if(nes->cpu.options.test)
     {
-        nes_soft_reset(nes);
         c64_install_harness(&nes->cpu);
+        arm_watches(&nes->cpu);
+        arm_lockstep(&nes->cpu);
         n6502_run_until_stopped(&nes->cpu, nes->options.max_instructions);
+        status = n6502_lockstep_detach(&nes->cpu);
+        n6502_block_cache_stats(&nes->cpu);
+        n6502_idle_stats(&nes->cpu);
+        n6502_profile_report(&nes->cpu);
+        n6502_trace_close(&nes->cpu);
+        n6502_watch_destroy(&nes->cpu);
+        c64_remove_harness(&nes->cpu);
     }
     else
     {
         unsigned frame_num = 0;
 
+#ifndef HEADLESS
         // OSX-only
-        SDL_Init(SDL_INIT_EVERYTHING);
+        // --headless: only the timer, for input_time_ms()
+        SDL_Init(nes->options.headless ? SDL_INIT_TIMER : SDL_INIT_EVERYTHING);
         atexit(SDL_Quit);
         // -OSX-only
+#endif
 
         nes_init(nes, 1);
         nes_load_rom(nes, nestalgia_state.rom_path);
+        if(nestalgia_state.input_script)
+            input_script_load(nes, nestalgia_state.input_script);
+        if(nestalgia_state.footprint)
+            nes_report_footprint(nes);
+
         nes_hard_reset(nes);
         nes_soft_reset(nes);
         if(nes->options.reset_pc > 0)
@@ -343,19 +522,34 @@ main(int argc, char *argv[])
             nes->cpu.regs.PC = nes->options.reset_pc;
         }
 
+        arm_watches(&nes->cpu);
+        arm_lockstep(&nes->cpu);
+
         while((nes->options.max_frames == 0) || (frame_num < nes->options.max_frames))
         {
             INFO("Frame: %d\n", frame_num);
             nes_run_frame(nes);
 
-            if(nes->options.quit)
-            {
-                nes_quit(nes);
+            if(nes->options.quit || n6502_lockstep_diverged(&nes->cpu))
                 break;
-            }
+
             frame_num++;
         }
 
+        // Report before nes_quit() tears the CPU state down
+        status = n6502_lockstep_detach(&nes->cpu);
+        n6502_block_cache_stats(&nes->cpu);
+        n6502_idle_stats(&nes->cpu);
+        n6502_aot_stats(&nes->cpu);
+        n6502_profile_report(&nes->cpu);
+        n6502_trace_close(&nes->cpu);
+        input_script_destroy(nes);
+
+        if(nes->options.quit)
+        {
+            nes_quit(nes);
+        }
+
         if(nes->options.blargg_test)
         {
             NOTIFY("Blargg test did not complete within %d frames\n", nes->options.max_frames);
@@ -365,5 +559,5 @@ main(int argc, char *argv[])
 
     free(nes);
 
-    return 0;
+    return status;
 }
@@ -1,45 +1,180 @@
 #ifndef __n6502_h__
 #define __n6502_h__
 
+#include <stddef.h>
 #include <stdint.h>
 #include "log.h"
 
 #define SEGMENTED_6502
 
+// Hot-path helpers must be inlined into the dispatch core so that the register
+// file never has its address taken
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+typedef struct
+{
+    uint8_t  A; // Accumulator
+    uint8_t  X;
+    uint8_t  Y;
+    uint8_t  S; // Stack pointer
+
+    uint16_t PC;
+
+    // Processor status, unpacked so that no flag update is a read-modify-write.
+    // Z and N are evaluated lazily from the last result that set them; the
+    // packed byte is only built when something observes P (see n6502_get_p()).
+    uint8_t  C;  // Carry
+    uint8_t  V;  // Overflow
+    uint8_t  I;  // Interrupt disable
+    uint8_t  D;  // Decimal mode status
+    uint8_t  ZR; // Zero: set if ZR == 0
+    uint8_t  NR; // Sign (negative): bit 7 of NR
+    uint8_t  U;  // Bit 5 as last loaded (1 unless P was set directly)
+} N6502Regs_t;
+
+#define P_C  0x01
+#define P_Z  0x02
+#define P_I  0x04
+#define P_D  0x08
+#define P_B  0x10 // Software interrupt (BRK); only exists on the stack
+#define P_5  0x20
+#define P_V  0x40
+#define P_N  0x80
+
+static inline uint8_t
+n6502_get_p(const N6502Regs_t *regs)
+{
+    return (regs->NR & P_N) |
+           (regs->V << 6) |
+           (regs->U << 5) |
+           (regs->D << 3) |
+           (regs->I << 2) |
+           ((regs->ZR == 0) << 1) |
+           regs->C;
+}
+
+static inline void
+n6502_set_p(N6502Regs_t *regs, uint8_t p)
+{
+    regs->C  = p & P_C;
+    regs->ZR = ~p & P_Z;
+    regs->I  = (p & P_I) >> 2;
+    regs->D  = (p & P_D) >> 3;
+    regs->U  = (p & P_5) >> 5;
+    regs->V  = (p & P_V) >> 6;
+    regs->NR = p;
+}
+
+typedef enum
+{
+    AM_BAD = 0,
+
+    AM_IMPLIED,
+    AM_ACCUM,
+
+    AM_IMMED,
+    AM_RELATIVE,
+    AM_ZP,
+    AM_ZPX,      /* Zero page indexed with X */
+    AM_ZPY,      /* Zero page indexed with Y */
+
+    AM_JMPABS,
+
+    AM_ABS,
+    AM_ABSX,     /* Absolute indexed with X */
+    AM_ABSY,     /* Absolute indexed with Y */
+
+    AM_INDA,     /* Indirect Absolute */
+    AM_INDX,     /* Indexed indirect (with x) */
+    AM_INDY,     /* Indirect indexed (with y) */
+
+    AM_LAST,
+} AddressingMode_t;
+
+// Number of operand bytes following the opcode; folds to a constant when the
+// mode is known at compile time
+static ALWAYS_INLINE unsigned
+n6502_operand_bytes(AddressingMode_t mode)
+{
+    switch(mode)
+    {
+        case AM_IMMED:
+        case AM_RELATIVE:
+        case AM_ZP:
+        case AM_ZPX:
+        case AM_ZPY:
+        case AM_INDX:
+        case AM_INDY:
+            return 1;
+
+        case AM_JMPABS:
+        case AM_ABS:
+        case AM_ABSX:
+        case AM_ABSY:
+        case AM_INDA:
+            return 2;
+
+        default:
+            return 0;
+    }
+}
+
+#define N6502_PAGE_SIZE  0x100
+#define N6502_NUM_PAGES  0x100
+
+// Direct-mapped view of the bus, one entry per 256-byte page.  A non-NULL entry
+// points at the backing store for that page; NULL pages (I/O, mapper registers)
+// fall back to the read_mem/write_mem handlers.
+typedef struct
+{
+    uint8_t *read[N6502_NUM_PAGES];
+    uint8_t *write[N6502_NUM_PAGES];
+} N6502PageTable_t;
+
+struct N6502;
+
+// A dispatch loop specialised for one CPU variant and feature set
+typedef void (*N6502Core_t)(struct N6502 *cpu, int64_t last_cycle, int hard_limit,
+                            int64_t max_instructions, int until_stopped);
+
 // NES-compatible 6502
 // Memory is paged (ie page1 == 0000h-00FFh)
 typedef struct N6502
 {
-    struct
-    {
-        uint8_t  A; // Accumulator
-        uint8_t  X;
-        uint8_t  Y;
-        uint8_t  S; // Stack pointer
-
-        uint16_t PC;
-
-        union
-        {
-            uint8_t word;
-
-            struct
-            {
-                unsigned C  : 1; // Carry
-                unsigned Z  : 1; // Zero
-                unsigned I  : 1; // Interrupt enable
-                unsigned D  : 1; // Decimal mode status
-                unsigned B  : 1; // Software interrupt (BRK)
-                unsigned _5 : 1; // _unused (always 1)
-                unsigned V  : 1; // Overflow
-                unsigned N  : 1; // Sign (negative)
-            } bits;
-        } P; // Processor status
-    } regs;
+    // NOTE: while n6502_run() is executing, the live registers are held in locals
+    // inside the dispatch loop.  They are written back here before any trap
+    // callback and when the run returns, so memory callbacks that merely log the PC
+    // may see a stale value.
+    N6502Regs_t regs;
 
 #ifdef SEGMENTED_6502
-    uint8_t (*read_mem) (uint16_t addr);
-    void    (*write_mem)(uint16_t addr, uint8_t data);
+    // The bus carries an opaque context so that several CPUs (and the systems
+    // around them) can coexist in one process
+    uint8_t (*read_mem) (void *ctx, uint16_t addr);
+    void    (*write_mem)(void *ctx, uint16_t addr, uint8_t data);
+    void    *mem_ctx;
+
+    // Optional: true if an unmapped address may be polled repeatedly without
+    // changing the outcome once it has been read (eg. the NES PPU status)
+    int     (*read_idempotent)(void *ctx, uint16_t addr);
+
+    // Optional: the ROM bank mapped at addr (-1 if none), for the profiler
+    int     (*bank_of)(void *ctx, uint16_t addr);
+
+    N6502PageTable_t *pages; // Owned by whoever installed the bus
+
+    // Pre-decoded basic blocks (NULL unless enabled); code_bits flags every
+    // address covered by a cached block so that writes can invalidate it
+    struct N6502BlockCache *block_cache;
+    uint8_t *code_bits;
+
+    // Writes that went to write_mem rather than the page table.  A cached block
+    // stops after one, since the write may have added cycles (eg. sprite DMA)
+    uint32_t bus_writes;
 #else
     uint8_t mem[0xffff + 1];
 #endif
@@ -47,6 +182,11 @@ typedef struct N6502
     int enable_decimal;
     uint16_t min_pc;
 
+    // Selected by n6502_select_core(): the 2A03 or generic 6502 fast core, the
+    // trace core when tracing, or the debug core when stepping, dumps,
+    // heartbeats or the profiler are enabled (or after a breakpoint hit)
+    N6502Core_t core;
+
     int64_t inst_count;
     int64_t cycle;
     int64_t heartbeat_at;
@@ -56,15 +196,37 @@ typedef struct N6502
 
     int stopped;
 
-    void (*dump_state_func)(void *ptr);
-    void *dump_state_ptr;
+    // Optional: the PPU dot and scanline (nestest numbering) for traces and dumps
+    void (*trace_position)(void *ptr, int *dot, int *scanline);
+    void *trace_position_ptr;
 
-    void (*trigger)(void *p);
-    int64_t trigger_cycle;
-    void *trigger_ptr;
+    // Set by the owner's scheduler: runs stop at the first instruction boundary
+    // at or past this cycle, so that the event can be fired
+    int64_t event_cycle;
 
     void (*debug_trap)(struct N6502 *cpu);
 
+    struct N6502Profile *profile; // NULL unless profiling
+    struct N6502Trace *trace;     // NULL unless tracing
+    struct N6502Watch *watch;     // NULL unless a breakpoint or watchpoint was set
+    struct N6502Aot *aot;         // NULL unless translated code was loaded for the ROM
+    struct N6502Lockstep *lockstep; // NULL unless checked against a reference CPU
+
+    // Idle-loop detection: the last backward branch taken, and the register
+    // file at the loop head when it was taken
+    struct
+    {
+        int32_t branch_pc; // -1 if there is no candidate loop
+        int pure;
+        int iterations;
+        N6502Regs_t regs;
+        int64_t cycle;
+        int64_t inst_count;
+
+        uint64_t skipped_cycles;
+        uint64_t skips;
+    } idle;
+
     struct
     {
         int dump;
@@ -76,7 +238,19 @@ typedef struct N6502
         int skip;       // FIXME: should go in c64 harness
 
         int step;
-        uint16_t breakpoint;
+
+        int block_cache;
+        int idle_skip;
+        int fuse;       // Superinstructions in the block cache (needs block_cache)
+
+        const char *profile; // Folded-stack output path; enables the profiler
+
+        const char *trace;   // Binary instruction trace path (see n6502_trace.h)
+        uint32_t trace_last; // Keep only this many instructions (0: everything)
+
+        const char *aot;     // Directory of translated PRG ROMs (see n6502_aot.h)
+
+        unsigned lockstep;   // Instructions per lockstep comparison (0: off)
     } options;
 } N6502_t;
 
@@ -85,15 +259,31 @@ typedef struct N6502
 void n6502_init(N6502_t *cpu);
 void n6502_reset(N6502_t *cpu);
 void n6502_dump_state(N6502_t *cpu);
-const char *n6502_dis(N6502_t *cpu);
+void n6502_disassemble(N6502_t *cpu);
+const char *n6502_dis(N6502_t *cpu, char *dis, size_t size);
 void n6502_step(N6502_t *cpu);
 void n6502_nmi(N6502_t *cpu);
 void n6502_irq(N6502_t *cpu);
 void n6502_run(N6502_t *cpu, int64_t max_cycles, int hard_limit);
 void n6502_run_until_stopped(N6502_t *cpu, int64_t max_instructions);
+void n6502_select_core(N6502_t *cpu);
+
+void n6502_block_cache_init(N6502_t *cpu);
+void n6502_block_cache_destroy(N6502_t *cpu);
+void n6502_block_cache_flush(N6502_t *cpu);
+void n6502_block_cache_write(N6502_t *cpu, uint16_t addr);
+void n6502_block_cache_stats(N6502_t *cpu);
+void n6502_block_cache_yield(N6502_t *cpu);
+
+void n6502_idle_stats(N6502_t *cpu);
+
+const char *n6502_op_name(uint8_t op);
 
 // --------------------------------------------------------------------------------
 #define STACK_BASE     0x100
+#define NMI_VECTOR     0xfffa
+#define RESET_VECTOR   0xfffc
+#define IRQ_VECTOR     0xfffe
 #define OP_DEBUG_TRAP  0x02
 
 //#ifdef DEBUG
@@ -104,8 +294,82 @@ void n6502_run_until_stopped(N6502_t *cpu, int64_t max_instructions);
 //
 #ifdef SEGMENTED_6502
 
-#define WRITE_MEM(a,v) cpu->write_mem(a,v)
-#define READ_MEM(a)    cpu->read_mem(a)
+// Slow paths for pages unmapped by a watch (see n6502_watch.h)
+uint8_t n6502_watch_read(N6502_t *cpu, uint16_t addr);
+void    n6502_watch_write(N6502_t *cpu, uint16_t addr, uint8_t data);
+uint8_t n6502_watch_fetch(N6502_t *cpu, uint16_t pc);
+
+// Bus accesses recorded for a lockstep reference CPU (see n6502_lockstep.h)
+uint8_t n6502_lockstep_read(N6502_t *cpu, uint16_t addr);
+void    n6502_lockstep_write(N6502_t *cpu, uint16_t addr, uint8_t data);
+
+static ALWAYS_INLINE void writemem(N6502_t *cpu, uint16_t addr, uint8_t data)
+{
+    uint8_t *page = cpu->pages->write[addr >> 8];
+    if(page)
+    {
+        page[addr & 0xff] = data;
+    }
+    else if(cpu->watch)
+    {
+        n6502_watch_write(cpu, addr, data);
+    }
+    else if(cpu->lockstep)
+    {
+        n6502_lockstep_write(cpu, addr, data);
+    }
+    else
+    {
+        cpu->write_mem(cpu->mem_ctx, addr, data);
+        cpu->bus_writes++;
+    }
+
+    // Self-modifying code: drop any cached block covering this address
+    if(cpu->code_bits && (cpu->code_bits[addr >> 3] & (1 << (addr & 7))))
+    {
+        n6502_block_cache_write(cpu, addr);
+    }
+}
+
+static ALWAYS_INLINE uint8_t readmem(N6502_t *cpu, uint16_t addr)
+{
+    const uint8_t *page = cpu->pages->read[addr >> 8];
+    if(page)
+    {
+        return page[addr & 0xff];
+    }
+
+    if(cpu->watch)
+        return n6502_watch_read(cpu, addr);
+
+    if(cpu->lockstep)
+        return n6502_lockstep_read(cpu, addr);
+
+    return cpu->read_mem(cpu->mem_ctx, addr);
+}
+
+// Opcode fetches are told apart from data reads so that execution breakpoints
+// can be checked on the slow path
+static ALWAYS_INLINE uint8_t fetchop(N6502_t *cpu, uint16_t pc)
+{
+    const uint8_t *page = cpu->pages->read[pc >> 8];
+    if(page)
+    {
+        return page[pc & 0xff];
+    }
+
+    if(cpu->watch)
+        return n6502_watch_fetch(cpu, pc);
+
+    if(cpu->lockstep)
+        return n6502_lockstep_read(cpu, pc);
+
+    return cpu->read_mem(cpu->mem_ctx, pc);
+}
+
+#define WRITE_MEM(a,v) writemem(cpu, a, v)
+#define READ_MEM(a)    readmem(cpu, a)
+#define FETCH_OP(pc)   fetchop(cpu, pc)
 
 #else
 
@@ -121,24 +385,40 @@ static inline uint16_t readmem(N6502_t *cpu, uint16_t addr)
 
 #define WRITE_MEM(a,v) writemem(cpu, a, v)
 #define READ_MEM(a)    readmem(cpu, a)
+#define FETCH_OP(pc)   readmem(cpu, pc)
 #endif
 
-#define FLAG(f)   cpu->regs.P.bits.f
+// All register access goes through CPU_REGS so that the dispatch core can rebind
+// it to a register file held in locals
+#define CPU_REGS  cpu->regs
+
+// C, V, I and D are stored as 0/1; Z and N are read-only views of the last
+// result and are set with SET_Z/SET_N
+#define FLAG(f)   FLAG_##f
+#define FLAG_C    CPU_REGS.C
+#define FLAG_V    CPU_REGS.V
+#define FLAG_I    CPU_REGS.I
+#define FLAG_D    CPU_REGS.D
+#define FLAG_Z    (CPU_REGS.ZR == 0)
+#define FLAG_N    (CPU_REGS.NR >> 7)
+
+#define GET_P()   n6502_get_p(&CPU_REGS)
+#define SET_P(p)  n6502_set_p(&CPU_REGS, (p))
 
-#define SET_Z(v)  FLAG(Z) = ((v) == 0)
-#define SET_N(v)  FLAG(N) = ((v) >> 7)
-#define SET_ZN(v) SET_Z(v); SET_N(v)
+#define SET_Z(v)  CPU_REGS.ZR = (v)
+#define SET_N(v)  CPU_REGS.NR = (v)
+#define SET_ZN(v) CPU_REGS.ZR = CPU_REGS.NR = (v)
 
-#define SET_A(v) cpu->regs.A = (v); SET_ZN(cpu->regs.A)
-#define SET_X(v) cpu->regs.X = (v); SET_ZN(cpu->regs.X)
-#define SET_Y(v) cpu->regs.Y = (v); SET_ZN(cpu->regs.Y)
+#define SET_A(v) CPU_REGS.A = (v); SET_ZN(CPU_REGS.A)
+#define SET_X(v) CPU_REGS.X = (v); SET_ZN(CPU_REGS.X)
+#define SET_Y(v) CPU_REGS.Y = (v); SET_ZN(CPU_REGS.Y)
 
 #define ADDR16(A)  (READ_MEM((A)) | (READ_MEM((A) + 1) << 8))
 
-#define IMM8(r)  (READ_MEM(cpu->regs.PC++))
-#define IMM16()  (ADDR16(cpu->regs.PC))
+#define IMM8(r)  (READ_MEM(CPU_REGS.PC++))
+#define IMM16()  (ADDR16(CPU_REGS.PC))
 
-static inline uint16_t _WORD16(N6502_t *cpu, uint16_t addr)
+static ALWAYS_INLINE uint16_t _WORD16(N6502_t *cpu, uint16_t addr)
 {
     // Glitch: For indirect reads [nnnn] the operand word cannot cross page boundaries,
     // ie. [03FFh] would fetch the MSB from [0300h] instead of [0400h].
@@ -155,10 +435,10 @@ static inline uint16_t _WORD16(N6502_t *cpu, uint16_t addr)
 #define READ_STACK(i)     READ_MEM(STACK_BASE + (i))
 #define WRITE_STACK(i, v) WRITE_MEM(STACK_BASE + (i), v)
 
-#define PUSH_STACK(v) WRITE_STACK(cpu->regs.S--, v)
-#define POP_STACK()   READ_STACK(++cpu->regs.S)
+#define PUSH_STACK(v) WRITE_STACK(CPU_REGS.S--, v)
+#define POP_STACK()   READ_STACK(++CPU_REGS.S)
 
-#define PUSH_PC() { PUSH_STACK(cpu->regs.PC >> 8); PUSH_STACK(cpu->regs.PC & 0xff); }
-#define POP_PC()  { cpu->regs.PC = POP_STACK(); cpu->regs.PC |= POP_STACK() << 8; }
+#define PUSH_PC() { PUSH_STACK(CPU_REGS.PC >> 8); PUSH_STACK(CPU_REGS.PC & 0xff); }
+#define POP_PC()  { CPU_REGS.PC = POP_STACK(); CPU_REGS.PC |= POP_STACK() << 8; }
 
 #endif
@@ -0,0 +1,159 @@
+#include "n6502_aot.h"
+#include "common.h"
+#include "log.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+#ifndef WIN32
+
+static int
+n6502_aot_check(const N6502AotModule_t *module, const char *path, uint32_t crc, uint32_t prg_size)
+{
+    uint32_t i;
+
+    if(module->version != N6502_AOT_VERSION || module->cpu_size != sizeof(N6502_t))
+    {
+        NOTIFY("AOT: %s was built for another version of the CPU core; ignoring it\n", path);
+        return 0;
+    }
+
+    if(module->crc != crc || module->prg_size != prg_size)
+    {
+        NOTIFY("AOT: %s was built for another ROM; ignoring it\n", path);
+        return 0;
+    }
+
+    for(i = 0; i < module->num_blocks; i++)
+    {
+        const N6502AotBlockDesc_t *desc = &module->blocks[i];
+
+        if(desc->rom_offset < (desc->pc & 0xff) || desc->rom_offset >= prg_size || desc->count == 0)
+        {
+            NOTIFY("AOT: %s: bad block @ %04Xh; ignoring it\n", path, desc->pc);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int
+n6502_aot_load(N6502_t *cpu, const char *dir, const uint8_t *prg, uint32_t prg_size)
+{
+    const uint32_t crc = crc32_update(0, prg, prg_size);
+    const N6502AotModule_t *module;
+    N6502Aot_t *aot;
+    char path[1024];
+    void *handle;
+    uint32_t i;
+
+    n6502_aot_unload(cpu);
+
+    snprintf(path, sizeof(path), "%s/%08X.so", dir, crc);
+
+    // Not every ROM has been translated
+    if(access(path, R_OK) != 0)
+    {
+        NOTIFY("AOT: no translation for PRG CRC %08X\n", crc);
+        return 0;
+    }
+
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if(! handle)
+    {
+        NOTIFY("AOT: %s\n", dlerror());
+        return 0;
+    }
+
+    module = dlsym(handle, N6502_AOT_MODULE_SYMBOL);
+    if(! module || ! n6502_aot_check(module, path, crc, prg_size))
+    {
+        if(! module)
+            NOTIFY("AOT: %s has no %s\n", path, N6502_AOT_MODULE_SYMBOL);
+
+        dlclose(handle);
+        return 0;
+    }
+
+    aot = calloc(1, sizeof(*aot));
+    ASSERT(aot, "Failed to allocate AOT state\n");
+
+    aot->entries = calloc(module->num_blocks ? module->num_blocks : 1, sizeof(N6502AotEntry_t));
+    ASSERT(aot->entries, "Failed to allocate %u AOT entries\n", module->num_blocks);
+
+    aot->handle = handle;
+    aot->module = module;
+
+    for(i = 0; i < module->num_blocks; i++)
+    {
+        const N6502AotBlockDesc_t *desc = &module->blocks[i];
+        N6502AotEntry_t *entry = &aot->entries[i];
+
+        // Page-table entries point into PRG ROM, so the page pointer identifies
+        // both the bank and the window it is mapped in
+        entry->page = prg + desc->rom_offset - (desc->pc & 0xff);
+        entry->desc = desc;
+        entry->next = aot->by_pc[desc->pc];
+        aot->by_pc[desc->pc] = entry;
+    }
+
+    cpu->aot = aot;
+
+    NOTIFY("AOT: loaded %s (%u blocks)\n", path, module->num_blocks);
+
+    return 1;
+}
+
+void
+n6502_aot_unload(N6502_t *cpu)
+{
+    N6502Aot_t *aot = cpu->aot;
+
+    if(! aot)
+        return;
+
+    // Leave the CPU on a core that does not call into the module
+    cpu->aot = NULL;
+    n6502_select_core(cpu);
+
+    dlclose(aot->handle);
+    free(aot->entries);
+    free(aot);
+}
+
+#else
+
+int
+n6502_aot_load(N6502_t *cpu, const char *dir, const uint8_t *prg, uint32_t prg_size)
+{
+    NOTIFY("AOT: not supported on this platform\n");
+    return 0;
+}
+
+void
+n6502_aot_unload(N6502_t *cpu)
+{
+}
+
+#endif
+
+void
+n6502_aot_stats(N6502_t *cpu)
+{
+    N6502Aot_t *aot = cpu->aot;
+
+    if(! aot)
+        return;
+
+    NOTIFY("AOT: %" PRIu64 " blocks run, %" PRIu64 " instructions (%.2f%% of all)\n",
+           aot->blocks_run, aot->insns_run,
+           cpu->inst_count ? (100.0 * aot->insns_run / cpu->inst_count) : 0.0);
+}
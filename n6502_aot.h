@@ -0,0 +1,99 @@
+#ifndef __n6502_aot_h__
+#define __n6502_aot_h__
+
+#include "n6502.h"
+
+// Ahead-of-time translated PRG ROM
+//
+// tools/n6502_recompile.c walks the code reachable from the vectors of a
+// mapper 0 or 2 cartridge and emits it as C: one function per basic block,
+// built from the same instruction handlers as the dispatch core (n6502_ops.h),
+// so the cycle accounting and every bus access are exactly those of the
+// interpreter.  The C is compiled into a shared object named after the CRC-32
+// of the PRG ROM, and loaded when a ROM with that CRC is.
+//
+// A translated block is entered from the dispatcher under the same checks as a
+// cached block, and only while the page it was translated from is mapped at its
+// PC; everything else (code in RAM, banks the translator could not follow, and
+// any run with breakpoints or watchpoints set) is interpreted as before.
+
+#define N6502_AOT_VERSION 2
+
+#define N6502_AOT_MODULE_SYMBOL "n6502_aot_module"
+
+// Runs the block from its first instruction on cpu->regs; returns the number of
+// instructions executed, which is short of the block's if it wrote to the bus
+// (a bank switch, or I/O that may have added cycles) part way through
+typedef unsigned (*N6502AotFunc_t)(N6502_t *cpu, N6502Regs_t *regs);
+
+typedef struct
+{
+    uint16_t pc;
+    uint16_t count;
+    uint32_t rom_offset;          // Of the first opcode, from the start of PRG ROM
+    uint32_t cycles_before_last;  // As N6502Block_t
+    uint32_t cycles_through_last;
+    int32_t  branch_pc;           // Trailing relative branch (-1 if none)
+    N6502AotFunc_t func;
+} N6502AotBlockDesc_t;
+
+// Exported by every module as N6502_AOT_MODULE_SYMBOL
+typedef struct
+{
+    uint32_t version;
+    uint32_t cpu_size; // sizeof(N6502_t) the module was built against
+    uint32_t crc;
+    uint32_t prg_size;
+    uint32_t num_blocks;
+    const N6502AotBlockDesc_t *blocks;
+} N6502AotModule_t;
+
+typedef struct N6502AotEntry
+{
+    const uint8_t *page; // Read page that must be mapped at desc->pc
+    const N6502AotBlockDesc_t *desc;
+    struct N6502AotEntry *next;
+} N6502AotEntry_t;
+
+typedef struct N6502Aot
+{
+    void *handle;
+    const N6502AotModule_t *module;
+
+    // Chained by PC: a switchable bank may hold a block at the same address in
+    // each of its banks
+    N6502AotEntry_t *entries;
+    N6502AotEntry_t *by_pc[0xffff + 1];
+
+    uint64_t blocks_run;
+    uint64_t insns_run;
+} N6502Aot_t;
+
+// Loads DIR/<CRC>.so for the PRG ROM at prg, which must be the memory that the
+// page table maps.  Returns 0 if there is no module for this ROM.  Call
+// n6502_select_core() afterwards.
+int  n6502_aot_load(N6502_t *cpu, const char *dir, const uint8_t *prg, uint32_t prg_size);
+void n6502_aot_unload(N6502_t *cpu);
+void n6502_aot_stats(N6502_t *cpu);
+
+// The translated block at pc under the current mapping, or NULL
+static ALWAYS_INLINE const N6502AotBlockDesc_t *
+n6502_aot_lookup(N6502_t *cpu, uint16_t pc)
+{
+    const uint8_t *page = cpu->pages->read[pc >> 8];
+    const N6502AotEntry_t *entry;
+
+    // Watch hits stop between instructions, which a translated block has none of
+    if(! page || cpu->watch)
+        return NULL;
+
+    for(entry = cpu->aot->by_pc[pc]; entry; entry = entry->next)
+    {
+        if(entry->page == page)
+            return entry->desc;
+    }
+
+    return NULL;
+}
+
+#endif
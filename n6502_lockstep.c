@@ -0,0 +1,555 @@
+#include "n6502_lockstep.h"
+#include "log.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void *
+lockstep_grow(void *ptr, uint32_t *capacity, size_t size)
+{
+    *capacity = *capacity ? *capacity * 2 : 256;
+    ptr = realloc(ptr, *capacity * size);
+    ASSERT(ptr, "Failed to grow lockstep log\n");
+    return ptr;
+}
+
+static N6502LockstepEvent_t *
+lockstep_event(N6502Lockstep_t *ls, N6502LockstepKind_t kind, uint16_t addr, uint8_t data)
+{
+    N6502LockstepEvent_t *event;
+
+    if(ls->num_events == ls->events_capacity)
+        ls->events = lockstep_grow(ls->events, &ls->events_capacity, sizeof(N6502LockstepEvent_t));
+
+    event = &ls->events[ls->num_events++];
+    event->kind = kind;
+    event->addr = addr;
+    event->data = data;
+    event->cycles = 0;
+    event->index = 0;
+
+    return event;
+}
+
+// Only the first mismatch in a chunk is kept; the reference may go anywhere
+// after it
+static void
+lockstep_mismatch(N6502Lockstep_t *ls, const char *fmt, ...)
+{
+    va_list ap;
+
+    if(ls->reason[0])
+        return;
+
+    va_start(ap, fmt);
+    vsnprintf(ls->reason, sizeof(ls->reason), fmt, ap);
+    va_end(ap);
+}
+
+// --------------------------------------------------------------------------------
+// Page tables
+
+static uint8_t *
+lockstep_private_page(N6502Lockstep_t *ls, const uint8_t *src, int create)
+{
+    N6502LockstepPage_t *page;
+    unsigned i;
+
+    for(i = 0; i < ls->num_ram; i++)
+    {
+        if(ls->ram[i].src == src)
+            return ls->ram[i].data;
+    }
+
+    if(! create)
+        return NULL;
+
+    // Pages never move while attached: ref_pages points into them
+    ASSERT(ls->num_ram < ls->ram_capacity, "Too many lockstep RAM pages\n");
+
+    // New RAM (eg. a RAM bank switched in) starts as the owner has it now
+    page = &ls->ram[ls->num_ram++];
+    page->src = src;
+    memcpy(page->data, src, N6502_PAGE_SIZE);
+
+    return page->data;
+}
+
+// The reference sees private copies of every writable page, the owner's ROM,
+// and nothing (the log) for I/O
+static void
+lockstep_map_ref(N6502Lockstep_t *ls, const N6502PageTable_t *bus)
+{
+    unsigned page;
+
+    for(page = 0; page < N6502_NUM_PAGES; page++)
+    {
+        const uint8_t *r = bus->read[page];
+
+        ls->ref_write[page] = bus->write[page] ? lockstep_private_page(ls, bus->write[page], 1) : NULL;
+
+        if(r == ls->ref_src[page])
+            continue;
+
+        ls->ref_src[page] = r;
+        if(r)
+        {
+            uint8_t *data = lockstep_private_page(ls, r, 0);
+            ls->ref_pages.read[page] = data ? data : (uint8_t *) r;
+        }
+        else
+        {
+            ls->ref_pages.read[page] = NULL;
+        }
+    }
+}
+
+// Picks up bank switches; every write stays unmapped so that it can be logged
+static void
+lockstep_sync(N6502Lockstep_t *ls)
+{
+    unsigned page;
+
+    if(memcmp(&ls->bus_seen, ls->bus, sizeof(N6502PageTable_t)) == 0)
+        return;
+
+    ls->bus_seen = *ls->bus;
+    memcpy(ls->fast_pages.read, ls->bus->read, sizeof(ls->bus->read));
+
+    // Copied now, while the owner's RAM is as the reference will find it
+    for(page = 0; page < N6502_NUM_PAGES; page++)
+    {
+        if(ls->bus->write[page])
+            lockstep_private_page(ls, ls->bus->write[page], 1);
+    }
+
+    if(ls->num_maps == ls->maps_capacity)
+        ls->maps = lockstep_grow(ls->maps, &ls->maps_capacity, sizeof(N6502PageTable_t));
+
+    ls->maps[ls->num_maps] = *ls->bus;
+    lockstep_event(ls, N6502_LOCKSTEP_MAP, 0, 0)->index = ls->num_maps++;
+}
+
+// --------------------------------------------------------------------------------
+// Checked CPU: everything the reference cannot do itself goes into the log
+
+uint8_t
+n6502_lockstep_read(N6502_t *cpu, uint16_t addr)
+{
+    N6502Lockstep_t *ls = cpu->lockstep;
+    const int64_t cycle = cpu->cycle;
+    uint8_t data = cpu->read_mem(cpu->mem_ctx, addr);
+
+    lockstep_event(ls, N6502_LOCKSTEP_READ, addr, data)->cycles = cpu->cycle - cycle;
+
+    return data;
+}
+
+void
+n6502_lockstep_write(N6502_t *cpu, uint16_t addr, uint8_t data)
+{
+    N6502Lockstep_t *ls = cpu->lockstep;
+    uint8_t *page = ls->bus->write[addr >> 8];
+    const int64_t cycle = cpu->cycle;
+    uint32_t index = ls->num_events;
+
+    lockstep_event(ls, N6502_LOCKSTEP_WRITE, addr, data);
+
+    if(page)
+    {
+        page[addr & 0xff] = data;
+    }
+    else
+    {
+        cpu->write_mem(cpu->mem_ctx, addr, data);
+        cpu->bus_writes++;
+
+        // The log may have grown during the callback (DMA reads)
+        ls->events[index].cycles = cpu->cycle - cycle;
+        lockstep_sync(ls);
+    }
+}
+
+static void
+lockstep_fast_trap(N6502_t *cpu)
+{
+    N6502Lockstep_t *ls = cpu->lockstep;
+    N6502LockstepEvent_t *end;
+    const int64_t cycle = cpu->cycle;
+
+    lockstep_event(ls, N6502_LOCKSTEP_TRAP, cpu->regs.PC, 0);
+
+    ls->owner_trap(cpu);
+
+    if(ls->num_traps == ls->traps_capacity)
+        ls->traps = lockstep_grow(ls->traps, &ls->traps_capacity, sizeof(N6502LockstepTrap_t));
+
+    ls->traps[ls->num_traps].regs = cpu->regs;
+    ls->traps[ls->num_traps].stopped = cpu->stopped;
+
+    end = lockstep_event(ls, N6502_LOCKSTEP_TRAP_END, cpu->regs.PC, 0);
+    end->index = ls->num_traps++;
+    end->cycles = cpu->cycle - cycle;
+}
+
+// --------------------------------------------------------------------------------
+// Reference CPU: replays the log
+
+static const N6502LockstepEvent_t *
+lockstep_next(N6502Lockstep_t *ls)
+{
+    while(ls->head < ls->num_events && ls->events[ls->head].kind == N6502_LOCKSTEP_MAP)
+    {
+        lockstep_map_ref(ls, &ls->maps[ls->events[ls->head].index]);
+        ls->head++;
+    }
+
+    return (ls->head < ls->num_events) ? &ls->events[ls->head] : NULL;
+}
+
+// A bank switch has to be in place before the reference's next fetch, which
+// may not come through here
+static void
+lockstep_consume(N6502Lockstep_t *ls)
+{
+    ls->head++;
+    lockstep_next(ls);
+}
+
+static uint8_t
+lockstep_ref_read(void *ctx, uint16_t addr)
+{
+    N6502Lockstep_t *ls = (N6502Lockstep_t *) ctx;
+    N6502_t *cpu = ls->cpu;
+    const N6502LockstepEvent_t *event = lockstep_next(ls);
+
+    if(event && event->kind == N6502_LOCKSTEP_READ && event->addr == addr)
+    {
+        lockstep_consume(ls);
+        ls->ref.cycle += event->cycles;
+        ls->io_last[addr] = event->data;
+        ls->io_valid[addr] = 1;
+        return event->data;
+    }
+
+    // A read the checked CPU skipped over in an idle loop
+    if(ls->io_valid[addr] && cpu->read_idempotent && cpu->read_idempotent(cpu->mem_ctx, addr))
+        return ls->io_last[addr];
+
+    lockstep_mismatch(ls, "reference read $%04X, checked CPU %s", addr,
+                      ! event ? "did not" :
+                      event->kind == N6502_LOCKSTEP_READ ? "read another address" :
+                      event->kind == N6502_LOCKSTEP_WRITE ? "wrote" : "trapped");
+    return 0xff;
+}
+
+static void
+lockstep_ref_apply(N6502Lockstep_t *ls, uint16_t addr, uint8_t data)
+{
+    uint8_t *page = ls->ref_write[addr >> 8];
+
+    // Private RAM only; ROM and I/O writes were the owner's business
+    if(page)
+        page[addr & 0xff] = data;
+}
+
+static void
+lockstep_ref_write(void *ctx, uint16_t addr, uint8_t data)
+{
+    N6502Lockstep_t *ls = (N6502Lockstep_t *) ctx;
+    const N6502LockstepEvent_t *event = lockstep_next(ls);
+
+    if(! event || event->kind != N6502_LOCKSTEP_WRITE || event->addr != addr || event->data != data)
+    {
+        if(event && event->kind == N6502_LOCKSTEP_WRITE)
+        {
+            lockstep_mismatch(ls, "reference wrote $%04X <= %02Xh, checked CPU $%04X <= %02Xh",
+                              addr, data, event->addr, event->data);
+        }
+        else
+        {
+            lockstep_mismatch(ls, "reference wrote $%04X <= %02Xh, checked CPU did not", addr, data);
+        }
+
+        return;
+    }
+
+    lockstep_consume(ls);
+    ls->ref.cycle += event->cycles;
+    lockstep_ref_apply(ls, addr, data);
+}
+
+static void
+lockstep_ref_trap(N6502_t *ref)
+{
+    N6502Lockstep_t *ls = (N6502Lockstep_t *) ref->mem_ctx;
+    const N6502LockstepEvent_t *event = lockstep_next(ls);
+
+    if(! event || event->kind != N6502_LOCKSTEP_TRAP || event->addr != ref->regs.PC)
+    {
+        lockstep_mismatch(ls, "reference trapped @ %04Xh, checked CPU did not", ref->regs.PC);
+        return;
+    }
+
+    ls->head++;
+
+    // Take on whatever the owner's handler did to the checked CPU
+    while((event = lockstep_next(ls)) != NULL)
+    {
+        ls->head++;
+
+        if(event->kind == N6502_LOCKSTEP_WRITE)
+        {
+            lockstep_ref_apply(ls, event->addr, event->data);
+        }
+        else if(event->kind == N6502_LOCKSTEP_TRAP_END)
+        {
+            ref->regs = ls->traps[event->index].regs;
+            ref->stopped = ls->traps[event->index].stopped;
+            ref->cycle += event->cycles;
+            lockstep_next(ls);
+            break;
+        }
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+static void
+lockstep_dump_regs(const char *who, const N6502_t *cpu)
+{
+    NOTIFY("  %-10s PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%" PRId64 " INSN:%" PRId64 "\n",
+           who, cpu->regs.PC, cpu->regs.A, cpu->regs.X, cpu->regs.Y,
+           n6502_get_p(&cpu->regs), cpu->regs.S, cpu->cycle, cpu->inst_count);
+}
+
+static void
+lockstep_report(N6502Lockstep_t *ls)
+{
+    const N6502Trace_t *trace = ls->ref.trace;
+    char line[N6502_TRACE_LINE_SIZE];
+    uint64_t i;
+
+    // The checked core may have stopped before the chunk ran anything
+    if((uint64_t) ls->ref.inst_count == ls->instructions)
+    {
+        NOTIFY("\nLockstep: CPUs diverged at instruction %" PRIu64 ", before the chunk ran: %s\n",
+               ls->instructions, ls->reason);
+    }
+    else
+    {
+        NOTIFY("\nLockstep: CPUs diverged in instructions %" PRIu64 "-%" PRId64 ": %s\n",
+               ls->instructions, ls->ref.inst_count, ls->reason);
+    }
+
+    lockstep_dump_regs("reference", &ls->ref);
+    lockstep_dump_regs("checked", ls->cpu);
+
+    NOTIFY("  Last reference instructions:\n");
+    for(i = (trace->count > trace->capacity) ? trace->count - trace->capacity : 0; i < trace->count; i++)
+    {
+        n6502_trace_format(&trace->records[i & (trace->capacity - 1)], line, sizeof(line));
+        NOTIFY("    %s\n", line);
+    }
+
+    ls->diverged = 1;
+    ls->cpu->stopped = 1;
+}
+
+// Both CPUs are at the same instruction boundary
+static int
+lockstep_compare(N6502Lockstep_t *ls)
+{
+    const N6502_t *cpu = ls->cpu;
+    const N6502_t *ref = &ls->ref;
+
+    if(lockstep_next(ls))
+        lockstep_mismatch(ls, "checked CPU made %u more bus accesses", ls->num_events - ls->head);
+
+    if(! ls->reason[0])
+    {
+        if(ref->regs.A != cpu->regs.A || ref->regs.X != cpu->regs.X || ref->regs.Y != cpu->regs.Y ||
+           ref->regs.S != cpu->regs.S || ref->regs.PC != cpu->regs.PC ||
+           n6502_get_p(&ref->regs) != n6502_get_p(&cpu->regs))
+        {
+            lockstep_mismatch(ls, "registers differ");
+        }
+        else if(ref->cycle != cpu->cycle)
+        {
+            lockstep_mismatch(ls, "cycle counts differ by %" PRId64, cpu->cycle - ref->cycle);
+        }
+        else if(ref->inst_count != cpu->inst_count)
+        {
+            lockstep_mismatch(ls, "instruction counts differ");
+        }
+    }
+
+    if(ls->reason[0])
+    {
+        lockstep_report(ls);
+        return 0;
+    }
+
+    // Start the next chunk's log
+    ls->num_events = ls->head = 0;
+    ls->num_traps = 0;
+    ls->num_maps = 0;
+    ls->instructions = ref->inst_count;
+
+    return 1;
+}
+
+static void
+lockstep_sink(void *ptr, const N6502TraceRecord_t *records, uint32_t count)
+{
+    // The ring only keeps the context for a report
+}
+
+void
+n6502_lockstep_attach(N6502_t *cpu, unsigned chunk)
+{
+    N6502Lockstep_t *ls;
+    N6502_t *ref;
+
+    ASSERT(cpu->lockstep == NULL, "Already in lockstep\n");
+    ASSERT(cpu->watch == NULL, "Lockstep does not work with watches\n");
+
+    ls = calloc(1, sizeof(*ls));
+    ASSERT(ls, "Failed to allocate lockstep state\n");
+
+    ls->cpu = cpu;
+    ls->chunk = chunk ? chunk : N6502_LOCKSTEP_CHUNK;
+    ls->bus = cpu->pages;
+    ls->owner_trap = cpu->debug_trap;
+
+    // 256K of banked RAM
+    ls->ram_capacity = N6502_NUM_PAGES * 4;
+    ls->ram = calloc(ls->ram_capacity, sizeof(N6502LockstepPage_t));
+    ASSERT(ls->ram, "Failed to allocate lockstep RAM\n");
+
+    // Every page starts out changed
+    memset(ls->ref_src, 0xff, sizeof(ls->ref_src));
+    lockstep_map_ref(ls, ls->bus);
+    ls->bus_seen = *ls->bus;
+    memcpy(ls->fast_pages.read, ls->bus->read, sizeof(ls->bus->read));
+
+    ref = &ls->ref;
+    n6502_init(ref);
+    ref->read_mem = lockstep_ref_read;
+    ref->write_mem = lockstep_ref_write;
+    ref->mem_ctx = ls;
+    ref->pages = &ls->ref_pages;
+    ref->debug_trap = lockstep_ref_trap;
+    ref->enable_decimal = cpu->enable_decimal;
+    ref->regs = cpu->regs;
+    ref->cycle = cpu->cycle;
+    ref->inst_count = cpu->inst_count;
+    ref->stopped = cpu->stopped;
+    n6502_trace_attach(ref, N6502_LOCKSTEP_CONTEXT, lockstep_sink, NULL);
+    n6502_select_core(ref);
+
+    ls->instructions = cpu->inst_count;
+
+    cpu->pages = &ls->fast_pages;
+    if(cpu->debug_trap)
+        cpu->debug_trap = lockstep_fast_trap;
+    cpu->lockstep = ls;
+
+    NOTIFY("Lockstep: checking every %u instructions against the reference core\n", ls->chunk);
+}
+
+int
+n6502_lockstep_detach(N6502_t *cpu)
+{
+    N6502Lockstep_t *ls = cpu->lockstep;
+    int diverged;
+
+    if(! ls)
+        return 0;
+
+    // Unless stopped on a divergence, the CPUs are at the same boundary
+    if(! ls->diverged)
+        lockstep_compare(ls);
+
+    diverged = ls->diverged;
+    if(! diverged)
+    {
+        NOTIFY("Lockstep: %" PRIu64 " instructions in %" PRIu64 " chunks matched the reference core\n",
+               (uint64_t) cpu->inst_count, ls->chunks);
+    }
+
+    cpu->pages = ls->bus;
+    cpu->debug_trap = ls->owner_trap;
+    cpu->lockstep = NULL;
+
+    n6502_trace_close(&ls->ref);
+    free(ls->events);
+    free(ls->traps);
+    free(ls->maps);
+    free(ls->ram);
+    free(ls);
+
+    return diverged;
+}
+
+void
+n6502_lockstep_run(N6502_t *cpu, int64_t last_cycle, int hard_limit,
+                   int64_t max_instructions, int until_stopped)
+{
+    N6502Lockstep_t *ls = cpu->lockstep;
+    int64_t done = 0;
+
+    // Interrupts may have been delivered since the last run
+    if(ls->diverged || ! lockstep_compare(ls))
+        return;
+
+    while(done < max_instructions)
+    {
+        const int64_t start = cpu->inst_count;
+        const int64_t chunk = (max_instructions - done < ls->chunk) ? max_instructions - done : ls->chunk;
+        int64_t n;
+
+        lockstep_sync(ls);
+
+        cpu->core(cpu, last_cycle, hard_limit, chunk, until_stopped);
+
+        n = cpu->inst_count - start;
+        if(n == 0 && ls->num_events == 0)
+            break;
+
+        // The reference stops where its own limits say, so a core that runs
+        // past the cycle budget or the next event is caught out
+        ls->ref.event_cycle = cpu->event_cycle;
+        ls->ref.core(&ls->ref, last_cycle, hard_limit, chunk, until_stopped);
+        ls->chunks++;
+
+        if(ls->ref.inst_count - start != n)
+        {
+            lockstep_mismatch(ls, "checked CPU stopped after %" PRId64 " instructions, reference after %" PRId64,
+                              n, ls->ref.inst_count - start);
+        }
+
+        if(! lockstep_compare(ls))
+            break;
+
+        done += n;
+
+        // The core stopped short: at the cycle limit, an event or a stop
+        if(n < chunk || (until_stopped && cpu->stopped))
+            break;
+    }
+}
+
+void
+n6502_lockstep_interrupt(N6502_t *cpu, uint16_t vector)
+{
+    N6502Lockstep_t *ls = cpu->lockstep;
+
+    if(vector == NMI_VECTOR)
+        n6502_nmi(&ls->ref);
+    else
+        n6502_irq(&ls->ref);
+}
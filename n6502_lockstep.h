@@ -0,0 +1,129 @@
+#ifndef __n6502_lockstep_h__
+#define __n6502_lockstep_h__
+
+#include "n6502.h"
+#include "n6502_trace.h"
+
+// Lockstep differential execution
+//
+// A reference CPU (the plain interpreter: no block cache, translated code or
+// idle skipping) shadows the CPU being checked, and the two are compared after
+// every chunk of instructions: registers, cycle and instruction counts, and
+// every bus write in order.  The reference runs each chunk under the same cycle
+// budget and next event as the checked CPU, so the two must also stop at the
+// same instruction boundary.
+//
+// The reference never touches the owner's bus, so any system (NES, C64
+// harness) can be checked without running two of it.  While attached, all of
+// the checked CPU's writes and its reads of unmapped pages go through here and
+// are logged, along with the owner's side effects: cycles added from a bus
+// callback (eg. sprite DMA), debug traps, and bank switches.  The reference gets
+// private copies of the RAM pages and shares the ROM pages, checks its writes
+// against the log and replays everything else from it.
+//
+// The checked CPU runs in chunks, and idle-loop detection starts afresh with
+// every run, so loops longer than a chunk are never skipped; use a larger
+// chunk to check idle skipping.
+
+#define N6502_LOCKSTEP_CHUNK    16 // Default: one full block
+#define N6502_LOCKSTEP_CONTEXT  32 // Reference instructions shown on a divergence
+
+typedef enum
+{
+    N6502_LOCKSTEP_READ = 0, // Unmapped read, replayed
+    N6502_LOCKSTEP_WRITE,    // Compared, then applied to private RAM
+    N6502_LOCKSTEP_TRAP,     // Debug trap at addr...
+    N6502_LOCKSTEP_TRAP_END, // ...and the registers it left (traps[index])
+    N6502_LOCKSTEP_MAP,      // The owner's page table changed (maps[index])
+} N6502LockstepKind_t;
+
+typedef struct
+{
+    uint8_t  kind;
+    uint8_t  data;
+    uint16_t addr;
+    int32_t  cycles; // Added by the owner during the access
+    uint32_t index;
+} N6502LockstepEvent_t;
+
+typedef struct
+{
+    N6502Regs_t regs;
+    int stopped;
+} N6502LockstepTrap_t;
+
+typedef struct
+{
+    const uint8_t *src; // The owner's page
+    uint8_t data[N6502_PAGE_SIZE];
+} N6502LockstepPage_t;
+
+typedef struct N6502Lockstep
+{
+    N6502_t *cpu;
+    N6502_t ref;
+    unsigned chunk;
+
+    // The owner's bus; the checked CPU runs on fast_pages (every write
+    // unmapped) and the reference on ref_pages
+    N6502PageTable_t *bus;
+    N6502PageTable_t bus_seen; // As of the last MAP event
+    N6502PageTable_t fast_pages;
+    N6502PageTable_t ref_pages;
+    void (*owner_trap)(N6502_t *cpu);
+
+    // Private RAM for the reference, one copy per distinct owner page
+    N6502LockstepPage_t *ram;
+    unsigned num_ram;
+    unsigned ram_capacity;
+    const uint8_t *ref_src[N6502_NUM_PAGES];   // The owner's read page behind ref_pages
+    uint8_t *ref_write[N6502_NUM_PAGES];        // Private copy a write lands in (NULL: ROM, I/O)
+
+    // Since the start of the chunk
+    N6502LockstepEvent_t *events;
+    uint32_t num_events;
+    uint32_t events_capacity;
+    uint32_t head; // Next event for the reference
+
+    N6502LockstepTrap_t *traps;
+    uint32_t num_traps;
+    uint32_t traps_capacity;
+
+    N6502PageTable_t *maps;
+    uint32_t num_maps;
+    uint32_t maps_capacity;
+
+    // Last value the reference read at each unmapped address, for reads the
+    // checked CPU skipped (see read_idempotent)
+    uint8_t io_last[0xffff + 1];
+    uint8_t io_valid[0xffff + 1];
+
+    char reason[160]; // First bus mismatch in this chunk
+    int diverged;
+
+    uint64_t chunks;
+    uint64_t instructions;
+} N6502Lockstep_t;
+
+// Shadows cpu from its current state; the bus must be installed and the CPU
+// reset.  Not available together with watches.
+void n6502_lockstep_attach(N6502_t *cpu, unsigned chunk);
+
+// Returns non-zero if the CPUs diverged
+int  n6502_lockstep_detach(N6502_t *cpu);
+
+// Runs cpu->core in chunks and runs the reference over the same limits after
+// each one; stops the CPU on the first divergence
+void n6502_lockstep_run(N6502_t *cpu, int64_t last_cycle, int hard_limit,
+                        int64_t max_instructions, int until_stopped);
+
+// The owner interrupted the checked CPU; do the same to the reference
+void n6502_lockstep_interrupt(N6502_t *cpu, uint16_t vector);
+
+static inline int
+n6502_lockstep_diverged(N6502_t *cpu)
+{
+    return cpu->lockstep && cpu->lockstep->diverged;
+}
+
+#endif
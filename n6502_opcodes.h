@@ -0,0 +1,302 @@
+// 6502 opcode table
+//
+// NOTE: no include guard -- this file is included once per consumer with GEN_OP
+// defined to expand each entry (see n6502.c).  Each GEN_OP expansion supplies its
+// own separator.
+
+// DEBUG
+GEN_OP(OP_DEBUG_TRAP, 1, AM_IMPLIED, 0, 0, DEBUG_TRAP, "Debug TRAP")
+
+// CPU Control
+GEN_OP(0x18, 0, AM_IMPLIED, 2, 0, CLC, "Clear carry flag            C=0")
+GEN_OP(0x58, 0, AM_IMPLIED, 2, 0, CLI, "Clear interrupt disable bit I=0")
+GEN_OP(0xD8, 0, AM_IMPLIED, 2, 0, CLD, "Clear decimal mode          D=0")
+GEN_OP(0xB8, 0, AM_IMPLIED, 2, 0, CLV, "Clear overflow flag         V=0")
+GEN_OP(0x38, 0, AM_IMPLIED, 2, 0, SEC, "Set carry flag              C=1")
+GEN_OP(0x78, 0, AM_IMPLIED, 2, 0, SEI, "Set interrupt disable bit   I=1")
+GEN_OP(0xF8, 0, AM_IMPLIED, 2, 0, SED, "Set decimal mode            D=1")
+
+// No Operation
+#define GEN_NOP(xx, UNDOCUMENTED) GEN_OP(xx, UNDOCUMENTED, AM_IMPLIED, 2, 0, NOP, "NOP No operation")
+GEN_NOP(0xEA, 0)
+
+// CPU Jump and Control Instructions
+GEN_OP(0x00, 0, AM_IMPLIED, 7, 0, BRK, "Force Break B=1 [S]=PC+1,[S]=P,I=1,PC=[FFFE]")
+
+// Conditional Branches
+GEN_OP(0x10, 0, AM_RELATIVE, 2, 1, BPL, "Branch on result plus     if N=0 PC=PC+/-nn")
+GEN_OP(0x30, 0, AM_RELATIVE, 2, 1, BMI, "Branch on result minus    if N=1 PC=PC+/-nn")
+GEN_OP(0x50, 0, AM_RELATIVE, 2, 1, BVC, "Branch on overflow clear  if V=0 PC=PC+/-nn")
+GEN_OP(0x70, 0, AM_RELATIVE, 2, 1, BVS, "Branch on overflow set    if V=1 PC=PC+/-nn")
+GEN_OP(0x90, 0, AM_RELATIVE, 2, 1, BCC, "Branch on carry clear     if C=0 PC=PC+/-nn")
+GEN_OP(0xB0, 0, AM_RELATIVE, 2, 1, BCS, "Branch on carry set       if C=1 PC=PC+/-nn")
+GEN_OP(0xD0, 0, AM_RELATIVE, 2, 1, BNE, "Branch on result not zero if Z=0 PC=PC+/-nn")
+GEN_OP(0xF0, 0, AM_RELATIVE, 2, 1, BEQ, "Branch on result zero     if Z=1 PC=PC+/-nn")
+
+// ** The execution time is 2 cycles if the condition is false (no branch
+// executed). Otherwise, 3 cycles if the destination is in the same memory page,
+// or 4 cycles if it crosses a page boundary (see below for exact info).
+// Note: After subtractions (SBC or CMP) carry=set indicates above-or-equal,
+// unlike as for 80x86 and Z80 CPUs. Obviously, this still applies even when using
+// 80XX-style syntax.
+
+// Normal Jumps
+GEN_OP(0x4C, 0, AM_JMPABS,   3, 0, JMPa, "Jump Absolute              PC=nnnn")
+GEN_OP(0x6C, 0, AM_INDA,     5, 0, JMPi, "Jump Indirect              PC=WORD[nnnn]")
+GEN_OP(0x20, 0, AM_JMPABS,   6, 0, JSR,  "Jump and Save Return Addr. [S]=PC+2,PC=nnnn")
+GEN_OP(0x40, 0, AM_IMPLIED,  6, 0, RTI,  "Return from BRK/IRQ/NMI    P=[S], PC=[S]")
+GEN_OP(0x60, 0, AM_IMPLIED,  6, 0, RTS,  "Return from Subroutine     PC=[S]+1")
+
+// CPU Rotate and Shift Instructions
+
+#define GEN_SHIFT(BASE, NAME, PREFIX, DESC)                           \
+    GEN_OP(BASE + 0x0A, 0, AM_ACCUM, 2, 0, NAME##1,  PREFIX " Accumulator   " DESC " A")  \
+    GEN_OP(BASE + 0x06, 0, AM_ZP,    5, 0, NAME##z,  PREFIX " Zero Page     " DESC " [nn]")  \
+    GEN_OP(BASE + 0x16, 0, AM_ZPX,   6, 0, NAME##zx, PREFIX " Zero Page,X   " DESC " [nn+X]")  \
+    GEN_OP(BASE + 0x0E, 0, AM_ABS,   6, 0, NAME##a,  PREFIX " Absolute      " DESC " [nnnn]")  \
+    GEN_OP(BASE + 0x1E, 0, AM_ABSX,  7, 0, NAME##ax, PREFIX " Absolute,X    " DESC " [nnnn+X]")
+
+// Shift Left
+GEN_SHIFT(0x00, ASL, "Shift Left", "ASL")
+
+// Shift Right
+GEN_SHIFT(0x40, LSR, "Shift Right", "LSR")
+
+// Rotate Left through Carry
+GEN_SHIFT(0x20, ROL, "Rotate Left", "ROL")
+
+// Rotate Right through Carry
+GEN_SHIFT(0x60, ROR, "Rotate Left", "ROR")
+
+// Bit Test
+GEN_OP(0x24, 0, AM_ZP,      3, 0, BIT8,  "Bit Test   A AND [nn], N=[nn].7, V=[nn].6")
+GEN_OP(0x2C, 0, AM_ABS,     4, 0, BIT16, "Bit Test   A AND [..], N=[..].7, V=[..].6")
+
+// Increment by one
+GEN_OP(0xE6, 0, AM_ZP,      5, 0, INCz,  "Increment Zero Page    [nn]=[nn]+1")
+GEN_OP(0xF6, 0, AM_ZPX,     6, 0, INCzx, "Increment Zero Page,X  [nn+X]=[nn+X]+1")
+GEN_OP(0xEE, 0, AM_ABS,     6, 0, INCa,  "Increment Absolute     [nnnn]=[nnnn]+1")
+GEN_OP(0xFE, 0, AM_ABSX,    7, 0, INCax, "Increment Absolute,X   [nnnn+X]=[nnnn+X]+1")
+
+GEN_OP(0xE8, 0, AM_IMPLIED, 2, 0, INX,   "Increment X            X=X+1")
+GEN_OP(0xC8, 0, AM_IMPLIED, 2, 0, INY,   "Increment Y            Y=Y+1")
+
+// Decrement by one
+// FIXME: merge with increment above
+GEN_OP(0xC6, 0, AM_ZP,      5, 0, DECz,  "Decrement Zero Page    [nn]=[nn]-1")
+GEN_OP(0xD6, 0, AM_ZPX,     6, 0, DECzx, "Decrement Zero Page,X  [nn+X]=[nn+X]-1")
+GEN_OP(0xCE, 0, AM_ABS,     6, 0, DECa,  "Decrement Absolute     [nnnn]=[nnnn]-1")
+GEN_OP(0xDE, 0, AM_ABSX,    7, 0, DECax, "Decrement Absolute,X   [nnnn+X]=[nnnn+X]-1")
+GEN_OP(0xCA, 0, AM_IMPLIED, 2, 0, DEX,   "Decrement X            X=X-1")
+GEN_OP(0x88, 0, AM_IMPLIED, 2, 0, DEY,   "Decrement Y            Y=Y-1")
+
+// Compare (FIXME: merge with ALU?)
+GEN_OP(0xC9, 0, AM_IMMED, 2, 0,   CMPi,  "Compare A with Immediate     A-nn")
+GEN_OP(0xC5, 0, AM_ZP,    3, 0,   CMPz,  "Compare A with Zero Page     A-[nn]")
+GEN_OP(0xD5, 0, AM_ZPX,   4, 0,   CMPzx, "Compare A with Zero Page,X   A-[nn+X]")
+GEN_OP(0xCD, 0, AM_ABS,   4, 0,   CMPa,  "Compare A with Absolute      A-[nnnn]")
+GEN_OP(0xDD, 0, AM_ABSX,  4, 1,   CMPax, "Compare A with Absolute,X    A-[nnnn+X]")
+GEN_OP(0xD9, 0, AM_ABSY,  4, 1,   CMPay, "Compare A with Absolute,Y    A-[nnnn+Y]")
+GEN_OP(0xC1, 0, AM_INDX,  6, 0,   CMPix, "Compare A with (Indirect,X)  A-[[nn+X]]")
+GEN_OP(0xD1, 0, AM_INDY,  5, 1,   CMPiy, "Compare A with (Indirect),Y  A-[[nn]+Y]")
+
+GEN_OP(0xE0, 0, AM_IMMED, 2, 0,   CPXi,  "Compare X with Immediate     X-nn")
+GEN_OP(0xE4, 0, AM_ZP,    3, 0,   CPXz,  "Compare X with Zero Page     X-[nn]")
+GEN_OP(0xEC, 0, AM_ABS,   4, 0,   CPXa,  "Compare X with Absolute      X-[nnnn]")
+GEN_OP(0xC0, 0, AM_IMMED, 2, 0,   CPYi,  "Compare Y with Immediate     Y-nn")
+GEN_OP(0xC4, 0, AM_ZP,    3, 0,   CPYz,  "Compare Y with Zero Page     Y-[nn]")
+GEN_OP(0xCC, 0, AM_ABS,   4, 0,   CPYa,  "Compare Y with Absolute      Y-[nnnn]")
+
+// CPU Arithmetic/Logical Operations
+
+// Logical AND memory with accumulator
+#define GEN_ALU(BASE, NAME, PREFIX, DESC)                          \
+    GEN_OP(BASE + 0x09, 0, AM_IMMED, 2, 0, NAME##i,   PREFIX " Immediate      A=" DESC "nn")       \
+    GEN_OP(BASE + 0x05, 0, AM_ZP,    3, 0, NAME##z,   PREFIX " Zero Page      A=" DESC "[nn]")     \
+    GEN_OP(BASE + 0x15, 0, AM_ZPX,   4, 0, NAME##zx,  PREFIX " Zero Page,X    A=" DESC "[nn+X]")   \
+    GEN_OP(BASE + 0x0D, 0, AM_ABS,   4, 0, NAME##a,   PREFIX " Absolute       A=" DESC "[nnnn]")   \
+    GEN_OP(BASE + 0x1D, 0, AM_ABSX,  4, 1, NAME##ax,  PREFIX " Absolute,X     A=" DESC "[nnnn+X]") \
+    GEN_OP(BASE + 0x19, 0, AM_ABSY,  4, 1, NAME##ay,  PREFIX " Absolute,Y     A=" DESC "[nnnn+Y]") \
+    GEN_OP(BASE + 0x01, 0, AM_INDX,  6, 0, NAME##ix,  PREFIX " (Indirect,X)   A=" DESC "[[nn+X]]") \
+    GEN_OP(BASE + 0x11, 0, AM_INDY,  5, 1, NAME##iy,  PREFIX " (Indirect),Y   A=" DESC "[[nn]+Y]")
+
+// Logical OR memory with accumulator
+GEN_ALU(0x00, ORA, "OR", "A OR ")
+
+// Exclusive-OR memory with accumulator
+GEN_ALU(0x40, EOR, "XOR", "A XOR ")
+
+// Logical AND memory with accumulator
+GEN_ALU(0x20, AND, "AND", "A AND ")
+
+// Add memory to accumulator with carry
+GEN_ALU(0x60, ADC, "Add", "A+C+")
+
+// Subtract memory from accumulator with borrow
+GEN_ALU(0xE0, SBC, "Subtract", "A+C-1-")
+
+// Push/Pull
+GEN_OP(0x48, 0, AM_IMPLIED, 3, 0, PHA,   "Push accumulator on stack        [S]=A")
+GEN_OP(0x08, 0, AM_IMPLIED, 3, 0, PHP,   "Push processor status on stack   [S]=P")
+GEN_OP(0x68, 0, AM_IMPLIED, 4, 0, PLA,   "Pull accumulator from stack      A=[S]")
+GEN_OP(0x28, 0, AM_IMPLIED, 4, 0, PLP,   "Pull processor status from stack P=[S]")
+
+// Store Register in Memory
+GEN_OP(0x85, 0, AM_ZP,    3, 0, STAz,  "Store A in Zero Page     [nn]=A")
+GEN_OP(0x95, 0, AM_ZPX,   4, 0, STAzx, "Store A in Zero Page,X   [nn+X]=A")
+GEN_OP(0x8D, 0, AM_ABS,   4, 0, STAa,  "Store A in Absolute      [nnnn]=A")
+GEN_OP(0x9D, 0, AM_ABSX,  5, 0, STAax, "Store A in Absolute,X    [nnnn+X]=A")
+GEN_OP(0x99, 0, AM_ABSY,  5, 0, STAay, "Store A in Absolute,Y    [nnnn+Y]=A")
+GEN_OP(0x81, 0, AM_INDX,  6, 0, STAix, "Store A in (Indirect,X)  [[nn+x]]=A")
+GEN_OP(0x91, 0, AM_INDY,  6, 0, STAiy, "Store A in (Indirect),Y  [[nn]+y]=A")
+
+GEN_OP(0x86, 0, AM_ZP,    3, 0, STXz,  "Store X in Zero Page     [nn]=X")
+GEN_OP(0x96, 0, AM_ZPY,   4, 0, STXzy, "Store X in Zero Page,Y   [nn+Y]=X")
+GEN_OP(0x8E, 0, AM_ABS,   4, 0, STXa,  "Store X in Absolute      [nnnn]=X")
+
+GEN_OP(0x84, 0, AM_ZP,    3, 0, STYz,  "Store Y in Zero Page     [nn]=Y")
+GEN_OP(0x94, 0, AM_ZPX,   4, 0, STYzx, "Store Y in Zero Page,X   [nn+X]=Y")
+GEN_OP(0x8C, 0, AM_ABS,   4, 0, STYa,  "Store Y in Absolute      [nnnn]=Y")
+
+// Load Register from Memory
+// LDA
+GEN_OP(0xA9, 0, AM_IMMED, 2, 0, LDAi,  "Load A with Immediate     A=nn")
+GEN_OP(0xA5, 0, AM_ZP,    3, 0, LDAz,  "Load A with Zero Page     A=[nn]")
+GEN_OP(0xB5, 0, AM_ZPX,   4, 0, LDAzx, "Load A with Zero Page,X   A=[nn+X]")
+GEN_OP(0xAD, 0, AM_ABS,   4, 0, LDAa,  "Load A with Absolute      A=[nnnn]")
+GEN_OP(0xBD, 0, AM_ABSX,  4, 1, LDAax, "Load A with Absolute,X    A=[nnnn+X]")
+GEN_OP(0xB9, 0, AM_ABSY,  4, 1, LDAay, "Load A with Absolute,Y    A=[nnnn+Y]")
+GEN_OP(0xA1, 0, AM_INDX,  6, 0, LDAix, "Load A with (Indirect,X)  A=[WORD[nn+X]]")
+GEN_OP(0xB1, 0, AM_INDY,  5, 1, LDAiy, "Load A with (Indirect),Y  A=[WORD[nn]+Y]")
+
+// LDX
+GEN_OP(0xA2, 0, AM_IMMED, 2, 0, LDXi,  "Load X with Immediate     X=nn")
+GEN_OP(0xA6, 0, AM_ZP,    3, 0, LDXz,  "Load X with Zero Page     X=[nn]")
+GEN_OP(0xB6, 0, AM_ZPY,   4, 0, LDXzy, "Load X with Zero Page,Y   X=[nn+Y]")
+GEN_OP(0xAE, 0, AM_ABS,   4, 0, LDXa,  "Load X with Absolute      X=[nnnn]")
+GEN_OP(0xBE, 0, AM_ABSY,  4, 1, LDXay, "Load X with Absolute,Y    X=[nnnn+Y]")
+
+// LDY
+GEN_OP(0xA0, 0, AM_IMMED, 2, 0, LDYi,  "Load Y with Immediate     Y=nn")
+GEN_OP(0xA4, 0, AM_ZP,    3, 0, LDYz,  "Load Y with Zero Page     Y=[nn]")
+GEN_OP(0xB4, 0, AM_ZPX,   4, 0, LDYzx, "Load Y with Zero Page,X   Y=[nn+X]")
+GEN_OP(0xAC, 0, AM_ABS,   4, 0, LDYa,  "Load Y with Absolute      Y=[nnnn]")
+GEN_OP(0xBC, 0, AM_ABSX,  4, 1, LDYax, "Load Y with Absolute,X    Y=[nnnn+X]")
+
+// Register to Register Transfer
+GEN_OP(0xA8, 0, AM_IMPLIED, 2, 0, TAY,   "Transfer Accumulator to Y    Y=A")
+GEN_OP(0xAA, 0, AM_IMPLIED, 2, 0, TAX,   "Transfer Accumulator to X    X=A")
+GEN_OP(0xBA, 0, AM_IMPLIED, 2, 0, TSX,   "Transfer Stack pointer to X  X=S")
+GEN_OP(0x98, 0, AM_IMPLIED, 2, 0, TYA,   "Transfer Y to Accumulator    A=Y")
+GEN_OP(0x8A, 0, AM_IMPLIED, 2, 0, TXA,   "Transfer X to Accumulator    A=X")
+GEN_OP(0x9A, 0, AM_IMPLIED, 2, 0, TXS,   "Transfer X to Stack pointer  S=X")
+
+// Undocumented ops (see http://nesdev.parodius.com/extra_instructions.txt)
+// --------------------------------------------------------------------------------
+GEN_NOP(0x1A, 1)
+GEN_NOP(0x3A, 1)
+GEN_NOP(0x5A, 1)
+GEN_NOP(0x7A, 1)
+GEN_NOP(0xDA, 1)
+GEN_NOP(0xFA, 1)
+
+GEN_OP(0xEB, 1, AM_IMMED, 2, 0, SBCi,  "Subtract Immediate (ALT)      A=A+C-1-nn")
+
+// ANC
+GEN_OP(0x2B, 1, AM_IMMED, 2, 0, ANCi, "A = A AND nn")
+GEN_OP(0x0B, 1, AM_IMMED, 2, 0, ANCi, "A = A AND nn")
+
+#define GEN_SKB(CODE, MODE, NUM_CYCLES) GEN_OP(CODE, 1, MODE, NUM_CYCLES, 0, NOPb, "SKB Skip next byte (NOPx2)")
+GEN_SKB(0x80, AM_IMMED, 2)
+GEN_SKB(0x82, AM_IMMED, 2)
+GEN_SKB(0xC2, AM_IMMED, 2)
+GEN_SKB(0xE2, AM_IMMED, 2)
+GEN_SKB(0x04, AM_ZP,    3)
+GEN_SKB(0x14, AM_ZPX,   4)
+GEN_SKB(0x34, AM_ZPX,   4)
+GEN_SKB(0x44, AM_ZP,    3)
+GEN_SKB(0x54, AM_ZPX,   4)
+GEN_SKB(0x64, AM_ZP,    3)
+GEN_SKB(0x74, AM_ZPX,   4)
+GEN_SKB(0xD4, AM_ZPX,   4)
+GEN_SKB(0xF4, AM_ZPX,   4)
+GEN_SKB(0x89, AM_IMMED, 2)
+
+// SKW skips next word (two bytes).
+#define GEN_SKW(CODE, MODE, X) GEN_OP(CODE, 1, MODE, 4, 1, NOPw##X, "SKW Skip next word (NOPx3)")
+// Takes 4 cycles to execute.
+//
+// To be dizzyingly precise, SKW actually performs a read operation.  It's
+// just that the value read is not stored in any register.  Further, opcode 0C
+// uses the absolute addressing mode.  The two bytes which follow it form the
+// absolute address.  All the other SKW opcodes use the absolute indexed X
+// addressing mode.  If a page boundary is crossed, the execution time of one
+// of these SKW opcodes is upped to 5 clock cycles.
+GEN_SKW(0x0C, AM_ABS,  a)
+GEN_SKW(0x1C, AM_ABSX, ax)
+GEN_SKW(0x3C, AM_ABSX, ax)
+GEN_SKW(0x5C, AM_ABSX, ax)
+GEN_SKW(0x7C, AM_ABSX, ax)
+GEN_SKW(0xDC, AM_ABSX, ax)
+GEN_SKW(0xFC, AM_ABSX, ax)
+
+#define GEN_DOUBLE(BASE, NAME, DESC) \
+    GEN_OP(BASE + 0x07, 1, AM_ZP,   5, 0, NAME##z,  DESC " mem with Accum [ab]")      \
+    GEN_OP(BASE + 0x17, 1, AM_ZPX,  6, 0, NAME##zx, DESC " mem with Accum [ab+X]")    \
+    GEN_OP(BASE + 0x0F, 1, AM_ABS,  6, 0, NAME##a,  DESC " mem with Accum abcd")    \
+    GEN_OP(BASE + 0x1F, 1, AM_ABSX, 7, 0, NAME##ax, DESC " mem with Accum abcd,X")  \
+    GEN_OP(BASE + 0x1B, 1, AM_ABSY, 7, 0, NAME##ay, DESC " mem with Accum abcd,Y")  \
+    GEN_OP(BASE + 0x03, 1, AM_INDX, 8, 0, NAME##ix, DESC " mem with Accum (ab,X)")  \
+    GEN_OP(BASE + 0x13, 1, AM_INDY, 8, 0, NAME##iy, DESC " mem with Accum (ab),Y")
+
+GEN_DOUBLE(0x00, SLO, "ASL/OR")
+GEN_DOUBLE(0x20, RLA, "ROL/AND")
+GEN_DOUBLE(0x40, SRE, "LSR/EOR")
+GEN_DOUBLE(0x60, RRA, "ROR/ADC")
+GEN_DOUBLE(0xC0, DCP, "DEC/CMP")
+GEN_DOUBLE(0xE0, ISB, "INC/SBC")
+
+// SAX
+GEN_OP(0x87, 1, AM_ZP,    3, 0, SAXz,  "AND A/X into mem Zero Page     A=[nn]")
+GEN_OP(0x97, 1, AM_ZPY,   4, 0, SAXzy, "AND A/X into mem Zero Page,Y   A=[nn+Y]")
+GEN_OP(0x8F, 1, AM_ABS,   4, 0, SAXa,  "AND A/X into mem Absolute      A=[nnnn]")
+GEN_OP(0x83, 1, AM_INDX,  6, 0, SAXix, "AND A/X into mem (Indirect,X)  A=[WORD[nn+X]]")
+
+// SAX
+GEN_OP(0xCB, 1, AM_IMMED, 2, 0, SAX, "X = (A AND X) - nn")
+
+// SAY
+GEN_OP(0x9C, 1, AM_ABS,   5, 0, SAYax, "[abcd] = Y AND (ab + 1)")
+
+// XAS
+GEN_OP(0x9E, 1, AM_ABS,   5, 0, XASay, "[abcd] = X AND (ab + 1)")
+
+// AXA
+GEN_OP(0x9F, 1, AM_ABS,   5, 0, AXAay, "[abcd] = A AND X AND (ab + 1)")
+GEN_OP(0x93, 1, AM_INDY,  6, 0, AXAiy, "[abcd] = A AND X AND (ab + 1)")
+
+// LAX
+GEN_OP(0xA7, 1, AM_ZP,    3, 0, LAXz,  "Load A/X with Zero Page     A=[nn]")
+GEN_OP(0xB7, 1, AM_ZPY,   4, 0, LAXzy, "Load A/X with Zero Page,Y   A=[nn+Y]")
+GEN_OP(0xAF, 1, AM_ABS,   4, 0, LAXa,  "Load A/X with Absolute      A=[nnnn]")
+GEN_OP(0xBF, 1, AM_ABSY,  4, 1, LAXay, "Load A/X with Absolute,Y    A=[nnnn+Y]")
+GEN_OP(0xA3, 1, AM_INDX,  6, 0, LAXix, "Load A/X with (Indirect,X)  A=[WORD[nn+X]]")
+GEN_OP(0xB3, 1, AM_INDY,  5, 1, LAXiy, "Load A/X with (Indirect),Y  A=[WORD[nn]+Y]")
+
+GEN_OP(0xBB, 1, AM_ABSY,  3, 1, LARay, "AND stack pointer A/X with Absolute,Y    A/X/S=([nnnn+Y] & S)")
+
+GEN_OP(0x4B, 1, AM_IMMED, 2, 0, ALR, "AND A with immediate and LSR  A=(A AND nn) >> 1")
+GEN_OP(0x6B, 1, AM_IMMED, 2, 0, ARR, "AND A with immediate and ROR  A=(A AND nn) >>> 1")
+
+GEN_OP(0x8B, 1, AM_IMMED, 2, 0, XAA, "A=(A* AND X AND nn)")
+GEN_OP(0xAB, 1, AM_IMMED, 2, 0, LXA, "A,X=(A* AND nn)")
+
+// TAS
+GEN_OP(0x9B, 1, AM_ABS,   5, 0, TASay, "FIXME")
+
+#undef GEN_NOP
+#undef GEN_SHIFT
+#undef GEN_ALU
+#undef GEN_SKB
+#undef GEN_SKW
+#undef GEN_DOUBLE
@@ -0,0 +1,596 @@
+#ifndef __n6502_ops_h__
+#define __n6502_ops_h__
+
+#include "n6502.h"
+
+// Instruction handlers, shared by the dispatch core in n6502.c and by PRG ROM
+// translated ahead of time (see tools/n6502_recompile.c).  The includer must
+// define LOG().
+
+// Opcode handlers operate on a register file passed alongside the CPU; the
+// dispatch core passes its locals here so they can stay in host registers
+#undef CPU_REGS
+#define CPU_REGS (*regs)
+
+// Handlers take their operand as a parameter rather than reading it at PC
+#undef IMM8
+#undef IMM16
+#define IMM8()  ((uint8_t) (CPU_REGS.PC++, operand))
+#define IMM16() (operand)
+
+// Core variants, folded into constants by each specialised dispatch core
+#define CORE_DECIMAL (1 << 0) // Generic 6502: BCD arithmetic (the 2A03 has none)
+#define CORE_DEBUG   (1 << 1) // Debugger checks (CHECK_PC)
+#define CORE_TRACE   (1 << 2) // Record each instruction into cpu->trace
+
+#define DEF_OP(X) static ALWAYS_INLINE void X(N6502_t *cpu, N6502Regs_t *regs, uint16_t operand, const unsigned variant)
+
+// Zero-page access
+#define ZP(i) ((i) & 0xff)
+
+DEF_OP(TAY)   { SET_Y(CPU_REGS.A); }
+DEF_OP(TAX)   { SET_X(CPU_REGS.A); }
+DEF_OP(TSX)   { SET_X(CPU_REGS.S); }
+DEF_OP(TYA)   { SET_A(CPU_REGS.Y); }
+DEF_OP(TXA)   { SET_A(CPU_REGS.X); }
+DEF_OP(TXS)   { CPU_REGS.S = CPU_REGS.X; }
+
+// Bank cross detection for cycle penalty
+#define CHECK_BANK_CROSSING(CPU, A, B)   \
+    if(((A) >> 8) != ((B) >> 8))         \
+        CPU->cycle++;
+
+#define DUMMY_MEM_READ(CPU, A, B)   \
+    if(((A) >> 8) != ((B) >> 8))    \
+        READ_MEM(((A) & 0xff00) | ((B) & 0xff));
+
+static ALWAYS_INLINE uint16_t
+src_ax(N6502_t *cpu, N6502Regs_t *regs, uint16_t imm)
+{
+    uint16_t src = imm + CPU_REGS.X;
+
+    return src;
+}
+
+static ALWAYS_INLINE uint16_t
+src_axb(N6502_t *cpu, N6502Regs_t *regs, uint16_t imm)
+{
+    uint16_t src = imm + CPU_REGS.X;
+
+    CHECK_BANK_CROSSING(cpu, src, imm);
+    // FIXME: when the APU is implemented
+    //DUMMY_MEM_READ(cpu, src, imm);
+
+    return src;
+}
+
+static ALWAYS_INLINE uint16_t
+src_ay(N6502_t *cpu, N6502Regs_t *regs, uint16_t imm)
+{
+    uint16_t src = imm + CPU_REGS.Y;
+
+    return src;
+}
+
+static ALWAYS_INLINE uint16_t
+src_ayb(N6502_t *cpu, N6502Regs_t *regs, uint16_t imm)
+{
+    uint16_t src = imm + CPU_REGS.Y;
+
+    CHECK_BANK_CROSSING(cpu, src, imm);
+
+    return src;
+}
+
+static ALWAYS_INLINE uint16_t
+src_iy(N6502_t *cpu, N6502Regs_t *regs, uint16_t operand)
+{
+    uint8_t z = IMM8();
+    uint16_t w = WORD16(z);
+    uint16_t src = w + CPU_REGS.Y;
+
+    return src;
+}
+
+static ALWAYS_INLINE uint16_t
+src_iyb(N6502_t *cpu, N6502Regs_t *regs, uint16_t operand)
+{
+    uint8_t z = IMM8();
+    uint16_t w = WORD16(z);
+    uint16_t src = w + CPU_REGS.Y;
+
+    CHECK_BANK_CROSSING(cpu, src, w);
+
+    return src;
+}
+
+#define SRC_ZX()  ZP(IMM8() + CPU_REGS.X)
+#define SRC_ZY()  ZP(IMM8() + CPU_REGS.Y)
+#define SRC_AX()  src_ax (cpu, regs, IMM16())
+#define SRC_AXB() src_axb(cpu, regs, IMM16())
+#define SRC_AY()  src_ay (cpu, regs, IMM16())
+#define SRC_AYB() src_ayb(cpu, regs, IMM16())
+#define SRC_IY()  src_iy (cpu, regs, operand)
+#define SRC_IYB() src_iyb(cpu, regs, operand)
+
+#define MEM_I()   IMM8()
+#define MEM_Z()   READ_MEM(IMM8())
+#define MEM_ZX()  READ_MEM(SRC_ZX())
+#define MEM_ZY()  READ_MEM(SRC_ZY())
+#define MEM_A()   READ_MEM(IMM16())
+#define MEM_AX()  READ_MEM(SRC_AX())
+#define MEM_AXB() READ_MEM(SRC_AXB())
+#define MEM_AY()  READ_MEM(SRC_AY())
+#define MEM_AYB() READ_MEM(SRC_AYB())
+
+DEF_OP(LDAi)  { SET_A(MEM_I()); }
+DEF_OP(LDAz)  { SET_A(MEM_Z()); }
+DEF_OP(LDAzx) { SET_A(MEM_ZX()); }
+DEF_OP(LDAa)  { SET_A(MEM_A());  CPU_REGS.PC += 2; }
+DEF_OP(LDAax) { SET_A(MEM_AXB()); CPU_REGS.PC += 2; }
+DEF_OP(LDAay) { SET_A(MEM_AYB()); CPU_REGS.PC += 2; }
+
+// Indirect ops => FUN!
+DEF_OP(LDAix) { uint8_t z = SRC_ZX(); SET_A(READ_MEM(WORD16(z))); }
+DEF_OP(LDAiy) { SET_A(READ_MEM(SRC_IYB())); }
+
+DEF_OP(LDXi)  { SET_X(MEM_I()); }
+DEF_OP(LDXz)  { SET_X(MEM_Z()); }
+DEF_OP(LDXzy) { SET_X(MEM_ZY()); }
+DEF_OP(LDXa)  { SET_X(MEM_A());  CPU_REGS.PC += 2; }
+DEF_OP(LDXay) { SET_X(MEM_AYB()); CPU_REGS.PC += 2; }
+
+DEF_OP(LDYi)  { SET_Y(MEM_I()); }
+DEF_OP(LDYz)  { SET_Y(MEM_Z()); }
+DEF_OP(LDYzx) { SET_Y(MEM_ZX()); }
+DEF_OP(LDYa)  { SET_Y(MEM_A());  CPU_REGS.PC += 2; }
+DEF_OP(LDYax) { SET_Y(MEM_AXB()); CPU_REGS.PC += 2; }
+
+#define STA(a) WRITE_MEM(a, CPU_REGS.A)
+
+DEF_OP(STAz)  { STA(IMM8()); }
+DEF_OP(STAzx) { STA(SRC_ZX()); }
+DEF_OP(STAa)  { STA(IMM16());  CPU_REGS.PC += 2; }
+DEF_OP(STAax) { STA(SRC_AX()); CPU_REGS.PC += 2; }
+DEF_OP(STAay) { STA(SRC_AY()); CPU_REGS.PC += 2; }
+// Indirect ops => FUN!
+DEF_OP(STAix) { uint8_t z = SRC_ZX(); STA(WORD16(z)); }
+DEF_OP(STAiy) { STA(SRC_IY()); }
+
+#define STX(a) WRITE_MEM(a, CPU_REGS.X)
+
+DEF_OP(STXz)  { STX(IMM8()); }
+DEF_OP(STXzy) { STX(SRC_ZY()); }
+DEF_OP(STXa)  { STX(IMM16()); CPU_REGS.PC += 2; }
+
+#define STY(a) WRITE_MEM(a, CPU_REGS.Y)
+
+DEF_OP(STYz)  { STY(IMM8()); }
+DEF_OP(STYzx) { STY(SRC_ZX()); }
+DEF_OP(STYa)  { STY(IMM16()); CPU_REGS.PC += 2; }
+
+// Notes: PLA sets Z and N according to content of A. The B-flag and unused flags
+// cannot be changed by PLP, these flags are always written as "1" by PHP.
+DEF_OP(PHP)   { PUSH_STACK(GET_P() | P_B); }
+DEF_OP(PHA)   { PUSH_STACK(CPU_REGS.A); }
+DEF_OP(PLA)   { SET_A(POP_STACK()); }
+DEF_OP(PLP)   { SET_P(POP_STACK() | P_5); }
+
+#define DEF_ALU(NAME)                                                     \
+    DEF_OP(NAME##i)  { NAME(MEM_I()); }                                   \
+    DEF_OP(NAME##z)  { NAME(MEM_Z()); }                                   \
+    DEF_OP(NAME##zx) { NAME(MEM_ZX()); }                                  \
+    DEF_OP(NAME##a)  { NAME(MEM_A());  CPU_REGS.PC += 2; }                    \
+    DEF_OP(NAME##ax) { NAME(MEM_AXB()); CPU_REGS.PC += 2; }                   \
+    DEF_OP(NAME##ay) { NAME(MEM_AYB()); CPU_REGS.PC += 2; }                   \
+    DEF_OP(NAME##ix) { uint8_t i = SRC_ZX(); NAME(READ_MEM(WORD16(i))); } \
+    DEF_OP(NAME##iy) { NAME(READ_MEM(SRC_IYB())); }
+
+// Undocumented ops
+
+static ALWAYS_INLINE void _ADC(N6502_t *cpu, N6502Regs_t *regs, const unsigned variant, uint8_t src)
+{
+    uint16_t temp = (CPU_REGS.A + (FLAG(C) ? 1 : 0) + src);
+    SET_Z(temp & 0xff);
+    if(FLAG(D) && (variant & CORE_DECIMAL))
+    {
+        LOG("ADCd");
+        if(((CPU_REGS.A & 0xf) + (src & 0xf) + (FLAG(C) ? 1 : 0)) > 9)
+        {
+            LOG(" += 6");
+            temp += 6;
+        }
+
+        SET_N(temp & 0xff);
+        FLAG(V) = !((CPU_REGS.A ^ src) & 0x80) && ((CPU_REGS.A ^ temp) & 0x80);
+        if(temp > 0x99)
+        {
+            LOG(" += 60");
+            temp += 0x60;
+        }
+        FLAG(C) = (temp > 0x99);
+        LOG(": %x %x => %x\n", CPU_REGS.A, src, temp);
+    }
+    else
+    {
+        SET_N(temp & 0xff);
+        FLAG(C) = (temp > 0xff);
+        FLAG(V) = !((CPU_REGS.A ^ src) & 0x80) && ((CPU_REGS.A ^ temp) & 0x80);
+    }
+    //CPU_REGS.A = (uint8_t) temp;
+    CPU_REGS.A = temp & 0xff;
+}
+
+#define ADC(i) _ADC(cpu, regs, variant, i)
+
+DEF_ALU(ADC)
+
+static ALWAYS_INLINE void _SBC(N6502_t *cpu, N6502Regs_t *regs, const unsigned variant, uint8_t src)
+{
+    uint16_t temp = (CPU_REGS.A - src - (FLAG(C) ? 0 : 1));
+    SET_N(temp);
+    SET_Z(temp & 0xff);
+    FLAG(V) = ((CPU_REGS.A ^ src) & 0x80) && ((CPU_REGS.A ^ temp) & 0x80);
+    if(FLAG(D) && (variant & CORE_DECIMAL))
+    {
+        LOG("SBCd");
+        if(((CPU_REGS.A & 0xf) - (FLAG(C) ? 0 : 1)) < (src & 0xf))
+        {
+            LOG(" -= 6");
+            temp -= 6;
+        }
+
+        if(temp > 0x99)
+        {
+            LOG(" -= 0x60");
+            temp -= 0x60;
+        }
+        LOG(": %x %x => %x\n", CPU_REGS.A, src, temp);
+    }
+    FLAG(C) = (temp < 0x100);
+    CPU_REGS.A = (uint8_t) temp;
+}
+
+#define SBC(i) _SBC(cpu, regs, variant, i)
+
+DEF_ALU(SBC)
+
+#define AND(i) SET_A(CPU_REGS.A & (i));
+DEF_ALU(AND)
+
+#define ORA(i) SET_A(CPU_REGS.A | (i));
+DEF_ALU(ORA)
+
+#define EOR(i) SET_A(CPU_REGS.A ^ (i));
+DEF_ALU(EOR)
+
+// Note: Compared with normal 80x86 and Z80 CPUs, resulting Carry Flag is reversed.
+#define CMP(R, IMM)               \
+    uint8_t v = (IMM);            \
+    FLAG(C) = (CPU_REGS.R >= v);      \
+    SET_ZN(CPU_REGS.R - v)
+
+#define CMPA(i) CMP(A, i)
+
+DEF_OP(CMPi)  { CMPA(MEM_I()); }
+DEF_OP(CMPz)  { CMPA(MEM_Z()); }
+DEF_OP(CMPzx) { CMPA(MEM_ZX()); }
+DEF_OP(CMPa)  { CMPA(MEM_A());  CPU_REGS.PC += 2; }
+DEF_OP(CMPax) { CMPA(MEM_AXB()); CPU_REGS.PC += 2; }
+DEF_OP(CMPay) { CMPA(MEM_AYB()); CPU_REGS.PC += 2; }
+// Indirect ops => FUN!
+DEF_OP(CMPix) { uint8_t i = SRC_ZX(); CMPA(READ_MEM(WORD16(i))); }
+DEF_OP(CMPiy) { CMPA(READ_MEM(SRC_IYB())); }
+
+#define CPX(i) CMP(X, i)
+
+DEF_OP(CPXi)  { CPX(MEM_I()); }
+DEF_OP(CPXz)  { CPX(MEM_Z()); }
+DEF_OP(CPXa)  { CPX(MEM_A()); CPU_REGS.PC += 2; }
+
+#define CPY(i) CMP(Y, i)
+
+DEF_OP(CPYi)  { CPY(MEM_I()); }
+DEF_OP(CPYz)  { CPY(MEM_Z()); }
+DEF_OP(CPYa)  { CPY(MEM_A()); CPU_REGS.PC += 2; }
+
+DEF_OP(BIT8)  {     \
+    uint8_t i = READ_MEM(IMM8());   \
+    SET_Z(i & CPU_REGS.A);          \
+    FLAG(V) = (i >> 6)&1;           \
+    SET_N(i);                       \
+}
+DEF_OP(BIT16)  {     \
+    uint8_t i = READ_MEM(IMM16());  \
+    SET_Z(i & CPU_REGS.A);          \
+    FLAG(V) = (i >> 6)&1;           \
+    SET_N(i);                       \
+    CPU_REGS.PC += 2; \
+}
+
+// FIXME: do one read instead of two
+#define MEM_INCDEC(OP, ADDR)   WRITE_MEM(ADDR, READ_MEM(ADDR) OP); SET_ZN(READ_MEM(ADDR))
+
+#define DEF_INCDEC(NAME, OP)                                                            \
+    DEF_OP(NAME##Cz)  { uint8_t addr = IMM8();    MEM_INCDEC(OP, addr); }               \
+    DEF_OP(NAME##Czx) { uint8_t addr = SRC_ZX();  MEM_INCDEC(OP, addr); }               \
+    DEF_OP(NAME##Ca)  { uint16_t addr = IMM16();  MEM_INCDEC(OP, addr); CPU_REGS.PC += 2; } \
+    DEF_OP(NAME##Cax) { uint16_t addr = SRC_AX(); MEM_INCDEC(OP, addr); CPU_REGS.PC += 2; } \
+    DEF_OP(NAME##X)   { SET_X(CPU_REGS.X OP); }                             \
+    DEF_OP(NAME##Y)   { SET_Y(CPU_REGS.Y OP); }
+
+// INX/INY/DEX/DEY
+DEF_INCDEC(IN, + 1);
+DEF_INCDEC(DE, - 1);
+
+//    DEF_OP(NAME##1)  { NAME(CPU_REGS.A); }
+#define DEF_SHIFT(NAME) \
+    DEF_OP(NAME##z)  { uint8_t z = IMM8();    NAME(z); }               \
+    DEF_OP(NAME##zx) { uint8_t z = SRC_ZX();  NAME(z); }               \
+    DEF_OP(NAME##a)  { uint16_t m = IMM16();  NAME(m); CPU_REGS.PC += 2; } \
+    DEF_OP(NAME##ax) { uint16_t m = SRC_AX(); NAME(m); CPU_REGS.PC += 2; }
+
+#define ASL(a) uint8_t i = READ_MEM(a); FLAG(C) = ((i) >> 7); (i) <<= 1; WRITE_MEM(a, i); SET_ZN(i)
+DEF_SHIFT(ASL);
+DEF_OP(ASL1) { FLAG(C) = ((CPU_REGS.A) >> 7); SET_A(CPU_REGS.A << 1); }
+
+#define LSR(a) uint8_t i = READ_MEM(a); FLAG(C) = ((i) & 1); (i) >>= 1; WRITE_MEM(a, i); SET_ZN(i)
+DEF_SHIFT(LSR);
+DEF_OP(LSR1) { FLAG(C) = (CPU_REGS.A) & 1; SET_A(CPU_REGS.A >> 1); }
+
+#define ROL(a) uint8_t i = READ_MEM(a); uint8_t C = ((i) >> 7); (i) = ((i) << 1) | FLAG(C); FLAG(C) = C; WRITE_MEM(a, i); SET_ZN(i)
+DEF_SHIFT(ROL);
+DEF_OP(ROL1) { uint8_t C = (CPU_REGS.A >> 7); SET_A((CPU_REGS.A << 1) | FLAG(C)); FLAG(C) = C; }
+
+#define ROR(a) uint8_t i = READ_MEM(a); uint8_t C = ((i) & 1); (i) = (FLAG(C) << 7) | ((i) >> (1)); FLAG(C) = C; WRITE_MEM(a, i); SET_ZN(i)
+DEF_SHIFT(ROR);
+DEF_OP(ROR1) { uint8_t C = CPU_REGS.A & 1; SET_A((FLAG(C) << 7) | CPU_REGS.A >> 1); FLAG(C) = C; }
+
+#ifdef DEBUG
+static void
+BAD_PC(N6502_t *cpu, N6502Regs_t *regs)
+{
+    ASSERT(0, "BAD PC: $%04X", CPU_REGS.PC);
+}
+
+static ALWAYS_INLINE void
+CHECK_PC(N6502_t *cpu, N6502Regs_t *regs, const unsigned variant)
+{
+    if((variant & CORE_DEBUG) && cpu->min_pc && (CPU_REGS.PC < cpu->min_pc))
+    {
+        BAD_PC(cpu, regs);
+    }
+}
+
+#else
+#define CHECK_PC(X, R, V)
+#endif
+
+DEF_OP(JMPa) { CPU_REGS.PC = IMM16(); CHECK_PC(cpu, regs, variant); }
+
+DEF_OP(JMPi) { CPU_REGS.PC = WORD16(IMM16()); CHECK_PC(cpu, regs, variant); }
+DEF_OP(JSR)  { uint16_t new_pc = IMM16(); CPU_REGS.PC++; PUSH_PC(); CPU_REGS.PC = new_pc; CHECK_PC(cpu, regs, variant); }
+
+DEF_OP(RTI)  { SET_P(POP_STACK() | P_5); POP_PC(); }
+DEF_OP(RTS)  { POP_PC(); CPU_REGS.PC++; CHECK_PC(cpu, regs, variant); }
+
+static ALWAYS_INLINE void
+_branch(N6502_t *cpu, N6502Regs_t *regs, uint16_t operand, uint8_t cond)
+{
+    int8_t offset = IMM8();
+    if(cond)
+    {
+        uint16_t not_taken_pc = CPU_REGS.PC;
+        CPU_REGS.PC += offset;
+        //LOG("branch taken => %04Xh\n", CPU_REGS.PC);
+
+        cpu->cycle++;
+
+        CHECK_BANK_CROSSING(cpu, CPU_REGS.PC, not_taken_pc);
+    }
+}
+
+#define DEF_BRANCH(NAME, COND) \
+    DEF_OP(NAME) { _branch(cpu, regs, operand, COND); }
+
+DEF_BRANCH(BPL, FLAG(N) == 0)
+DEF_BRANCH(BMI, FLAG(N) == 1)
+DEF_BRANCH(BVC, FLAG(V) == 0)
+DEF_BRANCH(BVS, FLAG(V) == 1)
+
+DEF_BRANCH(BCC, FLAG(C) == 0)
+DEF_BRANCH(BCS, FLAG(C) == 1)
+DEF_BRANCH(BNE, FLAG(Z) == 0)
+DEF_BRANCH(BEQ, FLAG(Z) == 1)
+
+DEF_OP(BRK) { CPU_REGS.PC++; PUSH_PC(); PUSH_STACK(GET_P() | P_B); FLAG(I) = 1; CPU_REGS.PC = WORD16(IRQ_VECTOR); }
+
+DEF_OP(CLC) { FLAG(C) = 0; }
+DEF_OP(CLI) { FLAG(I) = 0; }
+DEF_OP(CLD) { FLAG(D) = 0; }
+DEF_OP(CLV) { FLAG(V) = 0; }
+
+DEF_OP(SEC) { FLAG(C) = 1; }
+DEF_OP(SEI) { FLAG(I) = 1; }
+DEF_OP(SED) { FLAG(D) = 1; }
+
+DEF_OP(NOP) { (void)cpu; }
+
+// --------------------------------------------------------------------------------
+// UNDOCUMENTED 6502 OPS
+// --------------------------------------------------------------------------------
+DEF_OP(NOPb)   { /*LOG("SKB\n");*/ CPU_REGS.PC += 1; }
+DEF_OP(NOPwa)  { /*LOG("SKWa\n");*/ CPU_REGS.PC += 2; }
+DEF_OP(NOPwax) { /*LOG("SKWax\n");*/ MEM_AXB(); CPU_REGS.PC += 2; }
+
+#define DEF_DOUBLE(NAME) \
+    DEF_OP(NAME##z)  { uint8_t z = IMM8();    NAME(z); }               \
+    DEF_OP(NAME##zx) { uint8_t z = SRC_ZX();  NAME(z); }               \
+    DEF_OP(NAME##a)  { uint16_t m = IMM16();  NAME(m); CPU_REGS.PC += 2; } \
+    DEF_OP(NAME##ax) { uint16_t m = SRC_AX(); NAME(m); CPU_REGS.PC += 2; } \
+    DEF_OP(NAME##ay) { uint16_t m = SRC_AY(); NAME(m); CPU_REGS.PC += 2; } \
+    DEF_OP(NAME##ix) { uint8_t z = SRC_ZX(); uint16_t ix = WORD16(z); NAME(ix); } \
+    DEF_OP(NAME##iy) { uint16_t iy = SRC_IY(); NAME(iy); }
+
+// ASL/OR
+#define SLO(a) uint8_t src = READ_MEM(a); FLAG(C) = (src) >> 7; src <<= 1; WRITE_MEM(a, src); CPU_REGS.A |= (src); SET_ZN(CPU_REGS.A)
+
+// ROL/AND
+#define RLA(a) uint8_t src = READ_MEM(a); uint8_t C = ((src) >> 7); src = (src << 1) | FLAG(C); WRITE_MEM(a, src); FLAG(C) = C; CPU_REGS.A &= src; SET_ZN(CPU_REGS.A)
+
+// LSR/EOR
+#define SRE(a) uint8_t src = READ_MEM(a); FLAG(C) = ((src) & 1); src >>= 1; WRITE_MEM(a, src); CPU_REGS.A ^= src; SET_ZN(CPU_REGS.A)
+
+// ROR/ADC
+#define RRA(a) ROR(a); _ADC(cpu, regs, variant, READ_MEM(a))
+
+// DEC/CMP
+#define DCP(a) uint8_t src = READ_MEM(a) - 1; WRITE_MEM(a, src); CMP(A, src)
+
+// INC/SBC
+#define ISB(a) uint8_t src = READ_MEM(a) + 1; WRITE_MEM(a, src); _SBC(cpu, regs, variant, src)
+
+DEF_DOUBLE(SLO)
+DEF_DOUBLE(RLA)
+DEF_DOUBLE(SRE)
+DEF_DOUBLE(RRA)
+DEF_DOUBLE(DCP)
+DEF_DOUBLE(ISB)
+
+// SAX
+// SAX ANDs the contents of the A and X registers (leaving the contents of A
+// intact), subtracts an immediate value, and then stores the result in X.
+// ... A few points might be made about the action of subtracting an immediate
+// value.  It actually works just like the CMP instruction, except that CMP
+// does not store the result of the subtraction it performs in any register.
+// This subtract operation is not affected by the state of the Carry flag,
+// though it does affect the Carry flag.  It does not affect the Overflow
+// flag.
+DEF_OP(SAX)
+{
+    uint16_t result = (CPU_REGS.X & CPU_REGS.A) - IMM8();
+    SET_N(result);
+    CPU_REGS.X = result & 0xff;
+    FLAG(C) = (result < 0x100);
+    SET_Z(CPU_REGS.X);
+}
+
+// SAY:  [abcd] = Y AND (ab + 1)
+DEF_OP(SAYax)
+{
+    uint16_t addr = IMM16() + CPU_REGS.X; // FIXME: SRC_AX()?
+    uint8_t result = CPU_REGS.Y & ((addr >> 8) + 1);
+    //SET_ZN(result);
+    WRITE_MEM(addr, result);
+    CPU_REGS.PC += 2;
+}
+
+// XAS:  [abcd] = X AND (ab + 1)
+DEF_OP(XASay)
+{
+    uint16_t addr = IMM16() + CPU_REGS.Y; // FIXME: SRC_AY()?
+    uint8_t result = CPU_REGS.X & ((addr >> 8) + 1);
+    //SET_ZN(result);
+    WRITE_MEM(addr, result);
+    CPU_REGS.PC += 2;
+}
+
+// AXA:  [abcd] = A AND X AND (ab + 1)
+DEF_OP(AXAay)
+{
+    uint16_t addr = IMM16() + CPU_REGS.Y; // FIXME: SRC_AY()?
+    uint8_t result = CPU_REGS.X & CPU_REGS.A & ((addr >> 8) + 1);
+    WRITE_MEM(addr, result);
+    CPU_REGS.PC += 2;
+}
+
+DEF_OP(AXAiy)
+{
+    uint16_t addr = SRC_IY();
+    uint8_t result = CPU_REGS.X & CPU_REGS.A & ((addr >> 8) + 1);
+    WRITE_MEM(addr, result);
+}
+
+DEF_OP(TASay)
+{
+    uint16_t addr = SRC_AY();
+    CPU_REGS.S = CPU_REGS.A & CPU_REGS.X;
+    //WRITE_MEM(addr, CPU_REGS.S & ((addr >> 8) + 1));
+    WRITE_MEM(addr, CPU_REGS.S & ((addr >> 8) + 1));
+    CPU_REGS.PC += 2;
+}
+
+// LXA: also called OAL or ATX
+// NOTE: two behaviors for NES/C64 cpu's
+DEF_OP(LXA)
+{
+    uint8_t i = IMM8();
+    if(variant & CORE_DECIMAL) i &= (0xee | CPU_REGS.A);
+    SET_A(i);
+    CPU_REGS.X = CPU_REGS.A;
+}
+
+DEF_OP(LAXz)  { SET_A(MEM_Z());  CPU_REGS.X = CPU_REGS.A; }
+DEF_OP(LAXzy) { SET_A(MEM_ZY()); CPU_REGS.X = CPU_REGS.A; }
+DEF_OP(LAXa)  { SET_A(MEM_A());  CPU_REGS.X = CPU_REGS.A; CPU_REGS.PC += 2; }
+DEF_OP(LAXay) { SET_A(MEM_AYB()); CPU_REGS.X = CPU_REGS.A; CPU_REGS.PC += 2; }
+
+// Indirect ops => FUN!
+DEF_OP(LAXix) { uint8_t z = SRC_ZX(); SET_A(READ_MEM(WORD16(z))); CPU_REGS.X = CPU_REGS.A; }
+DEF_OP(LAXiy) { SET_A(READ_MEM(SRC_IYB())); CPU_REGS.X = CPU_REGS.A; }
+
+// LAR: also called LAE or LAS
+// AND memory with stack pointer, transfer result to accumulator, X register and stack pointer.
+DEF_OP(LARay)
+{
+    SET_A(MEM_AYB() & CPU_REGS.S);
+    CPU_REGS.X = CPU_REGS.A;
+    CPU_REGS.S = CPU_REGS.A;
+    CPU_REGS.PC += 2;
+}
+
+// ANC: AND with carry
+DEF_OP(ANCi)  { SET_A(CPU_REGS.A & IMM8()); FLAG(C) = FLAG(N); }
+
+// SAX (also known as AXS):
+// ANDs the contents of the A and X registers (without changing the
+// contents of either register) and stores the result in memory.
+// SAX does not affect any flags in the processor status register.
+
+#define SAX_AX() (CPU_REGS.A & CPU_REGS.X)
+
+DEF_OP(SAXz)  { uint8_t z = IMM8();    WRITE_MEM(z, SAX_AX()); }
+DEF_OP(SAXzy) { uint8_t z = SRC_ZY();  WRITE_MEM(z, SAX_AX()); }
+DEF_OP(SAXa)  { uint16_t m = IMM16();  WRITE_MEM(m, SAX_AX()); CPU_REGS.PC += 2; }
+DEF_OP(SAXix) { uint8_t i = SRC_ZX();  WRITE_MEM(WORD16(i), SAX_AX()); }
+
+DEF_OP(ALR)   { uint8_t i = IMM8();  CPU_REGS.A &= i; FLAG(C) = CPU_REGS.A & 1; CPU_REGS.A >>= 1; SET_ZN(CPU_REGS.A); }
+
+// ARR => AND/ROR
+// The opcode ARR operates more complexily than actually described in the list
+// above.  Here is a brief rundown on this.  The following assumes the decimal
+// flag is clear.  You see, the sub-instruction for ARR ($6B) is in fact ADC
+// ($69), not AND.  While ADC is not performed, some of the ADC mechanics are
+// evident.  Like ADC, ARR affects the overflow flag.  The following effects
+// occur after ANDing but before RORing.  The V flag is set to the result of
+// exclusive ORing bit 7 with bit 6.  Unlike ROR, bit 0 does not go into the
+// carry flag.  The state of bit 7 is exchanged with the carry flag.  Bit 0 is
+// lost.  All of this may appear strange, but it makes sense if you consider
+// the probable internal operations of ADC itself.
+
+// NOTE: this implementation does not work for decimal mode
+DEF_OP(ARR)                                    \
+{                                              \
+    uint8_t imm = IMM8();                      \
+    CPU_REGS.A &= imm;                             \
+    FLAG(V) = ((CPU_REGS.A >> 7) ^ (CPU_REGS.A >> 6)) & 1; \
+    CPU_REGS.A = (FLAG(C) << 7) | (CPU_REGS.A >> 1);   \
+    FLAG(C) = (CPU_REGS.A >> 6) & 1;               \
+    SET_ZN(CPU_REGS.A);                            \
+}
+
+// XAA transfers the contents of the X register to the A register and then
+// ANDs the A register with an immediate value.
+DEF_OP(XAA)   { uint8_t i = IMM8() & CPU_REGS.X; i &= (0xee | CPU_REGS.A); SET_A(i); }
+
+#endif
@@ -0,0 +1,462 @@
+#include "n6502_profile.h"
+#include "log.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILE_MAX_DEPTH  256
+#define PROFILE_TOP_PCS    32
+#define PROFILE_MAP_MIN    4096 // Initial hash capacity (power of 2)
+
+#define OP_BRK 0x00
+#define OP_JSR 0x20
+
+// Open-addressed hash from a non-zero 64-bit key to an array index
+typedef struct
+{
+    uint64_t *keys;
+    uint32_t *values;
+    uint32_t capacity;
+    uint32_t count;
+} ProfileMap_t;
+
+typedef struct
+{
+    uint32_t key; // (bank + 1) << 16 | PC
+    uint8_t  op;  // As first seen
+    uint64_t count;
+    uint64_t cycles;
+} ProfilePC_t;
+
+// Row of the opcode table in the report
+typedef struct
+{
+    uint8_t  op;
+    uint64_t cycles;
+} ProfileOp_t;
+
+// Call tree node; node 0 is the root (whatever was running before the first
+// call the profiler saw)
+typedef struct
+{
+    uint32_t parent;
+    uint32_t key;  // (bank + 1) << 16 | entry address
+    uint8_t  kind;
+    uint64_t cycles; // Self cycles
+} ProfileNode_t;
+
+typedef struct
+{
+    uint32_t node;
+    uint8_t  s; // Stack pointer before the call; the frame ends once S rises back to it
+} ProfileFrame_t;
+
+typedef struct N6502Profile
+{
+    uint64_t op_count[256];
+    uint64_t op_cycles[256];
+    uint64_t total_cycles;
+
+    ProfileMap_t pc_map;
+    ProfilePC_t *pcs;
+    uint32_t num_pcs;
+    uint32_t pcs_capacity;
+
+    ProfileMap_t node_map;
+    ProfileNode_t *nodes;
+    uint32_t num_nodes;
+    uint32_t nodes_capacity;
+
+    ProfileFrame_t stack[PROFILE_MAX_DEPTH];
+    unsigned depth;
+    uint64_t overflows;
+} N6502Profile_t;
+
+static const char *FRAME_PREFIX[] =
+{
+    [N6502_FRAME_CALL] = "",
+    [N6502_FRAME_NMI]  = "NMI@",
+    [N6502_FRAME_IRQ]  = "IRQ@",
+    [N6502_FRAME_BRK]  = "BRK@",
+};
+
+// --------------------------------------------------------------------------------
+static void
+map_alloc(ProfileMap_t *map, uint32_t capacity)
+{
+    map->keys = calloc(capacity, sizeof(map->keys[0]));
+    map->values = calloc(capacity, sizeof(map->values[0]));
+    ASSERT(map->keys && map->values, "Could not allocate profile map\n");
+    map->capacity = capacity;
+    map->count = 0;
+}
+
+static inline uint32_t
+map_hash(uint64_t key)
+{
+    key *= 0x9e3779b97f4a7c15ULL;
+    return (uint32_t) (key >> 32);
+}
+
+static void map_insert(ProfileMap_t *map, uint64_t key, uint32_t value);
+
+static void
+map_grow(ProfileMap_t *map)
+{
+    ProfileMap_t old = *map;
+    uint32_t i;
+
+    map_alloc(map, old.capacity * 2);
+    for(i = 0; i < old.capacity; i++)
+    {
+        if(old.keys[i])
+            map_insert(map, old.keys[i], old.values[i]);
+    }
+
+    free(old.keys);
+    free(old.values);
+}
+
+static void
+map_insert(ProfileMap_t *map, uint64_t key, uint32_t value)
+{
+    uint32_t i;
+
+    if(2 * (map->count + 1) > map->capacity)
+        map_grow(map);
+
+    for(i = map_hash(key) & (map->capacity - 1); map->keys[i]; i = (i + 1) & (map->capacity - 1))
+        ;
+
+    map->keys[i] = key;
+    map->values[i] = value;
+    map->count++;
+}
+
+// Returns 1 and sets *value if key is present
+static inline int
+map_find(const ProfileMap_t *map, uint64_t key, uint32_t *value)
+{
+    uint32_t i;
+
+    for(i = map_hash(key) & (map->capacity - 1); map->keys[i]; i = (i + 1) & (map->capacity - 1))
+    {
+        if(map->keys[i] == key)
+        {
+            *value = map->values[i];
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void
+map_free(ProfileMap_t *map)
+{
+    free(map->keys);
+    free(map->values);
+    memset(map, 0, sizeof(*map));
+}
+
+// Grows an array of items to hold index n, doubling from the map capacity
+static void *
+array_reserve(void *array, uint32_t n, uint32_t *capacity, size_t size)
+{
+    if(n < *capacity)
+        return array;
+
+    *capacity = *capacity ? *capacity * 2 : PROFILE_MAP_MIN;
+    array = realloc(array, *capacity * size);
+    ASSERT(array, "Could not allocate profile data\n");
+
+    return array;
+}
+
+// --------------------------------------------------------------------------------
+static inline uint32_t
+profile_key(N6502_t *cpu, uint16_t addr)
+{
+    int bank = cpu->bank_of ? cpu->bank_of(cpu->mem_ctx, addr) : -1;
+
+    return ((uint32_t) (bank + 1) << 16) | addr;
+}
+
+static uint32_t
+profile_node(N6502Profile_t *prof, uint32_t parent, uint32_t key, N6502FrameKind_t kind)
+{
+    // Keys are at most 25 bits; the +1 keeps the map key non-zero
+    const uint64_t map_key = (((uint64_t) parent << 32) | ((uint64_t) kind << 25) | key) + 1;
+    uint32_t node;
+
+    if(map_find(&prof->node_map, map_key, &node))
+        return node;
+
+    node = prof->num_nodes++;
+    prof->nodes = array_reserve(prof->nodes, node, &prof->nodes_capacity, sizeof(prof->nodes[0]));
+    prof->nodes[node].parent = parent;
+    prof->nodes[node].key = key;
+    prof->nodes[node].kind = kind;
+    prof->nodes[node].cycles = 0;
+
+    map_insert(&prof->node_map, map_key, node);
+
+    return node;
+}
+
+static inline uint32_t
+profile_current(N6502Profile_t *prof)
+{
+    return prof->depth ? prof->stack[prof->depth - 1].node : 0;
+}
+
+static void
+profile_push(N6502Profile_t *prof, uint32_t key, N6502FrameKind_t kind, uint8_t s)
+{
+    uint32_t node;
+
+    if(prof->depth == PROFILE_MAX_DEPTH)
+    {
+        prof->overflows++;
+        return;
+    }
+
+    node = profile_node(prof, profile_current(prof), key, kind);
+    prof->stack[prof->depth].node = node;
+    prof->stack[prof->depth].s = s;
+    prof->depth++;
+}
+
+// Frames end when the stack unwinds past them, which covers RTS/RTI as well as
+// stack resets via TXS, while RTS used as an indirect jump (push, then RTS)
+// leaves the enclosing frame alone
+static inline void
+profile_unwind(N6502Profile_t *prof, uint8_t s)
+{
+    while(prof->depth && prof->stack[prof->depth - 1].s <= s)
+    {
+        prof->depth--;
+    }
+}
+
+void
+n6502_profile_init(N6502_t *cpu)
+{
+    N6502Profile_t *prof = calloc(1, sizeof(N6502Profile_t));
+    ASSERT(prof, "Could not allocate the profiler\n");
+
+    map_alloc(&prof->pc_map, PROFILE_MAP_MIN);
+    map_alloc(&prof->node_map, PROFILE_MAP_MIN);
+
+    // Root node
+    profile_node(prof, 0, 0, N6502_FRAME_CALL);
+
+    cpu->profile = prof;
+
+    NOTIFY("6502 profiler enabled\n");
+}
+
+void
+n6502_profile_destroy(N6502_t *cpu)
+{
+    N6502Profile_t *prof = cpu->profile;
+
+    if(! prof)
+        return;
+
+    map_free(&prof->pc_map);
+    map_free(&prof->node_map);
+    free(prof->pcs);
+    free(prof->nodes);
+    free(prof);
+
+    cpu->profile = NULL;
+}
+
+void
+n6502_profile_insn(N6502_t *cpu, uint16_t pc, uint8_t op, uint8_t s, unsigned cycles)
+{
+    N6502Profile_t *prof = cpu->profile;
+    const uint32_t key = profile_key(cpu, pc);
+    uint32_t i;
+
+    prof->op_count[op]++;
+    prof->op_cycles[op] += cycles;
+    prof->total_cycles += cycles;
+
+    if(! map_find(&prof->pc_map, (uint64_t) key + 1, &i))
+    {
+        i = prof->num_pcs++;
+        prof->pcs = array_reserve(prof->pcs, i, &prof->pcs_capacity, sizeof(prof->pcs[0]));
+        prof->pcs[i].key = key;
+        prof->pcs[i].op = op;
+        prof->pcs[i].count = 0;
+        prof->pcs[i].cycles = 0;
+        map_insert(&prof->pc_map, (uint64_t) key + 1, i);
+    }
+    prof->pcs[i].count++;
+    prof->pcs[i].cycles += cycles;
+
+    // The instruction's cycles belong to the routine it ran in; a JSR or BRK
+    // only opens its frame for the instructions that follow
+    prof->nodes[profile_current(prof)].cycles += cycles;
+
+    profile_unwind(prof, cpu->regs.S);
+
+    if(op == OP_JSR)
+        profile_push(prof, profile_key(cpu, cpu->regs.PC), N6502_FRAME_CALL, s);
+    else if(op == OP_BRK)
+        profile_push(prof, profile_key(cpu, cpu->regs.PC), N6502_FRAME_BRK, s);
+}
+
+void
+n6502_profile_interrupt(N6502_t *cpu, N6502FrameKind_t kind, uint8_t s, unsigned cycles)
+{
+    N6502Profile_t *prof = cpu->profile;
+
+    profile_push(prof, profile_key(cpu, cpu->regs.PC), kind, s);
+    prof->nodes[profile_current(prof)].cycles += cycles;
+    prof->total_cycles += cycles;
+}
+
+// --------------------------------------------------------------------------------
+// Report
+
+static int
+format_key(char *str, size_t size, uint32_t key)
+{
+    const int bank = (int) (key >> 16) - 1;
+
+    if(bank < 0)
+        return snprintf(str, size, "%04X", key & 0xffff);
+
+    return snprintf(str, size, "%02X:%04X", bank, key & 0xffff);
+}
+
+static int
+format_frame(char *str, size_t size, const ProfileNode_t *node)
+{
+    int n = snprintf(str, size, "%s", FRAME_PREFIX[node->kind]);
+
+    return n + format_key(str + n, size - n, node->key);
+}
+
+static int
+compare_ops(const void *a, const void *b)
+{
+    const uint64_t ca = ((const ProfileOp_t *) a)->cycles;
+    const uint64_t cb = ((const ProfileOp_t *) b)->cycles;
+
+    return (ca < cb) - (ca > cb);
+}
+
+static int
+compare_pcs(const void *a, const void *b)
+{
+    const uint64_t ca = ((const ProfilePC_t *) a)->cycles;
+    const uint64_t cb = ((const ProfilePC_t *) b)->cycles;
+
+    return (ca < cb) - (ca > cb);
+}
+
+static void
+write_folded(const N6502Profile_t *prof, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    uint32_t i;
+
+    ASSERT(fp, "Could not open %s\n", path);
+
+    for(i = 0; i < prof->num_nodes; i++)
+    {
+        uint32_t chain[PROFILE_MAX_DEPTH + 1];
+        unsigned depth = 0;
+        uint32_t node;
+
+        if(prof->nodes[i].cycles == 0)
+            continue;
+
+        for(node = i; node != 0; node = prof->nodes[node].parent)
+        {
+            chain[depth++] = node;
+        }
+
+        fprintf(fp, "root");
+        while(depth > 0)
+        {
+            char frame[32];
+
+            format_frame(frame, sizeof(frame), &prof->nodes[chain[--depth]]);
+            fprintf(fp, ";%s", frame);
+        }
+        fprintf(fp, " %" PRIu64 "\n", prof->nodes[i].cycles);
+    }
+
+    fclose(fp);
+}
+
+void
+n6502_profile_report(N6502_t *cpu)
+{
+    N6502Profile_t *prof = cpu->profile;
+    ProfilePC_t *pcs;
+    ProfileOp_t ops[256];
+    double total;
+    unsigned i;
+
+    if(! prof)
+        return;
+
+    total = prof->total_cycles ? (double) prof->total_cycles : 1.0;
+
+    NOTIFY("\n6502 profile: %" PRIu64 " cycles\n", prof->total_cycles);
+
+    for(i = 0; i < 256; i++)
+    {
+        ops[i].op = i;
+        ops[i].cycles = prof->op_cycles[i];
+    }
+    qsort(ops, 256, sizeof(ops[0]), compare_ops);
+
+    NOTIFY("\n  OP  NAME           COUNT          CYCLES       %%\n");
+    for(i = 0; i < 256 && prof->op_count[ops[i].op]; i++)
+    {
+        const uint8_t op = ops[i].op;
+        const char *name = n6502_op_name(op);
+
+        NOTIFY("  %02X  %-6s %14" PRIu64 " %15" PRIu64 " %6.2f%%\n",
+               op, name ? name : "???", prof->op_count[op], prof->op_cycles[op],
+               100.0 * prof->op_cycles[op] / total);
+    }
+
+    // Sort a copy: the histogram stays indexed by pc_map
+    pcs = malloc(prof->num_pcs * sizeof(pcs[0]) + 1);
+    ASSERT(pcs, "Could not allocate profile report\n");
+    memcpy(pcs, prof->pcs, prof->num_pcs * sizeof(pcs[0]));
+    qsort(pcs, prof->num_pcs, sizeof(pcs[0]), compare_pcs);
+
+    NOTIFY("\n  BK:PC    FIRST OP             COUNT          CYCLES       %%\n");
+    for(i = 0; i < prof->num_pcs && i < PROFILE_TOP_PCS; i++)
+    {
+        const ProfilePC_t *pc = &pcs[i];
+        const char *name = n6502_op_name(pc->op);
+        char where[16];
+
+        format_key(where, sizeof(where), pc->key);
+        NOTIFY("  %-8s %-6s %18" PRIu64 " %15" PRIu64 " %6.2f%%\n",
+               where, name ? name : "???", pc->count, pc->cycles, 100.0 * pc->cycles / total);
+    }
+
+    free(pcs);
+
+    if(prof->overflows)
+        NOTIFY("\nCall stack deeper than %d frames %" PRIu64 " times\n", PROFILE_MAX_DEPTH, prof->overflows);
+
+    if(cpu->options.profile)
+    {
+        write_folded(prof, cpu->options.profile);
+        NOTIFY("\nWrote folded call stacks to %s\n", cpu->options.profile);
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef __n6502_profile_h__
+#define __n6502_profile_h__
+
+#include "n6502.h"
+
+// Guest-level profiler: per-opcode counts and cycles, a per-(bank, PC)
+// histogram, and a call tree built from JSR/BRK/interrupt entries that is
+// written out as flamegraph folded stacks.  Only the debug core feeds it, so
+// the fast cores pay nothing when it is off.
+
+typedef enum
+{
+    N6502_FRAME_CALL = 0,
+    N6502_FRAME_NMI,
+    N6502_FRAME_IRQ,
+    N6502_FRAME_BRK,
+} N6502FrameKind_t;
+
+void n6502_profile_init(N6502_t *cpu);
+void n6502_profile_destroy(N6502_t *cpu);
+
+// s is the stack pointer before the instruction ran; cycles includes any
+// page-crossing or branch penalty
+void n6502_profile_insn(N6502_t *cpu, uint16_t pc, uint8_t op, uint8_t s, unsigned cycles);
+void n6502_profile_interrupt(N6502_t *cpu, N6502FrameKind_t kind, uint8_t s, unsigned cycles);
+
+void n6502_profile_report(N6502_t *cpu);
+
+#endif
@@ -0,0 +1,342 @@
+#include "n6502_trace.h"
+#include "n6502_watch.h"
+#include "log.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Default ring size when streaming; each full ring is one fwrite
+#define TRACE_STREAM_RECORDS (1 << 16)
+
+// Just enough of the opcode table to decode a record, so that the offline
+// decoder does not have to link the CPU core
+typedef struct
+{
+    const char *name;
+    AddressingMode_t mode;
+    unsigned undocumented;
+} TraceOp_t;
+
+#define GEN_OP(OP, UNDOCUMENTED, MODE, CYCLES, A, NAME, DESC) [OP] = {#NAME, MODE, UNDOCUMENTED},
+static const TraceOp_t TRACE_OPS[256] =
+{
+#include "n6502_opcodes.h"
+};
+#undef GEN_OP
+
+// Reads without side effects: I/O and mapper registers are not touched, and
+// read back as FFh (which is also what nestest.log shows for them)
+static uint8_t
+n6502_trace_peek(N6502_t *cpu, uint16_t addr)
+{
+#ifdef SEGMENTED_6502
+    const uint8_t *page = n6502_watch_page(cpu, addr);
+    return page ? page[addr & 0xff] : 0xff;
+#else
+    return cpu->mem[addr];
+#endif
+}
+
+// Indirect pointers do not carry into the high byte of their address
+static uint16_t
+n6502_trace_peek_word(N6502_t *cpu, uint16_t addr)
+{
+    uint16_t hi = (addr & 0xff00) | ((addr + 1) & 0xff);
+    return n6502_trace_peek(cpu, addr) | (n6502_trace_peek(cpu, hi) << 8);
+}
+
+void
+n6502_trace_capture(N6502_t *cpu, const N6502Regs_t *regs, N6502TraceRecord_t *rec)
+{
+    const uint16_t pc = regs->PC;
+    const uint8_t op = n6502_trace_peek(cpu, pc);
+    const AddressingMode_t mode = TRACE_OPS[op].mode;
+    const unsigned size = 1 + n6502_operand_bytes(mode);
+    const uint16_t abs = n6502_trace_peek(cpu, pc + 1) | (n6502_trace_peek(cpu, pc + 2) << 8);
+    const uint8_t zp = n6502_trace_peek(cpu, pc + 1);
+    int addr = -1;
+    unsigned i;
+
+    memset(rec, 0, sizeof(*rec));
+
+    rec->cycle = cpu->cycle;
+    rec->pc = pc;
+    for(i = 0; i < size; i++)
+        rec->bytes[i] = n6502_trace_peek(cpu, pc + i);
+
+    rec->A = regs->A;
+    rec->X = regs->X;
+    rec->Y = regs->Y;
+    rec->P = n6502_get_p(regs);
+    rec->S = regs->S;
+
+    switch(mode)
+    {
+        case AM_ZP:   addr = zp; break;
+        case AM_ZPX:  addr = (uint8_t) (zp + regs->X); break;
+        case AM_ZPY:  addr = (uint8_t) (zp + regs->Y); break;
+        case AM_ABS:  addr = abs; break;
+        case AM_ABSX: addr = (uint16_t) (abs + regs->X); break;
+        case AM_ABSY: addr = (uint16_t) (abs + regs->Y); break;
+
+        case AM_INDA:
+            rec->word = n6502_trace_peek_word(cpu, abs);
+            break;
+
+        case AM_INDX:
+            rec->word = n6502_trace_peek_word(cpu, (uint8_t) (zp + regs->X));
+            addr = rec->word;
+            break;
+
+        case AM_INDY:
+            rec->word = n6502_trace_peek_word(cpu, zp);
+            addr = (uint16_t) (rec->word + regs->Y);
+            break;
+
+        default:
+            break;
+    }
+
+    if(addr >= 0)
+        rec->value = n6502_trace_peek(cpu, addr);
+
+    if(cpu->trace_position)
+    {
+        int dot, scanline;
+
+        cpu->trace_position(cpu->trace_position_ptr, &dot, &scanline);
+        rec->dot = dot;
+        rec->scanline = scanline;
+        rec->flags |= N6502_TRACE_POSITION;
+    }
+}
+
+/*
+Examples:
+
+863E  2C 02 20  BIT $2002 = 00                  A:40 X:10 Y:10 P:37 SP:FD CYC: 63 SL:87
+8641  F0 FB     BEQ $863E                       A:40 X:10 Y:10 P:37 SP:FD CYC: 75 SL:87
+
+FIXME: add a branch taken/not taken flag
+*/
+int
+n6502_trace_format(const N6502TraceRecord_t *rec, char *str, size_t size)
+{
+    const TraceOp_t *op = &TRACE_OPS[rec->bytes[0]];
+    const char *name = op->name ? op->name : "???";
+    const unsigned len = 1 + n6502_operand_bytes(op->mode);
+    const uint8_t zp = rec->bytes[1];
+    const uint16_t abs = rec->bytes[1] | (rec->bytes[2] << 8);
+    char bytes[3][3];
+    char ops[32];
+    unsigned i;
+    int n;
+
+    for(i = 0; i < 3; i++)
+    {
+        if(i < len)
+            snprintf(bytes[i], sizeof(bytes[i]), "%02X", rec->bytes[i]);
+        else
+            strcpy(bytes[i], "  ");
+    }
+
+    switch(op->mode)
+    {
+        case AM_ACCUM:
+            snprintf(ops, sizeof(ops), "A");
+            break;
+
+        case AM_IMMED:
+            snprintf(ops, sizeof(ops), "#$%02X", zp);
+            break;
+
+        case AM_RELATIVE:
+            snprintf(ops, sizeof(ops), "$%04X", (uint16_t) (rec->pc + 2 + (int8_t) zp));
+            break;
+
+        case AM_ZP:
+            snprintf(ops, sizeof(ops), "$%02X = %02X", zp, rec->value);
+            break;
+
+        case AM_ZPX:
+            snprintf(ops, sizeof(ops), "$%02X,X @ %02X = %02X", zp, (uint8_t) (zp + rec->X), rec->value);
+            break;
+
+        case AM_ZPY:
+            snprintf(ops, sizeof(ops), "$%02X,Y @ %02X = %02X", zp, (uint8_t) (zp + rec->Y), rec->value);
+            break;
+
+        case AM_JMPABS:
+            snprintf(ops, sizeof(ops), "$%04X", abs);
+            break;
+
+        case AM_ABS:
+            snprintf(ops, sizeof(ops), "$%04X = %02X", abs, rec->value);
+            break;
+
+        case AM_ABSX:
+            snprintf(ops, sizeof(ops), "$%04X,X @ %04X = %02X", abs, (uint16_t) (abs + rec->X), rec->value);
+            break;
+
+        case AM_ABSY:
+            snprintf(ops, sizeof(ops), "$%04X,Y @ %04X = %02X", abs, (uint16_t) (abs + rec->Y), rec->value);
+            break;
+
+        case AM_INDA:
+            snprintf(ops, sizeof(ops), "($%04X) = %04X", abs, rec->word);
+            break;
+
+        case AM_INDX:
+            snprintf(ops, sizeof(ops), "($%02X,X) @ %02X = %04X = %02X",
+                     zp, (uint8_t) (zp + rec->X), rec->word, rec->value);
+            break;
+
+        case AM_INDY:
+            snprintf(ops, sizeof(ops), "($%02X),Y = %04X @ %04X = %02X",
+                     zp, rec->word, (uint16_t) (rec->word + rec->Y), rec->value);
+            break;
+
+        default:
+            ops[0] = 0;
+            break;
+    }
+
+    n = snprintf(str, size, "%04X  %s %s %s %c%c%c%c %-27s A:%02X X:%02X Y:%02X P:%02X SP:%02X",
+                 rec->pc, bytes[0], bytes[1], bytes[2],
+                 op->undocumented ? '*' : ' ', name[0], name[1], name[2],
+                 ops, rec->A, rec->X, rec->Y, rec->P, rec->S);
+
+    if((rec->flags & N6502_TRACE_POSITION) && n >= 0 && (size_t) n < size)
+    {
+        n += snprintf(str + n, size - n, " CYC:%3d SL:%d", rec->dot, rec->scanline);
+    }
+
+    return n;
+}
+
+static void
+n6502_trace_write(N6502Trace_t *trace, uint64_t first, uint64_t count)
+{
+    const uint32_t mask = trace->capacity - 1;
+
+    // The range may wrap around the end of the ring
+    while(count > 0)
+    {
+        uint32_t start = first & mask;
+        uint32_t n = trace->capacity - start;
+
+        if(n > count)
+            n = count;
+
+        if(trace->sink)
+        {
+            trace->sink(trace->sink_ptr, &trace->records[start], n);
+        }
+        else
+        {
+            ASSERT(fwrite(&trace->records[start], sizeof(N6502TraceRecord_t), n, trace->fp) == n,
+                   "Trace write failed\n");
+        }
+
+        first += n;
+        count -= n;
+        trace->written += n;
+    }
+}
+
+void
+n6502_trace_spill(N6502Trace_t *trace)
+{
+    n6502_trace_write(trace, trace->written, trace->count - trace->written);
+}
+
+static N6502Trace_t *
+n6502_trace_alloc(N6502_t *cpu, uint32_t capacity)
+{
+    N6502Trace_t *trace;
+
+    ASSERT(cpu->trace == NULL, "Already tracing\n");
+
+    trace = calloc(1, sizeof(*trace));
+    ASSERT(trace, "Failed to allocate trace\n");
+
+    trace->records = malloc(capacity * sizeof(N6502TraceRecord_t));
+    ASSERT(trace->records, "Failed to allocate %u trace records\n", capacity);
+
+    trace->capacity = capacity;
+    cpu->trace = trace;
+
+    return trace;
+}
+
+void
+n6502_trace_open(N6502_t *cpu, const char *path, uint32_t last)
+{
+    N6502Trace_t *trace;
+    N6502TraceHeader_t header;
+    uint32_t capacity = TRACE_STREAM_RECORDS;
+
+    if(last > 0)
+    {
+        for(capacity = 1; capacity < last && capacity < (1u << 31); capacity <<= 1)
+            ;
+    }
+
+    trace = n6502_trace_alloc(cpu, capacity);
+    trace->keep_last = (last > 0);
+
+    trace->fp = fopen(path, "wb");
+    ASSERT(trace->fp, "Could not open %s\n", path);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, N6502_TRACE_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(N6502TraceRecord_t);
+    fwrite(&header, sizeof(header), 1, trace->fp);
+
+    NOTIFY("6502 trace: %s (%u record %s)\n", path, capacity, trace->keep_last ? "history" : "buffer");
+}
+
+void
+n6502_trace_attach(N6502_t *cpu, uint32_t records, N6502TraceSink_t sink, void *ptr)
+{
+    N6502Trace_t *trace;
+
+    ASSERT(records > 0 && (records & (records - 1)) == 0, "Bad trace ring size: %u\n", records);
+
+    trace = n6502_trace_alloc(cpu, records);
+
+    trace->sink = sink;
+    trace->sink_ptr = ptr;
+}
+
+void
+n6502_trace_close(N6502_t *cpu)
+{
+    N6502Trace_t *trace = cpu->trace;
+
+    if(trace == NULL)
+        return;
+
+    if(trace->keep_last && trace->count > trace->capacity)
+    {
+        // Only the last ring's worth survives, oldest first
+        n6502_trace_write(trace, trace->count - trace->capacity, trace->capacity);
+    }
+    else
+    {
+        n6502_trace_spill(trace);
+    }
+
+    if(trace->fp)
+    {
+        fclose(trace->fp);
+        NOTIFY("6502 trace: %" PRIu64 " of %" PRIu64 " instructions written\n", trace->written, trace->count);
+    }
+
+    free(trace->records);
+    free(trace);
+
+    cpu->trace = NULL;
+}
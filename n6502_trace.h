@@ -0,0 +1,91 @@
+#ifndef __n6502_trace_h__
+#define __n6502_trace_h__
+
+#include <stdio.h>
+#include "n6502.h"
+
+// Binary instruction trace
+//
+// One fixed-size record per instruction, captured before it executes, holding
+// everything needed to print the line in nestest.log format later: the
+// instruction bytes, the registers, the memory operand and the PPU position.
+// Records go into an in-memory ring; when streaming, every full ring is written
+// out, otherwise only the last ring's worth is saved when the trace is closed.
+//
+// File layout: an N6502TraceHeader_t, then records in host byte order.
+
+#define N6502_TRACE_MAGIC      "N6502TR1"
+#define N6502_TRACE_LINE_SIZE  128
+
+#define N6502_TRACE_POSITION   0x01 // dot/scanline are valid
+
+typedef struct
+{
+    char     magic[8];
+    uint32_t record_size;
+    uint32_t reserved;
+} N6502TraceHeader_t;
+
+typedef struct
+{
+    int64_t  cycle;
+    uint16_t pc;
+    uint16_t word;     // Pointer target for (ind), (ind,X) and (ind),Y
+    int16_t  dot;      // PPU position, nestest numbering
+    int16_t  scanline;
+    uint8_t  bytes[3]; // Opcode and operands (unused bytes are zero)
+    uint8_t  value;    // Memory operand before execution (FFh for unmapped I/O)
+    uint8_t  A;
+    uint8_t  X;
+    uint8_t  Y;
+    uint8_t  P;
+    uint8_t  S;
+    uint8_t  flags;
+    uint8_t  reserved[6];
+} N6502TraceRecord_t;
+
+// Receives records in order instead of a file (see n6502_trace_attach)
+typedef void (*N6502TraceSink_t)(void *ptr, const N6502TraceRecord_t *records, uint32_t count);
+
+typedef struct N6502Trace
+{
+    N6502TraceRecord_t *records;
+    uint32_t capacity; // Power of 2
+    uint64_t count;    // Records captured
+    uint64_t written;  // Records written to fp
+    int keep_last;
+    FILE *fp;
+    N6502TraceSink_t sink; // Replaces fp when set
+    void *sink_ptr;
+} N6502Trace_t;
+
+// Streams every instruction to path, or with last > 0 keeps only the last
+// instructions (rounded up to a power of 2) and writes them on close.  Call
+// n6502_select_core() after either if the CPU is going to keep running.
+void n6502_trace_open(N6502_t *cpu, const char *path, uint32_t last);
+void n6502_trace_close(N6502_t *cpu);
+
+// Streams records to sink every time a ring of the given size (a power of 2)
+// fills; with a ring of 1 the sink sees each instruction just before it runs.
+// A sink may set cpu->stopped to halt the CPU at the next instruction.
+void n6502_trace_attach(N6502_t *cpu, uint32_t records, N6502TraceSink_t sink, void *ptr);
+
+void n6502_trace_capture(N6502_t *cpu, const N6502Regs_t *regs, N6502TraceRecord_t *rec);
+void n6502_trace_spill(N6502Trace_t *trace);
+
+static inline void
+n6502_trace_insn(N6502_t *cpu, const N6502Regs_t *regs)
+{
+    N6502Trace_t *trace = cpu->trace;
+
+    n6502_trace_capture(cpu, regs, &trace->records[trace->count & (trace->capacity - 1)]);
+    trace->count++;
+
+    if(! trace->keep_last && (trace->count & (trace->capacity - 1)) == 0)
+        n6502_trace_spill(trace);
+}
+
+// Renders rec as a nestest.log line (without a newline); returns its length
+int n6502_trace_format(const N6502TraceRecord_t *rec, char *str, size_t size);
+
+#endif
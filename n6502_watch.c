@@ -0,0 +1,501 @@
+#include "n6502_watch.h"
+#include "log.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define WATCH_READS (N6502_WATCH_EXEC | N6502_WATCH_READ)
+
+static const char *SPACE_NAMES[] =
+{
+    [N6502_SPACE_CPU] = "CPU",
+    [N6502_SPACE_PPU] = "PPU",
+};
+
+static N6502Watch_t *
+n6502_watch_get(N6502_t *cpu)
+{
+    N6502Watch_t *watch = cpu->watch;
+
+    if(watch)
+        return watch;
+
+    ASSERT(cpu->pages, "Watches need the bus installed\n");
+
+    watch = calloc(1, sizeof(*watch));
+    ASSERT(watch, "Failed to allocate watches\n");
+
+    watch->bus = *cpu->pages;
+    watch->resume_pc = -1;
+    cpu->watch = watch;
+
+    return watch;
+}
+
+// Pages holding a watched address drop to the slow path; so does the read side
+// of every page while a data hit waits for the next opcode fetch
+static void
+n6502_watch_map(N6502_t *cpu, unsigned page)
+{
+    N6502Watch_t *watch = cpu->watch;
+
+    cpu->pages->read[page]  = (watch->pending || watch->read_count[page]) ? NULL : watch->bus.read[page];
+    cpu->pages->write[page] = watch->write_count[page] ? NULL : watch->bus.write[page];
+}
+
+void
+n6502_watch_sync(N6502_t *cpu)
+{
+    N6502Watch_t *watch = cpu->watch;
+    unsigned page;
+
+    if(! watch)
+        return;
+
+    for(page = 0; page < N6502_NUM_PAGES; page++)
+    {
+        uint8_t *read = cpu->pages->read[page];
+        uint8_t *write = cpu->pages->write[page];
+
+        // A NULL entry is the owner's unless it is one that we unmapped
+        if(read || ! (watch->pending || watch->read_count[page]))
+            watch->bus.read[page] = read;
+
+        if(write || ! watch->write_count[page])
+            watch->bus.write[page] = write;
+
+        n6502_watch_map(cpu, page);
+    }
+}
+
+static void
+n6502_watch_set(N6502Watch_t *watch, uint16_t addr, unsigned kinds, int on)
+{
+    const uint8_t old = watch->cpu_flags[addr];
+    const uint8_t new = on ? (old | kinds) : (old & ~kinds);
+
+    watch->cpu_flags[addr] = new;
+
+    watch->read_count[addr >> 8]  += ((new & WATCH_READS) != 0) - ((old & WATCH_READS) != 0);
+    watch->write_count[addr >> 8] += ((new & N6502_WATCH_WRITE) != 0) - ((old & N6502_WATCH_WRITE) != 0);
+}
+
+static int
+n6502_watch_update(N6502_t *cpu, N6502Space_t space, uint32_t first, uint32_t last, unsigned kinds, int on)
+{
+    const uint32_t size = (space == N6502_SPACE_PPU) ? N6502_PPU_SPACE_SIZE : 0xffff + 1;
+    N6502Watch_t *watch;
+    uint32_t addr;
+    unsigned page;
+
+    kinds &= N6502_WATCH_EXEC | N6502_WATCH_READ | N6502_WATCH_WRITE;
+
+    if(first > last || last >= size || kinds == 0)
+        return 0;
+
+    // The PPU never executes
+    if(space == N6502_SPACE_PPU && (kinds & N6502_WATCH_EXEC))
+        return 0;
+
+    if(! on && ! cpu->watch)
+        return 1;
+
+    watch = n6502_watch_get(cpu);
+
+    if(space == N6502_SPACE_PPU)
+    {
+        for(addr = first; addr <= last; addr++)
+            watch->ppu_flags[addr] = on ? (watch->ppu_flags[addr] | kinds) : (watch->ppu_flags[addr] & ~kinds);
+
+        return 1;
+    }
+
+    // Pick up any bank switches before the counts change
+    n6502_watch_sync(cpu);
+
+    for(addr = first; addr <= last; addr++)
+        n6502_watch_set(watch, addr, kinds, on);
+
+    for(page = first >> 8; page <= last >> 8; page++)
+        n6502_watch_map(cpu, page);
+
+    // Cached blocks on pages that lost their mapping must not run again, and the
+    // write aliasing checks have to be redone
+    n6502_block_cache_flush(cpu);
+
+    return 1;
+}
+
+int
+n6502_watch_add(N6502_t *cpu, N6502Space_t space, uint32_t first, uint32_t last, unsigned kinds)
+{
+    return n6502_watch_update(cpu, space, first, last, kinds, 1);
+}
+
+int
+n6502_watch_remove(N6502_t *cpu, N6502Space_t space, uint32_t first, uint32_t last, unsigned kinds)
+{
+    return n6502_watch_update(cpu, space, first, last, kinds, 0);
+}
+
+void
+n6502_watch_destroy(N6502_t *cpu)
+{
+    N6502Watch_t *watch = cpu->watch;
+    unsigned page;
+
+    if(! watch)
+        return;
+
+    NOTIFY("Watches: %" PRIu64 " hits\n", watch->hits);
+
+    n6502_watch_sync(cpu);
+
+    // Hand the owner back its page table
+    for(page = 0; page < N6502_NUM_PAGES; page++)
+    {
+        cpu->pages->read[page] = watch->bus.read[page];
+        cpu->pages->write[page] = watch->bus.write[page];
+    }
+
+    free(watch);
+    cpu->watch = NULL;
+
+    n6502_block_cache_flush(cpu);
+}
+
+void
+n6502_watch_set_log_only(N6502_t *cpu, int log_only)
+{
+    n6502_watch_get(cpu)->log_only = log_only;
+}
+
+int
+n6502_watch_parse(N6502_t *cpu, const char *spec, int remove)
+{
+    N6502Space_t space = N6502_SPACE_CPU;
+    unsigned kinds = 0;
+    unsigned long first, last;
+    const char *p = spec;
+    char *end;
+
+    if(strncasecmp(p, "ppu:", 4) == 0)
+    {
+        space = N6502_SPACE_PPU;
+        p += 4;
+    }
+    else if(strncasecmp(p, "cpu:", 4) == 0)
+    {
+        p += 4;
+    }
+
+    // A bare address is an execution breakpoint
+    if(strchr(p, ':'))
+    {
+        for(; *p != ':'; p++)
+        {
+            switch(*p)
+            {
+                case 'r': case 'R': kinds |= N6502_WATCH_READ;  break;
+                case 'w': case 'W': kinds |= N6502_WATCH_WRITE; break;
+                case 'x': case 'X': kinds |= N6502_WATCH_EXEC;  break;
+
+                default:
+                    return 0;
+            }
+        }
+        p++;
+    }
+    else
+    {
+        kinds = N6502_WATCH_EXEC;
+    }
+
+    if(*p == '$')
+        p++;
+
+    first = strtoul(p, &end, 16);
+    if(end == p)
+        return 0;
+
+    last = first;
+    if(*end == '-')
+    {
+        p = end + 1;
+        last = strtoul(p, &end, 16);
+        if(end == p)
+            return 0;
+    }
+
+    if(*end)
+        return 0;
+
+    return n6502_watch_update(cpu, space, first, last, kinds, ! remove);
+}
+
+static void
+n6502_watch_list_space(N6502Space_t space, const uint8_t *flags, uint32_t size)
+{
+    uint32_t addr = 0;
+
+    while(addr < size)
+    {
+        const uint8_t kinds = flags[addr];
+        uint32_t last = addr;
+
+        if(! kinds)
+        {
+            addr++;
+            continue;
+        }
+
+        while(last + 1 < size && flags[last + 1] == kinds)
+            last++;
+
+        printf("  %s:%s%s%s:%04X", (space == N6502_SPACE_PPU) ? "ppu" : "cpu",
+               (kinds & N6502_WATCH_READ) ? "r" : "",
+               (kinds & N6502_WATCH_WRITE) ? "w" : "",
+               (kinds & N6502_WATCH_EXEC) ? "x" : "",
+               addr);
+
+        if(last != addr)
+            printf("-%04X", last);
+
+        printf("\n");
+
+        addr = last + 1;
+    }
+}
+
+void
+n6502_watch_list(N6502_t *cpu)
+{
+    N6502Watch_t *watch = cpu->watch;
+
+    if(! watch)
+    {
+        printf("No breakpoints or watchpoints\n");
+        return;
+    }
+
+    printf("Breakpoints and watchpoints (%" PRIu64 " hits):\n", watch->hits);
+    n6502_watch_list_space(N6502_SPACE_CPU, watch->cpu_flags, sizeof(watch->cpu_flags));
+    n6502_watch_list_space(N6502_SPACE_PPU, watch->ppu_flags, sizeof(watch->ppu_flags));
+}
+
+// --------------------------------------------------------------------------------
+// Hits
+// --------------------------------------------------------------------------------
+
+// Data accesses happen part way through an instruction, when the registers are
+// not current; the hit is reported at the next opcode fetch instead
+static void
+n6502_watch_hit(N6502_t *cpu, N6502Space_t space, unsigned kind, uint16_t addr, uint8_t data)
+{
+    N6502Watch_t *watch = cpu->watch;
+    unsigned page;
+
+    watch->hits++;
+
+    // Only the first hit of an instruction is reported
+    if(watch->pending)
+        return;
+
+    watch->pending = 1;
+    watch->hit_space = space;
+    watch->hit_kind = kind;
+    watch->hit_addr = addr;
+    watch->hit_data = data;
+
+    for(page = 0; page < N6502_NUM_PAGES; page++)
+        cpu->pages->read[page] = NULL;
+
+    n6502_block_cache_yield(cpu);
+}
+
+void
+n6502_watch_ppu_hit(N6502_t *cpu, unsigned kind, uint16_t addr, uint8_t data)
+{
+    n6502_watch_hit(cpu, N6502_SPACE_PPU, kind, addr, data);
+}
+
+// Prints the hit and puts the pages back; returns 1 if the CPU should stop
+static int
+n6502_watch_report(N6502_t *cpu)
+{
+    N6502Watch_t *watch = cpu->watch;
+    const uint16_t pc = cpu->regs.PC;
+
+    if(watch->pending)
+    {
+        const int read = (watch->hit_kind == N6502_WATCH_READ);
+        unsigned page;
+
+        printf("%s %s watch: $%04X %s %02Xh, stopped @ PC %04Xh\n",
+               SPACE_NAMES[watch->hit_space], read ? "read" : "write",
+               watch->hit_addr, read ? "=>" : "<=", watch->hit_data, pc);
+
+        n6502_watch_sync(cpu);
+        watch->pending = 0;
+
+        for(page = 0; page < N6502_NUM_PAGES; page++)
+            n6502_watch_map(cpu, page);
+    }
+    else
+    {
+        watch->hits++;
+        printf("Hit breakpoint @ %04Xh\n", pc);
+    }
+
+    printf("%" PRIu64 " cycles elapsed\n", cpu->cycle - cpu->last_breakpoint_cycle);
+    cpu->last_breakpoint_cycle = cpu->cycle;
+
+    // The instruction at PC runs next without stopping again
+    watch->trap = 0;
+    watch->resume_pc = pc;
+    watch->resume_cycle = cpu->cycle;
+
+    if(watch->log_only)
+        return 0;
+
+    cpu->options.step = 1;
+    return 1;
+}
+
+static int
+n6502_watch_resuming(N6502Watch_t *watch, N6502_t *cpu, uint16_t pc)
+{
+    return pc == watch->resume_pc && cpu->cycle == watch->resume_cycle;
+}
+
+uint8_t
+n6502_watch_read(N6502_t *cpu, uint16_t addr)
+{
+    N6502Watch_t *watch = cpu->watch;
+    const uint8_t *page = watch->bus.read[addr >> 8];
+    const uint8_t data = page ? page[addr & 0xff] : cpu->read_mem(cpu->mem_ctx, addr);
+
+    if(watch->cpu_flags[addr] & N6502_WATCH_READ)
+        n6502_watch_hit(cpu, N6502_SPACE_CPU, N6502_WATCH_READ, addr, data);
+
+    return data;
+}
+
+void
+n6502_watch_write(N6502_t *cpu, uint16_t addr, uint8_t data)
+{
+    N6502Watch_t *watch = cpu->watch;
+    uint8_t *page = watch->bus.write[addr >> 8];
+
+    if(watch->cpu_flags[addr] & N6502_WATCH_WRITE)
+        n6502_watch_hit(cpu, N6502_SPACE_CPU, N6502_WATCH_WRITE, addr, data);
+
+    if(page)
+    {
+        page[addr & 0xff] = data;
+    }
+    else
+    {
+        cpu->write_mem(cpu->mem_ctx, addr, data);
+        cpu->bus_writes++;
+    }
+}
+
+// Breakpoints plant a DEBUG_TRAP in place of the opcode; the trap handler calls
+// n6502_watch_break()
+uint8_t
+n6502_watch_fetch(N6502_t *cpu, uint16_t pc)
+{
+    N6502Watch_t *watch = cpu->watch;
+    const uint8_t *page;
+
+    if((watch->pending || (watch->cpu_flags[pc] & N6502_WATCH_EXEC)) &&
+       ! n6502_watch_resuming(watch, cpu, pc))
+    {
+        watch->trap = 1;
+        return OP_DEBUG_TRAP;
+    }
+
+    page = watch->bus.read[pc >> 8];
+    return page ? page[pc & 0xff] : cpu->read_mem(cpu->mem_ctx, pc);
+}
+
+int
+n6502_watch_idempotent(N6502_t *cpu, uint16_t addr)
+{
+    N6502Watch_t *watch = cpu->watch;
+
+    if(watch->cpu_flags[addr] & N6502_WATCH_READ)
+        return 0;
+
+    if(watch->bus.read[addr >> 8])
+        return 1;
+
+    return cpu->read_idempotent && cpu->read_idempotent(cpu->mem_ctx, addr);
+}
+
+void
+n6502_watch_check(N6502_t *cpu)
+{
+    N6502Watch_t *watch = cpu->watch;
+    const uint16_t pc = cpu->regs.PC;
+
+    watch->trap = 0;
+
+    if(watch->pending ||
+       ((watch->cpu_flags[pc] & N6502_WATCH_EXEC) && ! n6502_watch_resuming(watch, cpu, pc)))
+    {
+        n6502_watch_report(cpu);
+    }
+}
+
+void
+n6502_watch_break(N6502_t *cpu)
+{
+    N6502Watch_t *watch = cpu->watch;
+
+    if(! n6502_watch_report(cpu))
+    {
+        // Logging only: the planted trap does not count as an instruction
+        watch->uncounted = 1;
+        return;
+    }
+
+    // The debug core brings up the CLI and finishes the run.  Outside of a run
+    // the fast core just carries on, and the CLI comes up on the next one.
+    n6502_select_core(cpu);
+
+    if(watch->can_escape)
+        longjmp(watch->escape, 1);
+}
+
+void
+n6502_watch_run(N6502_t *cpu, int64_t last_cycle, int hard_limit,
+                int64_t max_instructions, int until_stopped)
+{
+    N6502Watch_t *watch = cpu->watch;
+    const int64_t start = cpu->inst_count;
+
+    if(watch->can_escape)
+    {
+        cpu->core(cpu, last_cycle, hard_limit, max_instructions, until_stopped);
+        return;
+    }
+
+    watch->can_escape = 1;
+
+    if(setjmp(watch->escape))
+    {
+        // A fast core stopped on a hit with its registers written back
+        cpu->core(cpu, last_cycle, hard_limit, max_instructions - (cpu->inst_count - start), until_stopped);
+    }
+    else
+    {
+        cpu->core(cpu, last_cycle, hard_limit, max_instructions, until_stopped);
+    }
+
+    watch->can_escape = 0;
+}
@@ -0,0 +1,124 @@
+#ifndef __n6502_watch_h__
+#define __n6502_watch_h__
+
+#include <setjmp.h>
+#include "n6502.h"
+
+// Breakpoints and watchpoints
+//
+// Any number of execution breakpoints and read/write watchpoints over the CPU
+// address space, plus read/write watchpoints on the PPU address space ($2007
+// accesses).  The cost lives in the bus: a CPU page holding a watched address
+// is taken out of the page table, so its accesses (and opcode fetches) drop to
+// the slow path where they are checked; every other page keeps its direct
+// mapping, and the fast cores and block cache run on it as before.
+//
+// Execution breakpoints stop before the instruction runs.  Data hits stop at
+// the next instruction boundary, so that the registers are current: every read
+// page is unmapped until the next opcode fetch.  A hit in a fast core jumps
+// back to n6502_run(), which finishes the run in the debug core; continuing
+// from the CLI goes back to the fast core.
+
+#define N6502_WATCH_EXEC   0x01
+#define N6502_WATCH_READ   0x02
+#define N6502_WATCH_WRITE  0x04
+
+#define N6502_PPU_SPACE_SIZE 0x4000
+
+typedef enum
+{
+    N6502_SPACE_CPU = 0,
+    N6502_SPACE_PPU,
+} N6502Space_t;
+
+typedef struct N6502Watch
+{
+    uint8_t cpu_flags[0xffff + 1];
+    uint8_t ppu_flags[N6502_PPU_SPACE_SIZE];
+
+    // Watched addresses per CPU page; a page is unmapped while its count is
+    // non-zero (reads for EXEC/READ, writes for WRITE)
+    uint16_t read_count[N6502_NUM_PAGES];
+    uint16_t write_count[N6502_NUM_PAGES];
+
+    // The owner's mapping for every page, including the ones taken away
+    N6502PageTable_t bus;
+
+    // A data hit is waiting for the next instruction boundary
+    int pending;
+    N6502Space_t hit_space;
+    unsigned hit_kind;
+    uint16_t hit_addr;
+    uint8_t hit_data;
+
+    int trap;             // The DEBUG_TRAP in flight was planted by a hit
+    int uncounted;        // It was logged and carried on: not an instruction
+    int32_t resume_pc;    // Run the instruction here without stopping again
+    int64_t resume_cycle; // (-1 if none), unless anything has run since the hit
+    int log_only;         // Report hits and carry on (soak runs)
+    uint64_t hits;
+
+    // Valid while n6502_watch_run() is on the stack
+    jmp_buf escape;
+    int can_escape;
+} N6502Watch_t;
+
+// Watches can only be added once the bus is installed.  Returns 0 if the range
+// is bad.
+int  n6502_watch_add(N6502_t *cpu, N6502Space_t space, uint32_t first, uint32_t last, unsigned kinds);
+int  n6502_watch_remove(N6502_t *cpu, N6502Space_t space, uint32_t first, uint32_t last, unsigned kinds);
+void n6502_watch_destroy(N6502_t *cpu);
+
+// "[ppu:]KINDS:ADDR[-ADDR]" with KINDS any of r, w, x (eg. "w:0300-03ff",
+// "x:c000", "ppu:w:3f00-3f1f"); remove instead of adding if remove is set
+int  n6502_watch_parse(N6502_t *cpu, const char *spec, int remove);
+void n6502_watch_list(N6502_t *cpu);
+
+// Report hits without stopping
+void n6502_watch_set_log_only(N6502_t *cpu, int log_only);
+
+// The owner must call this after changing its page table (eg. a bank switch)
+void n6502_watch_sync(N6502_t *cpu);
+
+// Runs cpu->core with a landing pad for hits in the fast cores
+void n6502_watch_run(N6502_t *cpu, int64_t last_cycle, int hard_limit,
+                     int64_t max_instructions, int until_stopped);
+
+// Debug core: sets options.step if it should stop before the instruction at PC
+void n6502_watch_check(N6502_t *cpu);
+
+// Fast cores: a planted trap was hit (the registers have been written back)
+void n6502_watch_break(N6502_t *cpu);
+
+// Idle-loop detection: false for watched addresses
+int  n6502_watch_idempotent(N6502_t *cpu, uint16_t addr);
+
+void n6502_watch_ppu_hit(N6502_t *cpu, unsigned kind, uint16_t addr, uint8_t data);
+
+// The PPU calls this on every $2007 access, with the address as written and
+// after mirroring
+static inline void
+n6502_watch_ppu(N6502_t *cpu, unsigned kind, uint16_t addr, uint16_t mirror, uint8_t data)
+{
+    N6502Watch_t *watch = cpu->watch;
+
+    if(watch && ((watch->ppu_flags[addr & (N6502_PPU_SPACE_SIZE - 1)] |
+                  watch->ppu_flags[mirror & (N6502_PPU_SPACE_SIZE - 1)]) & kind))
+    {
+        n6502_watch_ppu_hit(cpu, kind, addr, data);
+    }
+}
+
+// The owner's backing store for addr, ignoring watches (NULL for I/O)
+static inline const uint8_t *
+n6502_watch_page(N6502_t *cpu, uint16_t addr)
+{
+    const uint8_t *page = cpu->pages->read[addr >> 8];
+
+    if(! page && cpu->watch)
+        page = cpu->watch->bus.read[addr >> 8];
+
+    return page;
+}
+
+#endif
@@ -1,11 +1,19 @@
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <inttypes.h>
 
 #include "nes.h"
+#include "audio.h"
 #include "input.h"
 #include "log.h"
 #include "nes_mapper.h"
+#include "n6502_profile.h"
+#include "n6502_trace.h"
+#include "n6502_watch.h"
+#include "n6502_aot.h"
+#include "nes_rom.h"
+#include "nes_gui.h"
 
 // TEST ROMS:
 // http://www.bspquakeeditor.com/users/sort/testroms/
@@ -50,8 +58,6 @@
 
 #define LOG_PPU(...) _LOG(PPU, __VA_ARGS__)
 
-static NES_t *global_nes = 0;
-
 static const char SRAM_HEADER[4] = {'S', 'R', 'A', 'M'};
 
 typedef struct
@@ -68,19 +74,18 @@ nes_get_state(void *ptr)
     if(! nes)
         return NULL;
 
-    static char msg[32];
-    sprintf(msg, "%3d:%3d @ %5" PRIu64,
-            nes->ppu.frame_count,
-            nes->ppu.scanline,
-            (nes->cpu.cycle - nes->frame_start_cpu_cycle));
+    snprintf(nes->state_msg, sizeof(nes->state_msg), "%3d:%3d @ %5" PRIu64,
+             nes->ppu.frame_count,
+             nes->ppu.scanline,
+             (nes->cpu.cycle - nes->frame_start_cpu_cycle));
 
-    return msg;
+    return nes->state_msg;
 }
 
 void
 nes_save_sram(NES_t *nes)
 {
-    if(nes->battery_backed_sram)
+    if(nes->battery_backed_sram && nes->rom_path)
     {
         char sram_path[128];
         snprintf(sram_path, sizeof(sram_path), "%s.sram", nes->rom_path);
@@ -94,7 +99,7 @@ nes_save_sram(NES_t *nes)
 
                 memcpy(sram.header, SRAM_HEADER, sizeof(SRAM_HEADER));
                 sram.size = NES_SRAM_SIZE;
-                memcpy(&sram.sram, nes->state.sram, sram.size);
+                memcpy(&sram.sram, nes->sram, sram.size);
 
                 fwrite(&sram, sizeof(sram), 1, fp);
                 NOTIFY("Wrote SRAM to %s\n", sram_path);
@@ -115,7 +120,7 @@ nes_save_sram(NES_t *nes)
 void
 nes_restore_sram(NES_t *nes)
 {
-    if(nes->battery_backed_sram)
+    if(nes->battery_backed_sram && nes->rom_path)
     {
         char sram_path[128];
         snprintf(sram_path, sizeof(sram_path), "%s.sram", nes->rom_path);
@@ -133,7 +138,7 @@ nes_restore_sram(NES_t *nes)
 
                 ASSERT(memcmp(sram.header, SRAM_HEADER, sizeof(SRAM_HEADER)) == 0, "Bad SRAM header in %s\n", sram_path);
                 ASSERT(sram.size == NES_SRAM_SIZE, "Bad SRAM size\n");
-                memcpy(nes->state.sram, &sram.sram, sram.size);
+                memcpy(nes->sram, &sram.sram, sram.size);
 
                 NOTIFY("Read SRAM from %s\n", sram_path);
                 fclose(fp);
@@ -150,24 +155,37 @@ nes_restore_sram(NES_t *nes)
     }
 }
 
+// Test modes exit from deep inside the emulation; flush the CPU trace first
+static void
+nes_exit(NES_t *nes, int status)
+{
+    n6502_trace_close(&nes->cpu);
+    exit(status);
+}
+
 void
 nes_quit(NES_t *nes)
 {
     if(nes->options.blargg_test)
     {
         NOTIFY("ABORTED from Blargg test\n");
-        exit(1);
+        nes_exit(nes, 1);
     }
 
     nes_save_sram(nes);
 
     nes_unload(nes);
+    n6502_block_cache_destroy(&nes->cpu);
+    n6502_profile_destroy(&nes->cpu);
+    n6502_trace_close(&nes->cpu);
+    n6502_watch_destroy(&nes->cpu);
 
     NOTIFY("Quit: %d frames\n", nes->ppu.frame_count);
     if(! nes->options.disable_audio)
         nes_apu_destroy(&nes->apu);
-    display_destroy(nes->ppu.display);
-    nes_rom_chooser_destroy(&nes->gui.chooser);
+
+    if(nes->gui)
+        nes_gui_destroy(nes);
 }
 
 // --------------------------------------------------------------------------------
@@ -195,6 +213,8 @@ nes_spr_ram_dma(NES_t *nes, uint16_t src_addr)
         *dest = src_byte;
         src_addr++;
     }
+
+    ppu->scanline_sprites.dirty = 1;
 }
 
 // --------------------------------------------------------------------------------
@@ -209,13 +229,13 @@ nes_check_blargg(NES_t *nes, uint16_t offset, uint8_t data)
     {
         if(offset == BLARGG_OFFSET_STATUS)
         {
-            const uint8_t blargg_status = global_nes->state.sram[BLARGG_OFFSET_STATUS];
+            const uint8_t blargg_status = nes->sram[BLARGG_OFFSET_STATUS];
             NOTIFY("Blargg status: 0x%02X\n", blargg_status);
 
             if(blargg_status != 0xff &&
                blargg_status != 0x80)
             {
-                const char *blargg_str = (const char *) &global_nes->state.sram[BLARGG_OFFSET_STR];
+                const char *blargg_str = (const char *) &nes->sram[BLARGG_OFFSET_STR];
                 const int len = strlen(blargg_str);
                 if(len > 0)
                 {
@@ -232,12 +252,12 @@ nes_check_blargg(NES_t *nes, uint16_t offset, uint8_t data)
                     else if(blargg_status == 0)
                     {
                         NOTIFY("Blargg PASSED\n");
-                        exit(0);
+                        nes_exit(nes, 0);
                     }
                     else
                     {
                         NOTIFY("Blargg FAILED: %02X\n", blargg_status);
-                        exit(1);
+                        nes_exit(nes, 1);
                     }
                 }
             }
@@ -257,7 +277,7 @@ nes_check_blargg_work_ram(NES_t *nes, uint16_t addr, uint8_t data)
         if(addr == BLARGG_ADDR_PPU && data == 0x01)
         {
             const uint16_t addr = (nes->options.blargg_test == 1) ? BLARGG_ADDR_STATUS : BLARGG_ADDR_STATUS2;
-            const uint8_t blargg_status = global_nes->state.ram[addr];
+            const uint8_t blargg_status = nes->state.ram[addr];
             NOTIFY("Blargg work ram status: 0x%02X\n", blargg_status);
 
             if(blargg_status != 0)
@@ -265,12 +285,12 @@ nes_check_blargg_work_ram(NES_t *nes, uint16_t addr, uint8_t data)
                 if(blargg_status == 0x01)
                 {
                     NOTIFY("Blargg work ram PASSED\n");
-                    exit(0);
+                    nes_exit(nes, 0);
                 }
                 else
                 {
                     NOTIFY("Blargg FAILED: %02X\n", blargg_status);
-                    exit(1);
+                    nes_exit(nes, 1);
                 }
             }
         }
@@ -280,22 +300,24 @@ nes_check_blargg_work_ram(NES_t *nes, uint16_t addr, uint8_t data)
 // --------------------------------------------------------------------------------
 
 static void
-nes_write_mem(uint16_t addr, uint8_t data)
+nes_write_mem(void *p, uint16_t addr, uint8_t data)
 {
+    NES_t *nes = (NES_t *) p;
+
     switch(addr >> 12)
     {
         // 0000-07FFh   Internal 2K Work RAM (mirrored to 800h-1FFFh)
         case 0x0:
         case 0x1:
             LOG_WRITE("Work RAM[%04Xh] <= %02Xh\n", addr, data);
-            global_nes->state.ram[addr & 0x07ff] = data;
+            nes->state.ram[addr & 0x07ff] = data;
             break;
 
         // 2000h-2007h   Internal PPU Registers (mirrored to 2008h-3FFFh)
         case 0x2:
         case 0x3:
         {
-            NESPPU_t *ppu = &global_nes->ppu;
+            NESPPU_t *ppu = &nes->ppu;
 
             nes_ppu_reg_write(ppu, addr, data);
 
@@ -311,19 +333,19 @@ nes_write_mem(uint16_t addr, uint8_t data)
                 switch(addr)
                 {
                     case 0x4014:
-                        nes_spr_ram_dma(global_nes, data << 8);
+                        nes_spr_ram_dma(nes, data << 8);
                         break;
 
                     case 0x4016:
                         if(data & 1)
                         {
-                            input_latch_joypads(global_nes);
+                            input_latch_joypads(nes);
                             INFO_NES("Joypad[%04Xh] capture\n", addr);
                         }
                         else
                         {
-                            global_nes->joypad_data1 = global_nes->joypad_latch1;
-                            global_nes->joypad_data2 = global_nes->joypad_latch2;
+                            nes->joypad_data1 = nes->joypad_latch1;
+                            nes->joypad_data2 = nes->joypad_latch2;
                             INFO_NES("Joypad[%04Xh] latch\n", addr);
                         }
 
@@ -331,19 +353,19 @@ nes_write_mem(uint16_t addr, uint8_t data)
 
                     default:
                         LOG_WRITE("APU[%04Xh] <= %02Xh\n", addr, data);
-                        nes_check_blargg_work_ram(global_nes, addr, data);
+                        nes_check_blargg_work_ram(nes, addr, data);
                         break;
                 }
 
-                nes_apu_write(&global_nes->apu, addr, data);
+                nes_apu_write(&nes->apu, addr, data);
             }
             else
             {
                 // FIXME: see Rad Racer
                 LOG_WRITE("Cartridge expansion area[%04Xh] <= %02Xh\n", addr, data);
-                if(global_nes->cartridge_write)
+                if(nes->cartridge_write)
                 {
-                    global_nes->cartridge_write(global_nes->cartridge_pointer, addr, data);
+                    nes->cartridge_write(nes->cartridge_pointer, addr, data);
                 }
             }
             break;
@@ -351,20 +373,20 @@ nes_write_mem(uint16_t addr, uint8_t data)
         // 6000h-7FFFh   Cartridge SRAM Area 8K
         case 0x6:
         case 0x7:
-            LOG_WRITE("SRAM[%04X] <= %02X, PC @ %04X\n", addr, data, global_nes->cpu.regs.PC - 2);
+            LOG_WRITE("SRAM[%04X] <= %02X, PC @ %04X\n", addr, data, nes->cpu.regs.PC - 2);
 
 #define NES_SRAM_BASE 0x6000
-            global_nes->state.sram[addr - NES_SRAM_BASE] = data;
+            nes->sram[addr - NES_SRAM_BASE] = data;
 
-            nes_check_blargg(global_nes, addr - NES_SRAM_BASE, data);
+            nes_check_blargg(nes, addr - NES_SRAM_BASE, data);
 
             break;
 
         // 8000h-FFFFh   Cartridge PRG-ROM Area 32K
         default:
-            if(global_nes->prg_rom_write)
+            if(nes->prg_rom_write)
             {
-                global_nes->prg_rom_write(global_nes, addr, data);
+                nes->prg_rom_write(nes, addr, data);
             }
             break;
 
@@ -372,8 +394,9 @@ nes_write_mem(uint16_t addr, uint8_t data)
 }
 
 static uint8_t
-nes_read_mem(uint16_t addr)
+nes_read_mem(void *p, uint16_t addr)
 {
+    NES_t *nes = (NES_t *) p;
     uint8_t data = 0;
 
     switch(addr >> 12)
@@ -382,14 +405,14 @@ nes_read_mem(uint16_t addr)
         case 0x0:
         case 0x1:
             //LOG("READ Work RAM[%04Xh]\n", addr);
-            data = global_nes->state.ram[addr & 0x07ff];
+            data = nes->state.ram[addr & 0x07ff];
             break;
 
         // 2000h-2007h   Internal PPU Registers (mirrored to 2008h-3FFFh)
         case 0x2:
         case 0x3:
         {
-            NESPPU_t *ppu = &global_nes->ppu;
+            NESPPU_t *ppu = &nes->ppu;
 
             switch(addr & 0x7)
             {
@@ -415,7 +438,7 @@ nes_read_mem(uint16_t addr)
 
 #if 0
                     printf("Read 2002 @ %04Xh, value=%02Xh, scanline=%d, cycle %" PRIu64 ")\n",
-                           global_nes->cpu.regs.PC, data, ppu->scanline, global_nes->cpu.cycle);
+                           nes->cpu.regs.PC, data, ppu->scanline, nes->cpu.cycle);
 #endif
 
                     LOG_NES("Frame: %d, SL: %d, PPU Status[%02Xh] => %02Xh\n",
@@ -471,26 +494,26 @@ nes_read_mem(uint16_t addr)
 +++------- D7-D5 of last value on data bus
            (usually 010, from upper bits of $4016)
 */
-                        data = global_nes->joypad_data1 & 1;
-                        data |= global_nes->paddle_buttondown << 1;
+                        data = nes->joypad_data1 & 1;
+                        data |= nes->paddle_buttondown << 1;
                         data |= 0x40;
 
                         INFO_NES("Joypad[%04Xh] => %02Xh\n", addr, data);
-                        global_nes->joypad_data1 >>= 1;
-                        global_nes->joypad_data1 |= 0x80;
+                        nes->joypad_data1 >>= 1;
+                        nes->joypad_data1 |= 0x80;
                         break;
 
                     case 0x4017:
-                        data = (global_nes->joypad_data2 & 1) << 1;
+                        data = (nes->joypad_data2 & 1) << 1;
                         //data |= 0x40;
                         //data = 2;
                         // HACK: disable joypad2
                         LOG_READ("Joypad[%04Xh] => %02Xh\n", addr, data);
-                        global_nes->joypad_data2 >>= 1;
+                        nes->joypad_data2 >>= 1;
                         break;
 
                     default:
-                        return nes_apu_read(&global_nes->apu, addr);
+                        return nes_apu_read(&nes->apu, addr);
                 }
             }
             else
@@ -504,7 +527,7 @@ nes_read_mem(uint16_t addr)
         // 6000h-7FFFh   Cartridge SRAM Area 8K
         case 0x6:
         case 0x7:
-            data = global_nes->state.sram[addr - 0x6000];
+            data = nes->sram[addr - 0x6000];
             LOG_READ("Cartridge SRAM: %04Xh => %02Xh\n", addr, data);
             break;
 
@@ -515,7 +538,7 @@ nes_read_mem(uint16_t addr)
             //LOG("READ PRG-ROM[%04Xh]\n", addr);
             addr -= 0x8000;
             bank = (addr >> 12) & 0x7;
-            data = global_nes->prg_rom[bank][addr & 0xfff];
+            data = nes->prg_rom[bank][addr & 0xfff];
             break;
         }
     }
@@ -523,13 +546,66 @@ nes_read_mem(uint16_t addr)
     return data;
 }
 
+// Polling $2002 only clears vblank and the address latch, so once it has been
+// read the result cannot change until the PPU status is next updated
+static int
+nes_read_idempotent(void *p, uint16_t addr)
+{
+    return (addr >> 13) == 1 && (addr & 0x7) == 0x2;
+}
+
+// 16K PRG-ROM bank mapped at addr, so that profiles tell banked routines apart
+static int
+nes_bank_of(void *p, uint16_t addr)
+{
+    NES_t *nes = p;
+    const uint8_t *slot;
+
+    if(addr < NES_PRG_ROM_BASE)
+        return -1;
+
+    slot = nes->prg_rom[(addr - NES_PRG_ROM_BASE) / NES_PRG_SLOT_SIZE];
+    if(! slot || ! nes->prg_rom_banks)
+        return -1;
+
+    return (slot - nes->prg_rom_banks) / PRG_ROM_BANK_SIZE;
+}
+
 static void
 nes_install_memory_map(NES_t *nes)
 {
+    unsigned page;
+
+    memset(&nes->pages, 0, sizeof(nes->pages));
+
+    // 0000-1FFFh: 2K work RAM, mirrored
+    for(page = 0x00; page < 0x20; page++)
+    {
+        uint8_t *ram = nes->state.ram + ((page << 8) & (NES_WORK_RAM_SIZE - 1));
+        nes->pages.read[page] = ram;
+        nes->pages.write[page] = ram;
+    }
+
+    // 6000-7FFFh: SRAM; blargg tests watch SRAM writes, so leave those to the handler
+    for(page = 0x60; page < 0x80; page++)
+    {
+        uint8_t *sram = nes->sram + ((page - 0x60) << 8);
+        nes->pages.read[page] = sram;
+        if(! nes->options.blargg_test)
+        {
+            nes->pages.write[page] = sram;
+        }
+    }
+
+    // 8000-FFFFh: read pages are filled in by nes_select_prg_rom_bank(); writes go to the mapper
+
     nes->cpu.read_mem  = nes_read_mem;
     nes->cpu.write_mem = nes_write_mem;
+    nes->cpu.mem_ctx   = nes;
+    nes->cpu.pages     = &nes->pages;
 
-    global_nes = nes;
+    nes->cpu.read_idempotent = nes_read_idempotent;
+    nes->cpu.bank_of = nes_bank_of;
 
     INFO_NES("Installed NES memory map\n");
 }
@@ -541,7 +617,7 @@ static void ines_dump_cart(NES_t *nes, iNES_t *ines)
     NOTIFY("16K PRG-ROM:  %d\n", ines->num_16k_prg_rom_banks);
     NOTIFY("8K  VROM:     %d\n", ines->num_8k_vrom_banks);
     NOTIFY("8K  PRG-RAM:  %d\n", ines->num_8k_prg_ram_banks);
-    NOTIFY("SRAM:         %d/%d\n", nes->sram, nes->battery_backed_sram);
+    NOTIFY("SRAM:         %d/%d\n", nes->has_sram, nes->battery_backed_sram);
     NOTIFY("Trainer:      %d\n", nes->trainer);
     NOTIFY("Four screen:  %d\n", nes->ppu.state.four_screen);
     NOTIFY("ROM Control:  %x %x\n", ines->rom_control_byte1, ines->rom_control_byte2);
@@ -552,16 +628,9 @@ static void ines_dump_cart(NES_t *nes, iNES_t *ines)
 }
 
 static void
-nes_load_ines(NES_t *nes, FILE *fp)
+nes_load_ines(NES_t *nes, NESRomImage_t *rom)
 {
-    iNES_t ines;
-    int result;
-    unsigned i;
-
-    if(! ines_load(&ines, fp))
-    {
-        ASSERT(0, "ROM load fail");
-    }
+    iNES_t ines = rom->ines;
 
     nes->mapper_num = ines_mapper_num(&ines);
 
@@ -573,7 +642,7 @@ nes_load_ines(NES_t *nes, FILE *fp)
         ASSERT(0, "iNES 2.0\n");
     }
 
-    nes->sram = (ines.flags10 >> 4) & 1;
+    nes->has_sram = (ines.flags10 >> 4) & 1;
     nes->battery_backed_sram = (ines.rom_control_byte1 & 2) != 0;
     nes->trainer = (ines.rom_control_byte1 & 4) != 0;
     nes->ppu.state.four_screen = (ines.rom_control_byte1 & 8) != 0;
@@ -590,33 +659,15 @@ nes_load_ines(NES_t *nes, FILE *fp)
         fprintf(stderr, "WARNING: PAL not impl\n");
     }
 
+    // The banks are the read-only image itself; only the CPU and PPU page
+    // tables point into them and the bus never writes through those
     nes->num_prg_rom_banks = ines.num_16k_prg_rom_banks;
-    nes->prg_rom_banks = malloc(ines.num_16k_prg_rom_banks * PRG_ROM_BANK_SIZE);
-
-    for(i = 0; i < ines.num_16k_prg_rom_banks; i++)
-    {
-        result = fread(nes->prg_rom_banks + i * PRG_ROM_BANK_SIZE, PRG_ROM_BANK_SIZE, 1, fp);
-        ASSERT(result == 1, "Bad PRG ROM 16K read: %d\n", i);
-    }
+    nes->prg_rom_banks = (uint8_t *) rom->prg;
 
     nes->ppu.has_vrom = (ines.num_8k_vrom_banks > 0);
     nes->ppu.num_vrom_banks = ines.num_8k_vrom_banks;
-
-    if(nes->ppu.has_vrom)
-    {
-        nes->ppu.vrom_banks = malloc(VROM_BANK_SIZE * ines.num_8k_vrom_banks);
-    }
-    else
-    {
-        // FIXME: always allocate 1 VROM Bank?
-        nes->ppu.vrom_banks = malloc(VROM_BANK_SIZE * 1);
-    }
-
-    for(i = 0; i < ines.num_8k_vrom_banks; i++)
-    {
-        result = fread(nes->ppu.vrom_banks + i * VROM_BANK_SIZE, VROM_BANK_SIZE, 1, fp);
-        ASSERT(result == 1, "Bad VROM 8K read: %d\n", i);
-    }
+    nes->ppu.vrom_banks = (uint8_t *) rom->chr;
+    nes->ppu.vrom_patterns = nes_rom_chr_patterns(rom);
 
     // FIXME: move into mapper init
     if(ines.num_8k_vrom_banks >= 1)
@@ -627,315 +678,64 @@ nes_load_ines(NES_t *nes, FILE *fp)
 
     nes_mapper_init(nes);
 
+    // The translator only follows fixed and UxROM banking
+    if(nes->cpu.options.aot && (nes->mapper_num == 0 || nes->mapper_num == 2))
+    {
+        n6502_aot_load(&nes->cpu, nes->cpu.options.aot, nes->prg_rom_banks,
+                       nes->num_prg_rom_banks * PRG_ROM_BANK_SIZE);
+        n6502_select_core(&nes->cpu);
+    }
+
     nes_restore_sram(nes);
 }
 
 void
 nes_unload(NES_t *nes)
 {
-    if(nes->prg_rom_banks)
+    if(nes->rom)
     {
-        free(nes->prg_rom_banks);
-        nes->prg_rom_banks = NULL;
+        nes_rom_release(nes->rom);
+        nes->rom = NULL;
     }
-
-    if(nes->ppu.vrom_banks)
+    else if(nes->prg_rom_banks)
     {
-        free(nes->ppu.vrom_banks);
-        nes->ppu.vrom_banks = NULL;
+        // NSF: built by nsf_load
+        free(nes->prg_rom_banks);
     }
 
+    nes->prg_rom_banks = NULL;
+    nes->ppu.vrom_banks = NULL;
+    nes->ppu.vrom_patterns = NULL;
     nes->num_prg_rom_banks = 0;
 
-    NOTIFY("Unloaded %s\n", nes->rom_path);
-}
-
-// --------------------------------------------------------------------------------
-
-static void
-nes_cpu_window_draw(Display_t *display, Window_t *window, DisplayPixel_t *origin, int stride, Rect_t *clip)
-{
-    char msg[128];
-    char *m = msg;
-    NES_t *nes = (NES_t *) window->p;
-    int font_y_offset = 1;
-
-    m += sprintf(m, "PC: %04X\n", nes->cpu.regs.PC);
-    m += sprintf(m, "A:%02X X:%02X Y:%02X P:%02X SP:%02X\n",
-                 nes->cpu.regs.A, nes->cpu.regs.X, nes->cpu.regs.Y,
-                 nes->cpu.regs.P.word, nes->cpu.regs.S);
-
-    font_printstr(nes->gui.display.font, (origin + 1 + font_y_offset * stride), stride, msg, clip);
-}
-
-static void
-nes_cpu_window_init(NES_t *nes)
-{
-    Window_t *window = &nes->gui.cpu_window;
-    window->title = "CPU";
-    window->width = 260;
-    window->height = 40;
-    window->p = nes;
-    window->y = 265;
-    window->draw = nes_cpu_window_draw;
-    window_init(window);
-
-    display_add_window(&nes->gui.display, window);
-}
-
-// --------------------------------------------------------------------------------
-
-static void
-nes_apu_sine_wave(NES_t *nes, DisplayPixel_t *origin, int stride, Rect_t *clip)
-{
-#define NUM_VISUALIZATION_SAMPLES 128
-
-#if 0 // this crashes in gdb
-    static float values[NUM_VISUALIZATION_SAMPLES] = {0};
-    const DisplayPixel_t pixel = display_maprgb(&nes->gui.display, 0xff, 0xff, 0xdd);
-    unsigned i;
-
-    for(i = 0; i < NUM_VISUALIZATION_SAMPLES - 1; i++)
-    {
-        values[i] = values[i + 1];
-    }
-
-    values[NUM_VISUALIZATION_SAMPLES - 1] = nes->apu.sample_average;
-
-    for(i = 0; i < sizeof(values); i++)
-    {
-        int amplitude = (int) (values[i] * 16);
-
-        display_line(origin, 0, 32 - amplitude, 0, 32 + amplitude,
-                     pixel,
-                     stride, clip);
-        origin++;
-    }
-#endif
-}
-
-static void
-nes_apu_window_draw(Display_t *display, Window_t *window, DisplayPixel_t *origin, int stride, Rect_t *clip)
-{
-    NES_t *nes = (NES_t *) window->p;
-    NESAPU_t *apu = &nes->apu;
-    char msg[256];
-    char *m = msg;
-
-    int font_y_offset = 1;
-
-    m += sprintf(m, "Mode:   %d Hz, %s\n",
-                 (apu->state.frame_sequencer_mode == MODE_240HZ) ? 240 : 192,
-                 apu->state.frame_irq ? "IRQ" : "[-]");
-
-    m += sprintf(m, "Volume: %X %X %X %X %X\n",
-                 apu->state.square[0].volume,
-                 apu->state.square[1].volume,
-                 apu->state.triangle.volume,
-                 apu->state.noise.volume,
-                 apu->state.dmc.volume);
-
-    m += sprintf(m, "Freq:   %4d %4d %4d %4d %4d\n",
-                 apu->state.square[0].cpu_period,
-                 apu->state.square[1].cpu_period,
-                 apu->state.triangle.cpu_period,
-                 apu->state.noise.cpu_period,
-                 apu->state.dmc.cpu_period);
-
-    m += sprintf(m, "Length: %3X %3X %3X %3X %3X\n",
-                 apu->state.square[0].length_count,
-                 apu->state.square[1].length_count,
-                 apu->state.triangle.length_count,
-                 apu->state.noise.length_count,
-                 apu->state.dmc.length_count);
-
-    font_printstr(nes->gui.display.font, (origin + 1 + font_y_offset * stride), stride, msg, clip);
-    nes_apu_sine_wave(nes, origin, stride, clip);
-}
-
-static void
-nes_apu_window_init(NES_t *nes)
-{
-    Window_t *window = &nes->gui.apu_window;
-    window->title = "APU";
-    window->width = 260;
-    window->height = 80;
-    window->p = nes;
-    window->y = 30;
-    window->draw = nes_apu_window_draw;
-    window_init(window);
-
-    display_add_window(&nes->gui.display, window);
-}
-
-// --------------------------------------------------------------------------------
-
-static void
-nes_mem_window_draw(Display_t *display, Window_t *window, DisplayPixel_t *origin, int stride, Rect_t *clip)
-{
-    NES_t *nes = (NES_t *) window->p;
-    uint8_t *ram = nes->state.ram;
-    DisplayPixel_t addr;
-    DisplayPixel_t *row = origin;
-    DisplayPixel_t *output = row;
-
-    //0000h-07FFh   Internal 2K Work RAM (mirrored to 800h-1FFFh)
-    for(addr = 0x0000; addr < 0x0800; addr++)
-    {
-        // FIXME assumes 16bpp
-        DisplayPixel_t pixel;
-        uint8_t value = ram[addr];
-
-        if((addr & 63) == 0)
-        {
-            output = row;
-            row += stride * 2;
-        }
-
-        // Convert from RGB 332 to RGB 565
-        pixel = ((value >> 5) << 13) | (((value >> 2) & 7) << 8) | ((value & 3) << 2);
-
-        output[0] = pixel;
-        output[1] = pixel;
-        output[stride + 0] = pixel;
-        output[stride + 1] = pixel;
-        output += 2;
-    }
-}
-
-static void
-nes_mem_window_init(NES_t *nes)
-{
-    Window_t *window = &nes->gui.mem_window;
-    window->title = "Memory";
-    window->width = 128;
-    window->height = 64;
-    window->p = nes;
-    window->draw = nes_mem_window_draw;
-    window->x = 290;
-    window->y = 500;;
-    window_init(window);
-
-    display_add_window(&nes->gui.display, window);
-}
-
-// --------------------------------------------------------------------------------
-static void
-nes_rom_select(NESRomChooser_t *chooser, const char *path)
-{
-    NES_t *nes = (NES_t *) chooser->p;
-    INFO_NES("Selecting ROM: %s\n", path);
-    nes->next_rom = path;
-}
-
-// --------------------------------------------------------------------------------
-
-static void
-menu_quit(MenuItem_t *item)
-{
-    global_nes->options.quit = 1;
-}
-
-static void
-menu_load(MenuItem_t *item)
-{
-    NES_t *nes = global_nes; // FIXME: global_nes should be nixed
-    display_select_window(&nes->gui.display, &nes->gui.chooser.window);
-}
-
-MenuItem_t MENU_WINDOW = {
-    .text = "Window",
-    .type = mitSubMenu,
-};
-
-MenuItem_t MENU_FILE_QUIT = {
-    .text = "Quit",
-    .type = mitEntry,
-    .key_accelerator = 'q',
-    .on_select = menu_quit,
-};
-
-MenuItem_t MENU_FILE_SAVE = {
-    .text = "Save State",
-    .type = mitEntry,
-    .next = &MENU_FILE_QUIT,
-};
-
-MenuItem_t MENU_FILE_LOAD = {
-    .text = "Load ROM",
-    .type = mitEntry,
-    .on_select = menu_load,
-    .key_accelerator = 'l',
-    .next = &MENU_FILE_SAVE,
-};
-
-MenuItem_t MENU_FILE = {
-    .text = "File",
-    .type = mitSubMenu,
-    .next = &MENU_WINDOW,
-    .child_menu = &MENU_FILE_LOAD,
-};
+    n6502_aot_unload(&nes->cpu);
 
-// --------------------------------------------------------------------------------
-
-static void
-nes_gui_init(NES_t *nes)
-{
-    nes->gui.display.width = nes->ppu.options.display_width;
-    nes->gui.display.height = nes->ppu.options.display_height;
-    nes->gui.display.depth_in_bytes = 2; // FIXME 16bpp
-    nes->gui.display.windowed = nes->ppu.options.display_windowed;
-
-    nes->gui.display.show_cursor = ! nes->ppu.options.enable_paddle;
-
-    display_init(&nes->gui.display, &MENU_FILE);
-    status_overlay_init(&nes->gui.status_overlay, &nes->gui.display);
-
-    if(nes->ppu.options.display_windowed)
-    {
-        nes_cpu_window_init(nes);
-        nes_mem_window_init(nes);
-    }
+    // The freed banks may be handed back for the next ROM at the same address
+    n6502_block_cache_flush(&nes->cpu);
 
-    nes->gui.chooser.p = nes;
-    nes->gui.chooser.on_select = nes_rom_select;
-    nes_rom_chooser_init(&nes->gui.chooser, &nes->gui.display);
-    nes->gui.chooser.window.y = 20;
+    if(nes->rom_path)
+        NOTIFY("Unloaded %s\n", nes->rom_path);
 }
 
+// PPU position of the CPU in nestest.log terms, for traces and state dumps
 static void
-nes_ppu_dump_state(void *obj)
+nes_ppu_position(void *obj, int *dot, int *scanline)
 {
     NES_t *nes = (NES_t *) obj;
-    int scanline;
     int64_t cpu_frame_cycles;
     int64_t ppu_scanline_start_cycle;
-    int64_t ppu_scanline_cycle;
 
     // Convert from "Brad Taylor PPU scanline #" to "nestest scanline #"
-    scanline = nes->ppu.scanline - 21;
+    *scanline = nes->ppu.scanline - 21;
 
-    if(scanline < -1)
+    if(*scanline < -1)
     {
-        scanline += 262;
+        *scanline += 262;
     }
 
     cpu_frame_cycles = (nes->cpu.cycle - nes->frame_start_cpu_cycle);
     ppu_scanline_start_cycle = nes->ppu.scanline * PPU_CYCLES_PER_SCANLINE;
-    ppu_scanline_cycle = cpu_frame_cycles * 3 - ppu_scanline_start_cycle;
-
-#if 0
-    NOTIFY("CPUT:%3d CPUF:%3d SL:%3d SLC:%3d PPU:%3d\n",
-           (int)nes->cpu.cycle, (int)cpu_frame_cycles, nes->ppu.scanline,
-           (int)ppu_scanline_start_cycle, (int)ppu_scanline_cycle);
-
-    if(nes->ppu.scanline >= 200)
-        ASSERT(0, "stop");
-#endif
-
-    _INFO(6502, "CYC:%3d SL:%3d\n",
-          (int16_t) ppu_scanline_cycle,
-          scanline);
+    *dot = (int16_t) (cpu_frame_cycles * 3 - ppu_scanline_start_cycle);
 }
 
 static void
@@ -953,12 +753,16 @@ nes_init(NES_t *nes, int install_memory_map)
         nes_install_memory_map(nes);
     }
 
-    nes->cpu.dump_state_func = nes_ppu_dump_state;
-    nes->cpu.dump_state_ptr = nes;
+    nes->cpu.trace_position = nes_ppu_position;
+    nes->cpu.trace_position_ptr = nes;
 
-    nes_gui_init(nes);
+    nes_sched_init(&nes->sched);
+    nes_ppu_init(&nes->ppu, &nes->cpu, &nes->sched);
 
-    nes_ppu_init(&nes->ppu, &nes->gui.display, &nes->cpu);
+    if(! nes->options.headless)
+    {
+        nes_gui_init(nes);
+    }
 
     if(! nes->options.disable_audio)
     {
@@ -966,39 +770,71 @@ nes_init(NES_t *nes, int install_memory_map)
         nes->apu.increment_cycles_func = &nes_increment_cycles;
         nes->apu.get_state_func = &nes_get_state;
         nes->apu.arg_ptr = nes;
+
+        // Nobody to hear it: keep the APU running for its IRQs and $4015, but
+        // never touch an audio device
+        if(nes->options.headless)
+            nes->apu.audio = &NULL_AUDIO;
+
         nes_apu_init(&nes->apu);
 
-        nes_apu_window_init(nes);
+        if(nes->gui)
+            nes_gui_init_apu(nes);
     }
 }
 
+const char *
+nes_rom_unsupported(const NESRomImage_t *rom)
+{
+    const iNES_t *ines = &rom->ines;
+
+    if(((ines->rom_control_byte2 >> 2) & 3) == 2)
+        return "iNES 2.0";
+
+    if(ines->num_16k_prg_rom_banks < 1)
+        return "no PRG-ROM";
+
+    if(ines->rom_control_byte1 & 4)
+        return "trainer";
+
+    if(ines->rom_control_byte1 & 8)
+        return "four-screen VRAM";
+
+    if(! nes_mapper_supported(ines_mapper_num(ines)))
+        return "mapper";
+
+    return NULL;
+}
+
 void
 nes_load_rom(NES_t *nes, const char *rom_path)
 {
-    FILE *fp;
+    NESRomImage_t *rom = nes_rom_open(rom_path);
 
+    ASSERT(rom, "Could not open '%s'", rom_path);
+    nes_load_rom_image(nes, rom, rom_path);
+}
+
+void
+nes_load_rom_image(NES_t *nes, NESRomImage_t *rom, const char *rom_path)
+{
     nes->rom_path = rom_path;
 
     memset(&nes->state, 0, sizeof(nes->state));
+    memset(nes->sram, 0, sizeof(nes->sram));
 
-    fp = fopen(rom_path, "rb");
-    ASSERT(fp != 0, "Could not open '%s'", rom_path);
+    nes->rom = rom;
 
-    if(1)
-    {
-        nes_ppu_reset(&nes->ppu);
-        nes_load_ines(nes, fp);
-    }
-
-    fclose(fp);
+    // Nothing from the last ROM (eg. a sprite 0 hit) may fire in this one
+    nes_sched_init(&nes->sched);
 
-    NOTIFY_NES(nes, "Loaded %s [Mapper #%d]", rom_path, nes->mapper_num);
+    nes_ppu_reset(&nes->ppu);
+    nes_load_ines(nes, nes->rom);
 
-    display_select_window(nes->ppu.display, &nes->ppu.gui.nes_window);
+    NOTIFY_NES(nes, "Loaded %s [Mapper #%d]", rom_path ? rom_path : "ROM image", nes->mapper_num);
 
-    // Hide the menubar
-    nes->gui.display.menubar.visible = 0;
-    menubar_deselect(&nes->gui.display.menubar);
+    if(nes->gui)
+        nes_gui_rom_loaded(nes);
 
     nes_pause(nes, 0); // Unpause
 }
@@ -1006,7 +842,8 @@ nes_load_rom(NES_t *nes, const char *rom_path)
 void
 nes_hard_reset(NES_t *nes)
 {
-    display_reset(nes->ppu.display);
+    if(nes->gui)
+        nes_gui_reset(nes);
 }
 
 void
@@ -1016,6 +853,10 @@ nes_soft_reset(NES_t *nes)
 
     n6502_reset(&nes->cpu);
 
+    // Pending events are timed against the old cycle count; the next frame
+    // schedules its own from the new one
+    nes_sched_init(&nes->sched);
+
     if(! nes->options.disable_audio)
         nes_apu_reset(&nes->apu);
 }
@@ -1051,7 +892,8 @@ nes_render_frame(NES_t *nes)
         input_delay(ppu->last_frame_ms - current_time_ms);
     }
 
-    display_draw(ppu->display);
+    if(nes->gui)
+        nes_gui_draw(nes);
 
     //else
     //{
@@ -1067,6 +909,76 @@ nes_render_frame(NES_t *nes)
     ppu->frame_count++;
 }
 
+// VBlank starts: the PPU raises NMI if it is enabled
+static void
+nes_vblank_event(void *p)
+{
+    NES_t *nes = (NES_t *) p;
+
+    // The new frame is timed from here, without the NMI's own cycles
+    nes->vblank_cpu_cycle = nes->cpu.cycle;
+
+    LOG_NES("PPU In VBLANK @ cycle %" PRIu64 "\n", nes->cpu.cycle);
+    if(nes->ppu.nmi_on_vblank)
+    {
+        n6502_nmi(&nes->cpu);
+        // FIXME
+        //nes->cpu.cycle += 7;
+    }
+}
+
+// The APU frame counter's quarter frame tick
+static void
+nes_apu_frame_event(void *p)
+{
+    NES_t *nes = (NES_t *) p;
+
+    if(nes_apu_240hz(&nes->apu))
+    {
+        //NOTIFY("Triggering APU IRQ\n");
+        n6502_irq(&nes->cpu);
+    }
+}
+
+// The mapper's scanline counter is clocked, and may raise IRQ
+static void
+nes_mapper_event(void *p)
+{
+    NES_t *nes = (NES_t *) p;
+
+    if(nes_mapper_scanline(nes))
+    {
+        n6502_irq(&nes->cpu);
+    }
+}
+
+// Runs the CPU for up to max_cycles, stopping to fire each scheduled event.  An
+// event fires after the first instruction that completes at or past its cycle,
+// so an event that is already due waits for one more instruction.
+static void
+nes_run_cpu(NES_t *nes, int64_t max_cycles, int hard_limit)
+{
+    N6502_t *cpu = &nes->cpu;
+    const int64_t last_cycle = cpu->cycle + max_cycles;
+
+    do
+    {
+        const int64_t inst_count = cpu->inst_count;
+        const int64_t next_event = nes_sched_next(&nes->sched);
+
+        cpu->event_cycle = (next_event > cpu->cycle) ? next_event : cpu->cycle + 1;
+        n6502_run(cpu, last_cycle - cpu->cycle, hard_limit);
+
+        // Stopped short by the hard limit
+        if(cpu->inst_count == inst_count)
+            break;
+
+        nes_sched_run(&nes->sched, cpu->cycle);
+    } while(cpu->cycle < last_cycle);
+
+    cpu->event_cycle = NES_NO_EVENT;
+}
+
 void
 nes_run_frame(NES_t *nes)
 {
@@ -1075,6 +987,7 @@ nes_run_frame(NES_t *nes)
         nes_unload(nes);
         nes_load_rom(nes, nes->next_rom);
         nes_hard_reset(nes);
+        nes_soft_reset(nes);
         nes->next_rom = NULL;
     }
 
@@ -1100,17 +1013,8 @@ nes_run_frame(NES_t *nes)
 
     if(nes->options.escape)
     {
-        Window_t *top_window = nes->gui.display.top_window;
-
-        if(top_window && top_window->has_titlebar && top_window->visible)
-        {
-            // Hide the topmost (ie focused) window
-            display_hide_window(&nes->gui.display, top_window);
-        }
-        else
-        {
-            display_set_menubar(&nes->gui.display, ! nes->gui.display.menubar.visible);
-        }
+        if(nes->gui)
+            nes_gui_escape(nes);
 
         nes->options.escape = 0;
     }
@@ -1132,25 +1036,43 @@ nes_run_frame(NES_t *nes)
         }
         */
 
+        // VBlank starts once what is left of the last frame has run
+        nes_sched_add(&nes->sched, nes->cpu.cycle + nes->frame_surplus_cpu_cycles, nes_vblank_event, nes);
+
         if(nes->frame_surplus_cpu_cycles)
         {
             int64_t s = nes->cpu.cycle;
 
-            n6502_run(&nes->cpu, nes->frame_surplus_cpu_cycles, 0);
+            nes_run_cpu(nes, nes->frame_surplus_cpu_cycles, 0);
 
-            offset = nes->cpu.cycle - s - nes->frame_surplus_cpu_cycles;
+            offset = nes->vblank_cpu_cycle - s - nes->frame_surplus_cpu_cycles;
             nes->frame_surplus_cpu_cycles = 0;
         }
+        else
+        {
+            // With nothing left to run, VBlank is due right away
+            nes_sched_run(&nes->sched, nes->cpu.cycle);
+        }
 
-        nes->frame_start_cpu_cycle = nes->cpu.cycle - offset;
+        nes->frame_start_cpu_cycle = nes->vblank_cpu_cycle - offset;
         nes->frame_cpu_cycle = offset;
         nes->ppu.scanline_start_ppu_cycle -= offset * 3;
 
+        // Quarter frames @ 60Hz == 240Hz, each at the end of every 60th scanline
+        for(scanline = 60; scanline < NES_PPU_SCANLINES; scanline += 60)
+        {
+            if(scanline >= NES_PPU_VERTICAL_RESET)
+            {
+                int64_t next_ppu_scanline_cycle = nes->ppu.scanline_start_ppu_cycle + (scanline + 1) * PPU_CYCLES_PER_SCANLINE;
+
+                nes_sched_add(&nes->sched, nes->frame_start_cpu_cycle + (next_ppu_scanline_cycle + 2) / 3,
+                              nes_apu_frame_event, nes);
+            }
+        }
+
         INFO_NES("Frame: %d, cycle %" PRIu64 "\n", nes->ppu.frame_count, nes->frame_start_cpu_cycle);
         for(scanline = 0; scanline < NES_PPU_SCANLINES; scanline++)
         {
-            int mapper_irq;
-
             nes->ppu.scanline = scanline;
             nes->scanline_start_cycle = nes->cpu.cycle;
 
@@ -1160,20 +1082,22 @@ nes_run_frame(NES_t *nes)
 
             nes_ppu_update_status(&nes->ppu);
 
-            if(scanline == NES_PPU_VBLANK)
-            {
-                LOG_NES("PPU In VBLANK @ cycle %" PRIu64 "\n", nes->scanline_start_cycle);
-                if(nes->ppu.nmi_on_vblank)
-                {
-                    n6502_nmi(&nes->cpu);
-                    // FIXME
-                    //nes->cpu.cycle += 7;
-                }
-            }
-
             int64_t next_ppu_scanline_cycle = nes->ppu.scanline_start_ppu_cycle + PPU_CYCLES_PER_SCANLINE;
             int64_t max_scanline_cpu_cycles = (next_ppu_scanline_cycle - (nes->frame_cpu_cycle * 3) + 2) / 3;
 
+            // The pre-render line and each visible line clock the mapper's
+            // scanline counter part way through.  A line is drawn at the end
+            // of the one before it is shown, so writes made by the IRQ handler
+            // in the rest of this line land on the next one drawn.
+            if(scanline >= NES_PPU_VERTICAL_RESET && scanline <= NES_PPU_VERTICAL_RESET + NES_HEIGHT &&
+               nes_mapper_has_scanline(nes))
+            {
+                int64_t mapper_ppu_cycle = nes->ppu.scanline_start_ppu_cycle + NES_MAPPER_SCANLINE_DOT;
+
+                nes_sched_add(&nes->sched, nes->frame_start_cpu_cycle + (mapper_ppu_cycle + 2) / 3,
+                              nes_mapper_event, nes);
+            }
+
             if(max_scanline_cpu_cycles > 0)
             {
                 int hard_limit = 0;
@@ -1184,7 +1108,7 @@ nes_run_frame(NES_t *nes)
                     hard_limit = 1;
                 }
 
-                n6502_run(&nes->cpu, max_scanline_cpu_cycles, hard_limit);
+                nes_run_cpu(nes, max_scanline_cpu_cycles, hard_limit);
             }
 
             nes->frame_cpu_cycle = nes->cpu.cycle - nes->frame_start_cpu_cycle;
@@ -1192,26 +1116,13 @@ nes_run_frame(NES_t *nes)
             if(scanline >= NES_PPU_VERTICAL_RESET)
             {
                 nes_ppu_render_scanline(&nes->ppu);
-
-                if((scanline % 60) == 0) // Quarter frame @ 60Hz == 240Hz
-                {
-                    int apu_irq = nes_apu_240hz(&nes->apu);
-
-                    if(apu_irq)
-                    {
-                        //NOTIFY("Triggering APU IRQ\n");
-                        n6502_irq(&nes->cpu);
-                    }
-                }
-
-                mapper_irq = nes_mapper_scanline(nes);
-
-                if(mapper_irq)
-                {
-                    n6502_irq(&nes->cpu);
-                }
-
             }
+
+            // The DMC reads its samples as the buffer is filled here, at the
+            // output rate rather than on a CPU cycle timer, so it has no event
+            // of its own.  Its IRQ goes out with the next quarter frame tick
+            // (nes_apu_240hz()) until it is timed in CPU cycles.
+            //
             // HACK: 245 is an even divisor of 735 == (44100/60)
             // FIXME: for better accuracy (ie to pass PCM.demo), use every scanline
             //        and render either 2 or 3 samples on that scanline
@@ -1257,7 +1168,8 @@ nes_toggle_pause(NES_t *nes)
 void
 nes_notify_status(NES_t *nes, const char *msg)
 {
-    status_overlay_update(&nes->gui.status_overlay, msg);
+    if(nes->gui)
+        nes_gui_status(nes, msg);
 }
 
 static const char NES_SAVE_STATE_HEADER[4] = {'S', 'R', 'A', 'M'};
@@ -1270,6 +1182,7 @@ typedef struct
     char header[sizeof(NES_SAVE_STATE_HEADER)];
     uint32_t size;
     uint8_t nes_state[SIZEOF_TYPE(NES_t, state)];
+    uint8_t sram_state[SIZEOF_TYPE(NES_t, sram)];
     uint8_t cpu_state[SIZEOF_TYPE(N6502_t, regs)];
     uint8_t ppu_state[SIZEOF_TYPE(NESPPU_t, state)];
     uint8_t apu_state[SIZEOF_TYPE(NESAPU_t, state)];
@@ -1289,11 +1202,12 @@ nes_save_state(NES_t *nes, const char *path)
         return;
     }
 
-    state.size = 1234; printf("FIXME\n");
+    state.size = sizeof(state);
 
     COPY_STATE(state.header, NES_SAVE_STATE_HEADER);
     COPY_STATE(state.cpu_state, nes->cpu.regs);
     COPY_STATE(state.nes_state, nes->state);
+    COPY_STATE(state.sram_state, nes->sram);
     COPY_STATE(state.ppu_state, nes->ppu.state);
     COPY_STATE(state.apu_state, nes->apu.state);
 
@@ -1321,15 +1235,53 @@ nes_restore_state(NES_t *nes, const char *path)
     ASSERT(read_size == 1, "Failed reading save state from %s\n", path);
 
     ASSERT(memcmp(state.header, NES_SAVE_STATE_HEADER, sizeof(NES_SAVE_STATE_HEADER)) == 0, "Bad save state header in %s\n", path);
+    ASSERT(state.size == sizeof(state), "Save state %s is from another version\n", path);
 
     COPY_STATE(nes->cpu.regs, state.cpu_state);
     COPY_STATE(nes->state, state.nes_state);
+    COPY_STATE(nes->sram, state.sram_state);
     COPY_STATE(nes->ppu.state, state.ppu_state);
     COPY_STATE(nes->apu.state, state.apu_state);
 
     nes_mapper_restore(nes);
     nes_ppu_restore(&nes->ppu);
 
+    // Work RAM/SRAM were overwritten behind the CPU's back
+    n6502_block_cache_flush(&nes->cpu);
+
     fclose(fp);
     NOTIFY_NES(nes, "Restored state from %s\n", path);
 }
+
+// --------------------------------------------------------------------------------
+
+void
+nes_report_footprint(NES_t *nes)
+{
+    const size_t hot = offsetof(NES_t, ppu) + offsetof(NESPPU_t, state.bank2);
+    const size_t vram = offsetof(NESPPU_t, background) - offsetof(NESPPU_t, state.bank2);
+    const size_t background = sizeof(nes->ppu.background);
+    const size_t frame = sizeof(nes->ppu.frame);
+    const size_t prg = nes->num_prg_rom_banks * PRG_ROM_BANK_SIZE;
+    const size_t chr = nes->ppu.num_vrom_banks * VROM_BANK_SIZE;
+    const size_t gui = nes_gui_size(nes);
+
+    // A ROM image is shared by every instance that loaded it
+    NOTIFY("Footprint: %zu bytes per NES instance\n", sizeof(NES_t) + gui + (nes->rom ? 0 : prg + chr));
+    NOTIFY("  Hot core:          %7zu (CPU, work RAM, page table, PPU registers and OAM)\n", hot);
+    NOTIFY("  PPU VRAM/patterns: %7zu\n", vram);
+    NOTIFY("  PPU BG surface:    %7zu\n", background);
+    NOTIFY("  PPU frame buffers: %7zu\n", frame);
+    NOTIFY("  APU:               %7zu\n", sizeof(NESAPU_t));
+    NOTIFY("  Rest of NES_t:     %7zu\n", sizeof(NES_t) - hot - vram - background - frame - sizeof(NESAPU_t));
+    NOTIFY("  GUI:               %7zu%s\n", gui, nes->gui ? "" : " (headless)");
+    if(nes->rom)
+    {
+        NOTIFY("  PRG/CHR ROM:       %7zu (shared, %s, %u refs)\n", prg + chr,
+               nes->rom->mapped ? "mapped" : "read", nes->rom->refs);
+        if(nes->rom->chr_patterns)
+            NOTIFY("  Decoded CHR ROM:   %7zu (shared)\n", chr / PPU_PATTERN_SIZE * CACHED_PATTERN_SIZE);
+    }
+    else
+        NOTIFY("  PRG/CHR ROM:       %7zu\n", prg + chr);
+}
@@ -5,11 +5,13 @@
 #include "ines.h"
 #include "nes_ppu.h"
 #include "nes_apu.h"
-#include "nes_rom_chooser.h"
-#include "status_overlay.h"
+#include "nes_scheduler.h"
 
 #define PRG_ROM_BANK_SIZE (16*1024)
 
+#define NES_PRG_ROM_BASE  0x8000
+#define NES_PRG_SLOT_SIZE 0x1000 // prg_rom[] granularity
+
 #define NES_DMA_CYCLES 512
 
 // http://wiki.nesdev.com/w/index.php/PPU_ntsc_pal_difference
@@ -46,21 +48,73 @@ CPU Memory Map (16bit buswidth, 0-FFFFh)
 
 */
 
-typedef struct
-{
-    Window_t cpu_window;
-    Window_t apu_window;
-    Window_t mem_window;
-    StatusOverlay_t status_overlay;
-    Display_t display;
-    NESRomChooser_t chooser;
-} NESGUI_t;
+// Frontend state: the display, debug windows, ROM chooser and status overlay.
+// Allocated by nes_init() unless options.headless is set, so that the
+// emulation core stays small and free of UI data (see nes_gui.h).
+typedef struct NESGUI NESGUI_t;
+
+// A joypad recording being replayed (see input.h)
+typedef struct InputScript InputScript_t;
 
 typedef struct _NES_t
 {
+    // Hot: the CPU, its bus and the PPU registers, together at the front.
+    // Cold cartridge, frontend and option state follows the PPU and APU.
     N6502_t cpu;
 
+    struct
+    {
+        uint8_t ram[NES_WORK_RAM_SIZE];
+        uint8_t mapper_state[128];
+    } state;
+
+    // CPU fast path: RAM, SRAM and the PRG-ROM slots currently in prg_rom[]
+    N6502PageTable_t pages;
+
+    uint8_t *prg_rom[8];
+
+    void    (*cartridge_write)(void *p, uint16_t addr, uint8_t data);
+    void    (*prg_rom_write)(struct _NES_t *nes, uint16_t addr, uint8_t data);
+    uint8_t (*prg_rom_read) (struct _NES_t *nes, uint16_t addr);
+
+    void *cartridge_pointer;
+
+    uint8_t joypad_latch1;
+    uint8_t joypad_data1;
+
+    uint8_t joypad_latch2;
+    uint8_t joypad_data2;
+
+    uint8_t paddle_buttondown;
+
+    int64_t frame_cpu_cycle;
+    int64_t frame_start_cpu_cycle;
+    int64_t frame_surplus_cpu_cycles;
+    int64_t vblank_cpu_cycle; // Where the VBlank event found the CPU, before any NMI
+
+    uint64_t scanline_start_cycle;
+
+    char state_msg[32]; // Position prefix for the APU's log lines
+
+    // Timed events (VBlank, APU frame counter, sprite-0 hit) against cpu.cycle
+    NESScheduler_t sched;
+
+    NESPPU_t ppu;
+    NESAPU_t apu;
+
+    uint8_t sram[NES_SRAM_SIZE];
+
+    struct NESRomImage *rom; // PRG and CHR ROM point into it (NULL for NSF)
+    unsigned num_prg_rom_banks;
+    uint8_t *prg_rom_banks;
+    unsigned mapper_num;
+
+    int trainer;
+    int has_sram;
+    int battery_backed_sram;
+
     const char *rom_path;
+    const char *next_rom;
 
     struct
     {
@@ -88,48 +142,9 @@ typedef struct _NES_t
         int mousey;
 
         int mousedown;
-    } input;
-
-    struct
-    {
-        uint8_t ram[NES_WORK_RAM_SIZE];
-        uint8_t sram[NES_SRAM_SIZE];
-
-        uint8_t mapper_state[128];
-    } state;
-
-    uint8_t *prg_rom[8];
 
-    NESPPU_t ppu;
-    NESAPU_t apu;
-
-    unsigned num_prg_rom_banks;
-    uint8_t *prg_rom_banks;
-    unsigned mapper_num;
-
-    int trainer;
-    int sram;
-    int battery_backed_sram;
-
-    uint64_t scanline_start_cycle;
-
-    void    (*cartridge_write)(void *p, uint16_t addr, uint8_t data);
-    void    (*prg_rom_write)(struct _NES_t *nes, uint16_t addr, uint8_t data);
-    uint8_t (*prg_rom_read) (struct _NES_t *nes, uint16_t addr);
-
-    void *cartridge_pointer;
-
-    uint8_t joypad_latch1;
-    uint8_t joypad_data1;
-
-    uint8_t joypad_latch2;
-    uint8_t joypad_data2;
-
-    uint8_t paddle_buttondown;
-
-    int64_t frame_cpu_cycle;
-    int64_t frame_start_cpu_cycle;
-    int64_t frame_surplus_cpu_cycles;
+        InputScript_t *script; // --input, or NULL
+    } input;
 
     struct
     {
@@ -142,6 +157,9 @@ typedef struct _NES_t
 
         char *override;
 
+        int headless; // No NESGUI_t: nothing is displayed
+        const char *title;
+
         int save_state;
         int restore_state;
 
@@ -150,9 +168,7 @@ typedef struct _NES_t
         int escape;
     } options;
 
-    const char *next_rom;
-
-    NESGUI_t gui;
+    NESGUI_t *gui; // NULL when headless
 } NES_t;
 
 void nes_init(NES_t *nes, int install_memory_map);
@@ -165,6 +181,12 @@ void nes_soft_reset(NES_t *nes);
 void nes_inspect_rom(iNES_t *ines, const char *rom_path);
 void nes_load_rom(NES_t *nes, const char *rom_path);
 
+// Takes over the reference to rom (see nes_rom.h).  rom_path names the
+// battery-backed SRAM file; with NULL, SRAM lives in nes->sram only.
+void nes_load_rom_image(NES_t *nes, struct NESRomImage *rom, const char *rom_path);
+// Why nes_load_rom_image() would refuse rom, or NULL if it can run it
+const char *nes_rom_unsupported(const struct NESRomImage *rom);
+
 void nes_run_frame(NES_t *nes);
 void nes_render_frame(NES_t *nes);
 
@@ -173,6 +195,10 @@ unsigned nes_toggle_pause(NES_t *nes);
 
 void nes_notify_status(NES_t *nes, const char *msg);
 
+// Per-instance memory: the NES_t itself, split hot and cold, plus what it
+// allocated
+void nes_report_footprint(NES_t *nes);
+
 void nes_save_state(NES_t *nes, const char *path);
 void nes_restore_state(NES_t *nes, const char *path);
 
@@ -141,7 +141,10 @@ nes_apu_init(NESAPU_t *apu)
 {
     memset(&apu->state, 0, sizeof(apu->state));
 
-    AUDIO_DESCRIPTOR.audio_open(&apu->audio_buffer);
+    if(! apu->audio)
+        apu->audio = &AUDIO_DESCRIPTOR;
+
+    apu->audio->audio_open(&apu->audio_buffer);
     if(apu->options.dump_wav)
     {
         wav_init();
@@ -151,7 +154,7 @@ nes_apu_init(NESAPU_t *apu)
 void
 nes_apu_pause(NESAPU_t *apu, int paused)
 {
-    AUDIO_DESCRIPTOR.audio_pause(paused);
+    apu->audio->audio_pause(paused);
 }
 
 void
@@ -179,8 +182,8 @@ nes_apu_reset(NESAPU_t *apu)
 void
 nes_apu_destroy(NESAPU_t *apu)
 {
-    AUDIO_DESCRIPTOR.audio_pause(1);
-    AUDIO_DESCRIPTOR.audio_close();
+    apu->audio->audio_pause(1);
+    apu->audio->audio_close();
 
     if(apu->options.dump_wav)
     {
@@ -220,7 +223,7 @@ dmc_next_sample(NESAPU_t *apu)
         }
     }
 
-    chan->attr.dmc.sample = apu->read_mem_func(chan->attr.dmc.sample_address);
+    chan->attr.dmc.sample = apu->read_mem_func(apu->arg_ptr, chan->attr.dmc.sample_address);
     apu->increment_cycles_func(apu->arg_ptr, APU_DMA_CYCLES);
 
     TRACE("DMC update: %02X @ %04X [%d bytes left]\n",
@@ -787,6 +790,12 @@ nes_apu_fill_buffer(NESAPU_t *apu, unsigned fill_size)
         }
 
         ab->wr_index = (ab->wr_index + 1) % AUDIO_BUFFER_SIZE;
+
+        // Full: drop the oldest sample rather than let the ring look empty
+        if(ab->wr_index == ab->rd_index)
+        {
+            ab->rd_index = (ab->rd_index + 1) % AUDIO_BUFFER_SIZE;
+        }
     }
 
     if(last)
@@ -240,13 +240,14 @@ typedef struct
 
 typedef struct
 {
-    uint8_t (*read_mem_func)(uint16_t addr);
+    uint8_t (*read_mem_func)(void *ptr, uint16_t addr);
     void    (*increment_cycles_func)(void *ptr, int cycles);
     const char *(*get_state_func)(void *ptr);
 
     void *arg_ptr;
 
     AudioBuffer_t audio_buffer;
+    const struct AudioDescriptor *audio; // The platform's, unless set before nes_apu_init()
 
     int fill_count;
 
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "nes_gui.h"
+#include "log.h"
+
+#define INFO_NES(...) _INFO(NES, __VA_ARGS__)
+
+static void
+nes_cpu_window_draw(Display_t *display, Window_t *window, DisplayPixel_t *origin, int stride, Rect_t *clip)
+{
+    char msg[128];
+    char *m = msg;
+    NES_t *nes = (NES_t *) window->p;
+    int font_y_offset = 1;
+
+    m += sprintf(m, "PC: %04X\n", nes->cpu.regs.PC);
+    m += sprintf(m, "A:%02X X:%02X Y:%02X P:%02X SP:%02X\n",
+                 nes->cpu.regs.A, nes->cpu.regs.X, nes->cpu.regs.Y,
+                 n6502_get_p(&nes->cpu.regs), nes->cpu.regs.S);
+
+    font_printstr(nes->gui->display.font, (origin + 1 + font_y_offset * stride), stride, msg, clip);
+}
+
+static void
+nes_cpu_window_init(NES_t *nes)
+{
+    Window_t *window = &nes->gui->cpu_window;
+    window->title = "CPU";
+    window->width = 260;
+    window->height = 40;
+    window->p = nes;
+    window->y = 265;
+    window->draw = nes_cpu_window_draw;
+    window_init(window);
+
+    display_add_window(&nes->gui->display, window);
+}
+
+// --------------------------------------------------------------------------------
+
+static void
+nes_apu_window_draw(Display_t *display, Window_t *window, DisplayPixel_t *origin, int stride, Rect_t *clip)
+{
+    NES_t *nes = (NES_t *) window->p;
+    NESAPU_t *apu = &nes->apu;
+    char msg[256];
+    char *m = msg;
+
+    int font_y_offset = 1;
+
+    m += sprintf(m, "Mode:   %d Hz, %s\n",
+                 (apu->state.frame_sequencer_mode == MODE_240HZ) ? 240 : 192,
+                 apu->state.frame_irq ? "IRQ" : "[-]");
+
+    m += sprintf(m, "Volume: %X %X %X %X %X\n",
+                 apu->state.square[0].volume,
+                 apu->state.square[1].volume,
+                 apu->state.triangle.volume,
+                 apu->state.noise.volume,
+                 apu->state.dmc.volume);
+
+    m += sprintf(m, "Freq:   %4d %4d %4d %4d %4d\n",
+                 apu->state.square[0].cpu_period,
+                 apu->state.square[1].cpu_period,
+                 apu->state.triangle.cpu_period,
+                 apu->state.noise.cpu_period,
+                 apu->state.dmc.cpu_period);
+
+    m += sprintf(m, "Length: %3X %3X %3X %3X %3X\n",
+                 apu->state.square[0].length_count,
+                 apu->state.square[1].length_count,
+                 apu->state.triangle.length_count,
+                 apu->state.noise.length_count,
+                 apu->state.dmc.length_count);
+
+    font_printstr(nes->gui->display.font, (origin + 1 + font_y_offset * stride), stride, msg, clip);
+}
+
+void
+nes_gui_init_apu(NES_t *nes)
+{
+    Window_t *window = &nes->gui->apu_window;
+    window->title = "APU";
+    window->width = 260;
+    window->height = 80;
+    window->p = nes;
+    window->y = 30;
+    window->draw = nes_apu_window_draw;
+    window_init(window);
+
+    display_add_window(&nes->gui->display, window);
+}
+
+// --------------------------------------------------------------------------------
+
+static void
+nes_mem_window_draw(Display_t *display, Window_t *window, DisplayPixel_t *origin, int stride, Rect_t *clip)
+{
+    NES_t *nes = (NES_t *) window->p;
+    uint8_t *ram = nes->state.ram;
+    DisplayPixel_t addr;
+    DisplayPixel_t *row = origin;
+    DisplayPixel_t *output = row;
+
+    //0000h-07FFh   Internal 2K Work RAM (mirrored to 800h-1FFFh)
+    for(addr = 0x0000; addr < 0x0800; addr++)
+    {
+        // FIXME assumes 16bpp
+        DisplayPixel_t pixel;
+        uint8_t value = ram[addr];
+
+        if((addr & 63) == 0)
+        {
+            output = row;
+            row += stride * 2;
+        }
+
+        // Convert from RGB 332 to RGB 565
+        pixel = ((value >> 5) << 13) | (((value >> 2) & 7) << 8) | ((value & 3) << 2);
+
+        output[0] = pixel;
+        output[1] = pixel;
+        output[stride + 0] = pixel;
+        output[stride + 1] = pixel;
+        output += 2;
+    }
+}
+
+static void
+nes_mem_window_init(NES_t *nes)
+{
+    Window_t *window = &nes->gui->mem_window;
+    window->title = "Memory";
+    window->width = 128;
+    window->height = 64;
+    window->p = nes;
+    window->draw = nes_mem_window_draw;
+    window->x = 290;
+    window->y = 500;;
+    window_init(window);
+
+    display_add_window(&nes->gui->display, window);
+}
+
+// --------------------------------------------------------------------------------
+static void
+nes_rom_select(NESRomChooser_t *chooser, const char *path)
+{
+    NES_t *nes = (NES_t *) chooser->p;
+    INFO_NES("Selecting ROM: %s\n", path);
+    nes->next_rom = path;
+}
+
+// --------------------------------------------------------------------------------
+
+static void
+menu_quit(MenuItem_t *item, void *p)
+{
+    NES_t *nes = (NES_t *) p;
+    nes->options.quit = 1;
+}
+
+static void
+menu_load(MenuItem_t *item, void *p)
+{
+    NES_t *nes = (NES_t *) p;
+    display_select_window(&nes->gui->display, &nes->gui->chooser.window);
+}
+
+MenuItem_t MENU_WINDOW = {
+    .text = "Window",
+    .type = mitSubMenu,
+};
+
+MenuItem_t MENU_FILE_QUIT = {
+    .text = "Quit",
+    .type = mitEntry,
+    .key_accelerator = 'q',
+    .on_select = menu_quit,
+};
+
+MenuItem_t MENU_FILE_SAVE = {
+    .text = "Save State",
+    .type = mitEntry,
+    .next = &MENU_FILE_QUIT,
+};
+
+MenuItem_t MENU_FILE_LOAD = {
+    .text = "Load ROM",
+    .type = mitEntry,
+    .on_select = menu_load,
+    .key_accelerator = 'l',
+    .next = &MENU_FILE_SAVE,
+};
+
+MenuItem_t MENU_FILE = {
+    .text = "File",
+    .type = mitSubMenu,
+    .next = &MENU_WINDOW,
+    .child_menu = &MENU_FILE_LOAD,
+};
+
+// --------------------------------------------------------------------------------
+
+void
+nes_gui_init(NES_t *nes)
+{
+    nes->gui = calloc(1, sizeof(NESGUI_t));
+    ASSERT(nes->gui, "Failed to allocate the GUI\n");
+
+    nes->gui->display.title = nes->options.title;
+    nes->gui->display.fullscreen = nes->ppu.options.display_fullscreen;
+    nes->gui->display.width = nes->ppu.options.display_width;
+    nes->gui->display.height = nes->ppu.options.display_height;
+    nes->gui->display.depth_in_bytes = 2; // FIXME 16bpp
+    nes->gui->display.windowed = nes->ppu.options.display_windowed;
+
+    nes->gui->display.show_cursor = ! nes->ppu.options.enable_paddle;
+
+    display_init(&nes->gui->display, &MENU_FILE);
+    nes->gui->display.menubar.p = nes;
+    status_overlay_init(&nes->gui->status_overlay, &nes->gui->display);
+
+    if(nes->ppu.options.display_windowed)
+    {
+        nes_cpu_window_init(nes);
+        nes_mem_window_init(nes);
+    }
+
+    nes->gui->chooser.p = nes;
+    nes->gui->chooser.on_select = nes_rom_select;
+    nes_rom_chooser_init(&nes->gui->chooser, &nes->gui->display);
+    nes->gui->chooser.window.y = 20;
+
+    nes_ppu_gui_init(&nes->ppu, &nes->gui->ppu, &nes->gui->display);
+}
+
+// --------------------------------------------------------------------------------
+
+void
+nes_gui_destroy(NES_t *nes)
+{
+    display_destroy(&nes->gui->display);
+    nes_rom_chooser_destroy(&nes->gui->chooser);
+    free(nes->gui);
+    nes->gui = NULL;
+    nes->ppu.gui = NULL;
+    nes->ppu.display = NULL;
+}
+
+// --------------------------------------------------------------------------------
+
+void
+nes_gui_rom_loaded(NES_t *nes)
+{
+    display_select_window(&nes->gui->display, &nes->gui->ppu.nes_window);
+
+    // Hide the menubar
+    nes->gui->display.menubar.visible = 0;
+    menubar_deselect(&nes->gui->display.menubar);
+}
+
+void
+nes_gui_reset(NES_t *nes)
+{
+    display_reset(&nes->gui->display);
+}
+
+void
+nes_gui_draw(NES_t *nes)
+{
+    display_draw(&nes->gui->display);
+}
+
+void
+nes_gui_escape(NES_t *nes)
+{
+    Window_t *top_window = nes->gui->display.top_window;
+
+    if(top_window && top_window->has_titlebar && top_window->visible)
+    {
+        // Hide the topmost (ie focused) window
+        display_hide_window(&nes->gui->display, top_window);
+    }
+    else
+    {
+        display_set_menubar(&nes->gui->display, ! nes->gui->display.menubar.visible);
+    }
+}
+
+void
+nes_gui_status(NES_t *nes, const char *msg)
+{
+    status_overlay_update(&nes->gui->status_overlay, msg);
+}
@@ -0,0 +1,61 @@
+#ifndef __nes_gui_h__
+#define __nes_gui_h__
+
+#include "nes.h"
+
+// The NES frontend: display, debug windows, menus, ROM chooser and status
+// overlay, hung off nes->gui.  The core only calls in here while nes->gui is
+// set.  Builds without a frontend (-DHEADLESS: libnestalgia and the headless
+// platform) compile all of it out and never have a GUI.
+
+#ifndef HEADLESS
+
+#include "nes_rom_chooser.h"
+#include "status_overlay.h"
+
+struct NESGUI
+{
+    Display_t display;
+    NESPPUGUI_t ppu;
+    Window_t cpu_window;
+    Window_t apu_window;
+    Window_t mem_window;
+    StatusOverlay_t status_overlay;
+    NESRomChooser_t chooser;
+};
+
+// Allocates nes->gui: the display, CPU/memory windows and ROM chooser
+void nes_gui_init(NES_t *nes);
+// Once the APU is up
+void nes_gui_init_apu(NES_t *nes);
+void nes_gui_destroy(NES_t *nes);
+
+void nes_gui_rom_loaded(NES_t *nes);
+void nes_gui_reset(NES_t *nes);
+void nes_gui_draw(NES_t *nes);
+void nes_gui_escape(NES_t *nes);
+void nes_gui_status(NES_t *nes, const char *msg);
+
+static inline size_t
+nes_gui_size(NES_t *nes)
+{
+    return nes->gui ? sizeof(NESGUI_t) : 0;
+}
+
+#else
+
+static inline void nes_gui_init(NES_t *nes) {}
+static inline void nes_gui_init_apu(NES_t *nes) {}
+static inline void nes_gui_destroy(NES_t *nes) {}
+
+static inline void nes_gui_rom_loaded(NES_t *nes) {}
+static inline void nes_gui_reset(NES_t *nes) {}
+static inline void nes_gui_draw(NES_t *nes) {}
+static inline void nes_gui_escape(NES_t *nes) {}
+static inline void nes_gui_status(NES_t *nes, const char *msg) {}
+
+static inline size_t nes_gui_size(NES_t *nes) { return 0; }
+
+#endif
+
+#endif
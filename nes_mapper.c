@@ -1,4 +1,5 @@
 #include "nes_mapper.h"
+#include "n6502_watch.h"
 
 extern NESMapper_t nes_mapper0;
 extern NESMapper_t nes_mapper1;
@@ -25,6 +26,7 @@ void
 nes_select_prg_rom_bank(NES_t *nes, unsigned dest_bank, unsigned src_bank, int size_kb)
 {
     int i;
+    unsigned page;
     INFO_MAPPER("Switching PRG-ROM %d from %d\n", dest_bank, src_bank);
 
     ASSERT(dest_bank * size_kb <= 8, "Bad dest PRG-ROM bank: %d\n", dest_bank);
@@ -38,24 +40,47 @@ nes_select_prg_rom_bank(NES_t *nes, unsigned dest_bank, unsigned src_bank, int s
 
     for(i = 0; i < size_kb; i++)
     {
-        nes->prg_rom[dest_bank * size_kb + i] = nes->prg_rom_banks + (src_bank * size_kb + i) * 0x1000;
+        const unsigned slot = dest_bank * size_kb + i;
+        const unsigned first_page = (NES_PRG_ROM_BASE + slot * NES_PRG_SLOT_SIZE) >> 8;
+
+        nes->prg_rom[slot] = nes->prg_rom_banks + (src_bank * size_kb + i) * NES_PRG_SLOT_SIZE;
+
+        // Keep the CPU page table in sync
+        for(page = 0; page < NES_PRG_SLOT_SIZE / N6502_PAGE_SIZE; page++)
+        {
+            nes->pages.read[first_page + page] = nes->prg_rom[slot] + page * N6502_PAGE_SIZE;
+        }
     }
+
+    n6502_watch_sync(&nes->cpu);
 }
 
 static const NESMapper_t *
-nes_mapper_get(NES_t *nes)
+nes_mapper_find(unsigned mapper_num)
 {
     size_t i;
     for(i = 0; i < sizeof(MAPPERS) / sizeof(MAPPERS[0]); i++)
     {
         const NESMapper_t *mapper = MAPPERS[i];
-        if(nes->mapper_num == mapper->num)
+        if(mapper_num == mapper->num)
             return mapper;
     }
 
     return NULL;
 }
 
+static const NESMapper_t *
+nes_mapper_get(NES_t *nes)
+{
+    return nes_mapper_find(nes->mapper_num);
+}
+
+int
+nes_mapper_supported(unsigned mapper_num)
+{
+    return nes_mapper_find(mapper_num) != NULL;
+}
+
 void
 nes_mapper_init(NES_t *nes)
 {
@@ -84,6 +109,12 @@ nes_mapper_restore(NES_t *nes)
     }
 }
 
+int
+nes_mapper_has_scanline(NES_t *nes)
+{
+    return nes_mapper_get(nes)->scanline_func != NULL;
+}
+
 int
 nes_mapper_scanline(NES_t *nes)
 {
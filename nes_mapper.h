@@ -7,10 +7,16 @@
 #define LOG_MAPPER(...)  _LOG(MAPPER, __VA_ARGS__)
 
 void nes_mapper_init(NES_t *nes);
+int nes_mapper_supported(unsigned mapper_num);
 void nes_select_prg_rom_bank(NES_t *nes, unsigned dest_bank, unsigned src_bank, int size_kb);
 void nes_mapper_restore(NES_t *nes);
+int nes_mapper_has_scanline(NES_t *nes);
 int nes_mapper_scanline(NES_t *nes);
 
+// The dot of the pre-render and visible lines where the scanline counter is
+// clocked: the MMC3 sees A12 rise as the PPU starts fetching sprite patterns
+#define NES_MAPPER_SCANLINE_DOT 260
+
 typedef struct
 {
     unsigned int num;
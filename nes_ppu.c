@@ -1,8 +1,11 @@
 #include "nes_ppu.h"
+#include "nes_ppu_tile.h"
+#include "n6502_watch.h"
 #include "log.h"
 #include "display.h"
 #include "window.h"
 #include <inttypes.h>
+#include <stddef.h>
 #include <string.h>
 
 #define LOG(...)  _LOG(PPU, __VA_ARGS__)
@@ -62,8 +65,10 @@ const char *PPU_MIRRORING_STR[4] =
     "Horz",
 };
 
+#ifndef HEADLESS
 static void nes_ppu_sprites_window_init(NESPPU_t *ppu);
 static void nes_ppu_background_window_init(NESPPU_t *ppu);
+#endif
 
 // --------------------------------------------------------------------------------
 
@@ -74,6 +79,7 @@ ppu_latch(NESPPU_t *ppu)
     ppu->bg_pattern_table = ppu->state.vram.S;
 }
 
+#ifndef HEADLESS
 static void
 nes_ppu_info_window_draw(Display_t *display, Window_t *window, DisplayPixel_t *origin, int stride, Rect_t *clip)
 {
@@ -97,7 +103,7 @@ nes_ppu_info_window_draw(Display_t *display, Window_t *window, DisplayPixel_t *o
 static void
 nes_ppu_info_window_init(NESPPU_t *ppu)
 {
-    Window_t *window = &ppu->gui.ppu_info_window;
+    Window_t *window = &ppu->gui->ppu_info_window;
     window->title = "PPU";
     window->width = 260;
     window->height = 50;
@@ -135,7 +141,7 @@ nes_ppu_palette_window_draw(Display_t *display, Window_t *window, DisplayPixel_t
         {
             char num[4];
             sprintf(num, "%02d", palette[i]);
-            const DisplayPixel_t color = ppu->gui.screen_palette[palette[i]];
+            const DisplayPixel_t color = ppu->gui->screen_palette[palette[i]];
             int x_offset = i * (SWATCH_SIZE + SWATCH_GAP);
             display_fillrect(origin + x_offset + y_offset, SWATCH_SIZE, SWATCH_SIZE, color, stride, clip);
             font_printstr(ppu->display->font, (origin + x_offset + y_offset + 1), stride, num, clip);
@@ -146,7 +152,7 @@ nes_ppu_palette_window_draw(Display_t *display, Window_t *window, DisplayPixel_t
 static void
 nes_ppu_palette_window_init(NESPPU_t *ppu)
 {
-    Window_t *window = &ppu->gui.palette_window;
+    Window_t *window = &ppu->gui->palette_window;
     window->title = "Palette";
     window->width = 270;
     window->height = 40;
@@ -158,6 +164,7 @@ nes_ppu_palette_window_init(NESPPU_t *ppu)
 
     display_add_window(ppu->display, window);
 }
+#endif
 
 // --------------------------------------------------------------------------------
 
@@ -181,6 +188,7 @@ static const uint8_t NES_PPU_PALETTE[NES_PPU_PALETTE_SIZE][3] =
     { 0x99, 0xFF, 0xFC }, { 0xDD, 0xDD, 0xDD }, { 0x11, 0x11, 0x11 }, { 0x11, 0x11, 0x11 },
 };
 
+#ifndef HEADLESS
 static void
 nes_ppu_window_draw(Display_t *display, Window_t *window, DisplayPixel_t *origin, int stride, Rect_t *clip)
 {
@@ -207,10 +215,10 @@ nes_ppu_window_draw(Display_t *display, Window_t *window, DisplayPixel_t *origin
     {
         DisplayPixel_t *pixels = row;
 
-        uint8_t *src = &ppu->gui.nes_screen[y * NES_WIDTH + clip_left];
+        uint8_t *src = &ppu->frame.nes_screen[y * NES_WIDTH + clip_left];
         for(x = clip_left; x < clip_right; x++)
         {
-            *pixels = ppu->gui.screen_palette[palette_offset[*src++]];
+            *pixels = ppu->gui->screen_palette[palette_offset[*src++]];
 #ifdef PIXEL_DOUBLING
             pixels[1] = *pixels;
             pixels += 2;
@@ -247,14 +255,14 @@ nes_ppu_init_palette(Window_t *window)
     {
         const uint8_t *palette_entry = NES_PPU_PALETTE[i];
 
-        ppu->gui.screen_palette[i] = display_maprgb(ppu->display, palette_entry[0], palette_entry[1], palette_entry[2]);
+        ppu->gui->screen_palette[i] = display_maprgb(ppu->display, palette_entry[0], palette_entry[1], palette_entry[2]);
     }
 }
 
-void
+static void
 nes_ppu_window_init(NESPPU_t *ppu)
 {
-    Window_t *window = &ppu->gui.nes_window;
+    Window_t *window = &ppu->gui->nes_window;
     window->title = "NES";
     window->width = NES_CROPPED_WIDTH(ppu) * XD;
     window->height = NES_CROPPED_HEIGHT(ppu) * YD;
@@ -273,10 +281,10 @@ nes_ppu_window_init(NESPPU_t *ppu)
 }
 
 void
-nes_ppu_init(NESPPU_t *ppu, Display_t *display, N6502_t *cpu)
+nes_ppu_gui_init(NESPPU_t *ppu, NESPPUGUI_t *gui, Display_t *display)
 {
+    ppu->gui = gui;
     ppu->display = display;
-    ppu->cpu = cpu;
 
     nes_ppu_window_init(ppu);
 
@@ -288,15 +296,110 @@ nes_ppu_init(NESPPU_t *ppu, Display_t *display, N6502_t *cpu)
         nes_ppu_background_window_init(ppu);
 
         // Move NES window to right side of screen
-        ppu->gui.nes_window.x = ppu->display->width - ppu->gui.nes_window.width - 2;
+        ppu->gui->nes_window.x = ppu->display->width - ppu->gui->nes_window.width - 2;
+    }
+}
+#endif
+
+// --------------------------------------------------------------------------------
+
+static void
+nes_ppu_invalidate_patterns(NESPPU_t *ppu)
+{
+    memset(ppu->pattern_dirty, 1, sizeof(ppu->pattern_dirty));
+    ppu->dirty = 1;
+}
+
+// The pattern at addr, a CHR RAM address
+static inline void
+nes_ppu_invalidate_pattern(NESPPU_t *ppu, uint16_t addr)
+{
+    const unsigned builtin = (ppu->bank[addr >> 10] - ppu->state.builtin_bank[0]) / sizeof(ppu->state.builtin_bank[0]);
+
+    // Any slot showing the same 1K sees the change, as they share ram_patterns
+    ppu->pattern_dirty[builtin][(addr >> 4) % NUM_PATTERNS_PER_BANK] = 1;
+    ppu->dirty = 1;
+}
+
+// Redraws the whole background surface before it is next used
+static void
+nes_ppu_invalidate_background(NESPPU_t *ppu)
+{
+    memset(ppu->background.patterns, 0, sizeof(ppu->background.patterns));
+}
+
+// The tiles the name or attribute byte at addr, a resolved nametable
+// address, covers
+static inline void
+nes_ppu_invalidate_nametable(NESPPU_t *ppu, uint16_t addr)
+{
+    const unsigned table = (addr >> 10) & 1;
+    const unsigned offset = addr & 0x3ff;
+
+    if(offset < NUM_TILES_PER_NAME_TABLE)
+    {
+        ppu->background.tile_dirty[table][offset] = 1;
+    }
+    else
+    {
+        // 4x4 tiles an attribute byte, the last row of them half off the bottom
+        const unsigned attribute = offset - NUM_TILES_PER_NAME_TABLE;
+        unsigned x, y;
+
+        for(y = (attribute / 8) * 4; y < (attribute / 8) * 4 + 4 && y < NES_HEIGHT / PATTERN_HEIGHT; y++)
+        {
+            for(x = (attribute % 8) * 4; x < (attribute % 8) * 4 + 4; x++)
+            {
+                ppu->background.tile_dirty[table][y * (NES_WIDTH / PATTERN_WIDTH) + x] = 1;
+            }
+        }
+    }
+
+    ppu->background.tiles_dirty = 1;
+}
+
+// Maps builtin CHR RAM bank i into 1K slot i
+static void
+nes_ppu_map_builtin_banks(NESPPU_t *ppu)
+{
+    unsigned i;
+
+    for(i = 0; i < 8; i++)
+    {
+        ppu->bank[i] = ppu->state.builtin_bank[i];
+        ppu->patterns[i] = ppu->ram_patterns[i][0];
+    }
+}
+
+void
+nes_ppu_init(NESPPU_t *ppu, N6502_t *cpu, NESScheduler_t *sched)
+{
+    ppu->cpu = cpu;
+    ppu->sched = sched;
+
+    ppu->tile = nes_ppu_tile_kernels(ppu->options.tile_kernels);
+    ASSERT(ppu->tile, "Tile kernels '%s' are not supported here\n", ppu->options.tile_kernels);
+    INFO("PPU tile kernels: %s\n", ppu->tile->name);
+}
+
+void
+nes_ppu_frame_rgb(const NESPPU_t *ppu, uint32_t *pixels)
+{
+    const uint8_t *palette = ppu->state.bank2.map.image_palette;
+    unsigned i;
+
+    for(i = 0; i < NES_WIDTH * NES_HEIGHT; i++)
+    {
+        const uint8_t *rgb = NES_PPU_PALETTE[palette[ppu->frame.nes_screen[i]] & (NES_PPU_PALETTE_SIZE - 1)];
+
+        pixels[i] = (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
     }
 }
 
 void
 nes_ppu_reset(NESPPU_t *ppu)
 {
-    memset(&ppu->gui.nes_screen, 0, sizeof(ppu->gui.nes_screen));
-    memset(&ppu->gui.nes_background, 0, sizeof(ppu->gui.nes_background));
+    memset(&ppu->frame.nes_screen, 0, sizeof(ppu->frame.nes_screen));
 
     ppu->state.vram.first_write = 1;
 
@@ -313,11 +416,7 @@ nes_ppu_reset(NESPPU_t *ppu)
     ppu->background_blue  = 0;
 #endif
 
-    {
-        int i;
-        for(i = 0; i < 8; i++)
-            ppu->bank[i] = ppu->state.builtin_bank[i];
-    }
+    nes_ppu_map_builtin_banks(ppu);
 
     ppu->state.bank_mapping[0] = -1;
     ppu->state.bank_mapping[1] = -1;
@@ -326,6 +425,7 @@ nes_ppu_reset(NESPPU_t *ppu)
     ppu->in_vblank = 0;
     ppu->num_vrom_banks = 0;
     ppu->vrom_banks = NULL;
+    ppu->vrom_patterns = NULL;
 
     ppu->scanline_start_ppu_cycle = 0;
     ppu->frame_count = 0;
@@ -339,7 +439,9 @@ nes_ppu_reset(NESPPU_t *ppu)
     ppu->sprites_visible = 0;
     ppu->background_visible = 0;
 
-    ppu->dirty = 1;
+    nes_ppu_invalidate_patterns(ppu);
+    nes_ppu_invalidate_background(ppu);
+    ppu->scanline_sprites.dirty = 1;
 }
 
 static inline uint16_t
@@ -469,6 +571,7 @@ nes_ppu_read_vram(NESPPU_t *ppu)
     }
 
     LOG("PPU VRAM[%04Xh] => %02Xh\n", vram_address, data);
+    n6502_watch_ppu(ppu->cpu, N6502_WATCH_READ, ppu->state.vram.V, vram_address, data);
     nes_ppu_increment_vram_address(ppu);
 
     return data;
@@ -478,10 +581,15 @@ static inline void
 nes_ppu_write_vram(NESPPU_t *ppu, uint8_t data)
 {
     uint16_t vram_address = nes_ppu_get_vram_address(ppu, 0x3fff);
-    // FIXME: for double VROM games like baseball, this assert fires
+    uint8_t *p;
+
+    // CHR ROM is mapped read-only from the ROM file; the write goes nowhere,
+    // as on the cart (some games, eg. baseball, do it anyway)
     if(ppu->has_vrom && vram_address < VROM_BANK_SIZE)
     {
-        //ASSERT(0, "WARNING: writing over VROM[%04Xh]\n", vram_address);
+        INFO("PPU write to CHR ROM[%04Xh] <= %02Xh ignored\n", vram_address, data);
+        nes_ppu_increment_vram_address(ppu);
+        return;
     }
 
     // Palette can only hold 6 bits
@@ -493,11 +601,12 @@ nes_ppu_write_vram(NESPPU_t *ppu, uint8_t data)
     }
     else
     {
-        if(vram_address < 0x2000)
+        if(*PPU_BANK_PTR(ppu, vram_address) != data)
         {
-            // Flag the affected pattern as dirty
-            // FIXME: this calculation may be bogus
-            ppu->pattern_dirty[vram_address >> 13][vram_address >> 4] = 1;
+            if(vram_address < 0x2000)
+                nes_ppu_invalidate_pattern(ppu, vram_address);
+            else
+                nes_ppu_invalidate_nametable(ppu, vram_address);
         }
 
         if(! ppu->in_vblank && (ppu->sprites_visible || ppu->background_visible))
@@ -506,7 +615,9 @@ nes_ppu_write_vram(NESPPU_t *ppu, uint8_t data)
         }
     }
 
-    uint8_t *p = PPU_BANK_PTR(ppu, vram_address);
+    n6502_watch_ppu(ppu->cpu, N6502_WATCH_WRITE, ppu->state.vram.V, vram_address, data);
+
+    p = PPU_BANK_PTR(ppu, vram_address);
     *p = data;
     LOG("PPU VRAM[%04Xh] <= %02Xh\n", ppu->state.vram.T, data);
     nes_ppu_increment_vram_address(ppu);
@@ -528,7 +639,11 @@ nes_ppu_write_control1(NESPPU_t *ppu, uint8_t data)
         reg->word = data;
 
         // FIXME: decoding these bits is probably a waste of time
-        ppu->sprite_height_16  = reg->bits.sprite_size_8x16;
+        if(ppu->sprite_height_16 != reg->bits.sprite_size_8x16)
+        {
+            ppu->sprite_height_16 = reg->bits.sprite_size_8x16;
+            ppu->scanline_sprites.dirty = 1;
+        }
         ppu->state.vram.S            = reg->bits.bg_pattern_table;
         ppu->spr_pattern_table = reg->bits.sprite_pattern_table;
         ppu->state.vram.increment    = reg->bits.increment_by_32 ? 32 : 1;
@@ -607,6 +722,7 @@ nes_ppu_reg_write(NESPPU_t *ppu, uint16_t addr, uint8_t data)
 
         case 0x4: // $2004
             ppu->state.spr_ram.ram[ppu->state.spr_ram_address & 0xff] = data;
+            ppu->scanline_sprites.dirty = 1;
             LOG("PPU SPR-RAM[%02Xh] <= %02Xh\n",
                       ppu->state.spr_ram_address, data);
             if(! ppu->in_vblank && (ppu->sprites_visible || ppu->background_visible))
@@ -672,13 +788,15 @@ nes_ppu_select_vrom_bank(NESPPU_t *ppu, unsigned vrom_dest, unsigned vrom_src, u
     ASSERT(vrom_src < ppu->num_vrom_banks * (8 / size_kb), "Bad VROM bank: %d\n", vrom_src);
     ppu->state.bank_mapping[vrom_dest] = vrom_src;
 
+    // Already decoded: MMC3 games can switch several times a frame for free
     for(i = 0; i < size_kb; i++)
     {
-        ppu->bank[vrom_dest * size_kb + i] = ppu->vrom_banks + ((vrom_src * size_kb) + i) * 1024;
-    }
+        unsigned slot = vrom_dest * size_kb + i;
+        size_t offset = ((vrom_src * size_kb) + i) * 1024;
 
-    // FIXME: only mark dirty if the vrom changed
-    ppu->dirty = 1;
+        ppu->bank[slot] = ppu->vrom_banks + offset;
+        ppu->patterns[slot] = ppu->vrom_patterns + offset / PPU_PATTERN_SIZE * CACHED_PATTERN_SIZE;
+    }
 
     INFO("Copied VROM %dKB bank %2d to PPU bank %d @ %4d / %d\n",
          size_kb, vrom_src, vrom_dest, ppu->frame_count, ppu->scanline);
@@ -698,10 +816,14 @@ nes_ppu_restore(NESPPU_t *ppu)
         else
         {
             ppu->bank[i] = ppu->state.builtin_bank[i];
+            ppu->patterns[i] = ppu->ram_patterns[i][0];
         }
     }
 
-    ppu->dirty = 1;
+    // The CHR RAM and OAM came back with the state
+    nes_ppu_invalidate_patterns(ppu);
+    nes_ppu_invalidate_background(ppu);
+    ppu->scanline_sprites.dirty = 1;
 }
 
 static void
@@ -766,7 +888,7 @@ nes_ppu_check_sprite0_collision(NESPPU_t *ppu)
             if(sprite_line)
             {
                 const uint8_t flip_h = sprite0->attributes & SPRITE_FLIP_H;
-                const uint8_t *background = &ppu->gui.nes_screen[NES_WIDTH * row + sprite0->x_coord];
+                const uint8_t *background = &ppu->frame.nes_screen[NES_WIDTH * row + sprite0->x_coord];
                 int x;
 
                 if(ppu->options.force_sprite0)
@@ -801,16 +923,18 @@ nes_ppu_check_sprite0_collision(NESPPU_t *ppu)
                         else
                         {
                             // Set up a future trigger for cycle-accurate sprite0 timing
-                            ppu->cpu->trigger = sprite0_trigger;
-                            ppu->cpu->trigger_cycle = ppu->cpu->cycle + (ppu->sprite0.x / 3) - 3;
-                            ppu->cpu->trigger_ptr = ppu;
+                            int64_t trigger_cycle = ppu->cpu->cycle + (ppu->sprite0.x / 3) - 3;
 
                             if(ppu->options.trigger_hack)
                             {
                                 // FIXME: double dragon timing is off, so the status bar twitches
                                 // THIS IS POSSIBLY RELATED TO SCREEN EXTRA CYCLES
-                                ppu->cpu->trigger_cycle -= 4;
+                                trigger_cycle -= 4;
                             }
+
+                            // Only one hit can be pending
+                            nes_sched_cancel(ppu->sched, sprite0_trigger, ppu);
+                            nes_sched_add(ppu->sched, trigger_cycle, sprite0_trigger, ppu);
                         }
 
 #if 0
@@ -841,62 +965,58 @@ nes_ppu_check_sprite0_collision(NESPPU_t *ppu)
     }
 }
 
+void
+nes_ppu_decode_patterns(uint8_t *dst, const uint8_t *chr, size_t num_patterns)
+{
+    nes_ppu_tile_kernels(NULL)->decode(dst, chr, num_patterns);
+}
+
+// Decodes the CHR RAM patterns marked since the last time
 static void
 nes_ppu_update_pattern_cache(NESPPU_t *ppu)
 {
-    unsigned table;
-    for(table = 0; table <= 1; table++)
+    unsigned bank;
+
+    for(bank = 0; bank < 8; bank++)
     {
-        unsigned i;
-        uint8_t *pattern_cache = ppu->pattern_cache[table][0];
-        uint8_t *pattern_dirty = ppu->pattern_dirty[table];
-        uint8_t *sprite = ppu->bank[0];
+        unsigned i, slot;
 
-        for(i = 0; i < NUM_PATTERNS_PER_TABLE; i++)
+        for(i = 0; i < NUM_PATTERNS_PER_BANK; i++)
         {
-            unsigned x, y;
-            if(i % 64 == 0)
+            if(ppu->pattern_dirty[bank][i])
             {
-                sprite = ppu->bank[table * 4 + i / 64];
-            }
+                ppu->pattern_dirty[bank][i] = 0;
+                ppu->tile->decode(ppu->ram_patterns[bank][i],
+                                  &ppu->state.builtin_bank[bank][i * PPU_PATTERN_SIZE], 1);
 
-            if(ppu->dirty || *pattern_dirty || 1)
-            {
-                *pattern_dirty = 0;
-
-                for(y = 0; y < PATTERN_HEIGHT; y++)
+                for(slot = 0; slot < 4; slot++)
                 {
-                    uint8_t line0 = sprite[0];
-                    uint8_t line1 = sprite[PATTERN_HEIGHT];
-
-                    for(x = 0; x < PATTERN_WIDTH; x++)
+                    if(ppu->background.patterns[slot] == ppu->ram_patterns[bank][0])
                     {
-                        *pattern_cache++ = ((line1 & 0x80) >> 6) | ((line0 /*& 0x80*/) >> 7);
-                        line0 <<= 1;
-                        line1 <<= 1;
+                        ppu->background.pattern_dirty[slot * NUM_PATTERNS_PER_BANK + i] = 1;
+                        ppu->background.patterns_dirty = 1;
                     }
-                    sprite++;
                 }
             }
-            else
-            {
-                pattern_cache += CACHED_PATTERN_SIZE;
-                sprite += PATTERN_HEIGHT;
-            }
-
-            pattern_dirty++;
-            sprite += PATTERN_HEIGHT;
         }
     }
 
     ppu->dirty = 0;
 }
 
+// The decoded pattern tile of table 0/1
+static inline const uint8_t *
+nes_ppu_pattern(const NESPPU_t *ppu, unsigned table, unsigned tile)
+{
+    return ppu->patterns[table * 4 + tile / NUM_PATTERNS_PER_BANK] + (tile % NUM_PATTERNS_PER_BANK) * CACHED_PATTERN_SIZE;
+}
+
 static inline void
-nes_ppu_render_pattern8_cached(uint8_t *pixels,
+nes_ppu_render_pattern8_cached(const NESPPU_t *ppu,
+                               uint8_t *pixels,
                                unsigned stride,
                                unsigned offset_x,
-                               uint8_t *sprite_ptr, uint8_t palette_offset,
+                               const uint8_t *sprite_ptr, uint8_t palette_offset,
                                uint16_t X, uint8_t Y, uint8_t sprite_height_16,
                                uint8_t upper_color,
                                uint8_t flip_h, uint8_t flip_v,
@@ -905,64 +1025,42 @@ nes_ppu_render_pattern8_cached(uint8_t *pixels,
 {
     uint8_t *p = &pixels[Y * stride + X + offset_x];
 
-    const int8_t y_offset       = flip_v ? -16 : 0;
-    const int8_t x_increment    = flip_h ? -1 : 1;
-    const int8_t x_offset       = flip_h ? 16 : 0;
-    const int8_t sprite_offset  = x_offset + y_offset;
-    const uint8_t sprite_height = PATTERN_HEIGHT << sprite_height_16;
+    const unsigned sprite_height = PATTERN_HEIGHT << sprite_height_16;
+    unsigned rows = sprite_height;
+    int row_step = PATTERN_WIDTH;
 
-    uint8_t x, y;
+    if(Y >= NES_HEIGHT || X >= NES_WIDTH)
+        return;
+    if(Y + rows > NES_HEIGHT)
+        rows = NES_HEIGHT - Y;
 
-    if(flip_h)
-    {
-        sprite_ptr += PATTERN_WIDTH - 1;
-    }
+    // Bottom row first; an 8x16 sprite's two patterns are consecutive
     if(flip_v)
     {
-        sprite_ptr += (CACHED_PATTERN_SIZE << sprite_height_16) - PATTERN_WIDTH;
+        sprite_ptr += (sprite_height - 1) * PATTERN_WIDTH;
+        row_step = -PATTERN_WIDTH;
     }
 
     upper_color = palette_offset | (upper_color << 2);
 
-    for(y = 0; y < sprite_height; y++)
+    if(X + PATTERN_WIDTH <= NES_WIDTH)
     {
-        if(Y + y >= NES_HEIGHT)
-            break;
-
-        for(x = 0; x < PATTERN_WIDTH; x++)
-        {
-            uint8_t palette_entry = *sprite_ptr;
-            sprite_ptr += x_increment;
-
-            if(X + x < NES_WIDTH)
-            {
-                // Only render non-transparent pixels
-                if(palette_entry > 0)
-                {
-                    if(priority || *p == 0)
-                    {
-                        *p = upper_color | palette_entry;
-                    }
-                }
-                else if(is_bg)
-                {
-                    *p = 0;
-                }
-            }
-            p++;
-        }
-
-        p += stride - x;
-        sprite_ptr += sprite_offset;
+        ppu->tile->draw(p, stride, sprite_ptr, row_step, rows, upper_color, flip_h, priority, is_bg);
+    }
+    else
+    {
+        nes_ppu_tile_draw_clipped(p, stride, sprite_ptr, row_step, rows, NES_WIDTH - X,
+                                  upper_color, flip_h, priority, is_bg);
     }
 }
 
+#ifndef HEADLESS
 static inline void
 nes_ppu_render_pattern16_cached(NESPPU_t *ppu,
                                 DisplayPixel_t *pixels,
                                 unsigned stride,
                                 unsigned offset_x,
-                                uint8_t *sprite_ptr, uint8_t palette_offset,
+                                const uint8_t *sprite_ptr, uint8_t palette_offset,
                                 uint8_t *palette,
                                 uint16_t X, uint8_t Y, uint8_t sprite_height_16,
                                 uint8_t upper_color,
@@ -976,7 +1074,7 @@ nes_ppu_render_pattern16_cached(NESPPU_t *ppu,
     DisplayPixel_t *p = &pixels[Y * stride + X + offset_x];
     int x, y;
 
-    nes_ppu_render_pattern8_cached(temp_pixels, TEMP_STRIDE,
+    nes_ppu_render_pattern8_cached(ppu, temp_pixels, TEMP_STRIDE,
                                    0,
                                    sprite_ptr, palette_offset,
                                    0, 0, sprite_height_16,
@@ -994,18 +1092,20 @@ nes_ppu_render_pattern16_cached(NESPPU_t *ppu,
                 pixel |= upper_color;
             }
 
-            *p++ = ppu->gui.screen_palette[palette[pixel]];
+            *p++ = ppu->gui->screen_palette[palette[pixel]];
         }
 
         p += stride - PATTERN_WIDTH;
     }
 }
+#endif
 
 #else
 #error NOT IMPL
 #endif
 
 // --------------------------------------------------------------------------------
+#ifndef HEADLESS
 #define SEPARATOR_SIZE 2
 
 static void
@@ -1025,15 +1125,15 @@ nes_ppu_sprites_window_draw(Display_t *display, Window_t *window, DisplayPixel_t
         uint8_t upper_color = sprite->attributes & SPRITE_PALETTE;
         uint8_t flip_h = sprite->attributes & SPRITE_FLIP_H;
         uint8_t flip_v = sprite->attributes & SPRITE_FLIP_V;
-        uint8_t *sprite_ptr;
+        const uint8_t *sprite_ptr;
 
         if(ppu->sprite_height_16)
         {
-            sprite_ptr = ppu->pattern_cache[sprite->tile_index & 1][sprite->tile_index & ~1];
+            sprite_ptr = nes_ppu_pattern(ppu, sprite->tile_index & 1, sprite->tile_index & ~1);
         }
         else
         {
-            sprite_ptr = ppu->pattern_cache[sprite_pattern_table][sprite->tile_index];
+            sprite_ptr = nes_ppu_pattern(ppu, sprite_pattern_table, sprite->tile_index);
         }
 
         nes_ppu_render_pattern16_cached(ppu,
@@ -1059,7 +1159,7 @@ nes_ppu_sprites_window_draw(Display_t *display, Window_t *window, DisplayPixel_t
 static void
 nes_ppu_sprites_window_init(NESPPU_t *ppu)
 {
-    Window_t *window = &ppu->gui.sprites_window;
+    Window_t *window = &ppu->gui->sprites_window;
     window->title = "Sprites";
     window->width = 90;
     window->height = 160;
@@ -1088,7 +1188,7 @@ nes_ppu_background_window_draw(Display_t *display, Window_t *window, DisplayPixe
 
     for(pattern = 0; pattern < NUM_PATTERNS_PER_TABLE; pattern++)
     {
-        uint8_t *sprite_ptr = ppu->pattern_cache[ppu->bg_pattern_table][pattern];
+        const uint8_t *sprite_ptr = nes_ppu_pattern(ppu, ppu->bg_pattern_table, pattern);
 
         nes_ppu_render_pattern16_cached(ppu,
                                         origin,
@@ -1113,7 +1213,7 @@ nes_ppu_background_window_draw(Display_t *display, Window_t *window, DisplayPixe
 static void
 nes_ppu_background_window_init(NESPPU_t *ppu)
 {
-    Window_t *window = &ppu->gui.background_window;
+    Window_t *window = &ppu->gui->background_window;
     window->title = "Background";
     window->width = 170;
     window->height = 162;
@@ -1125,122 +1225,301 @@ nes_ppu_background_window_init(NESPPU_t *ppu)
 
     display_add_window(ppu->display, window);
 }
+#endif
 
 // --------------------------------------------------------------------------------
 
+// The 1K name/attribute table (0/1) each of $2000/$2400/$2800/$2C00 is,
+// under the current mirroring (as nes_ppu_get_vram_address() resolves $2007
+// accesses)
 static inline void
-_nes_ppu_render_background(NESPPU_t *ppu, unsigned y)
+nes_ppu_map_nametables(NESPPU_t *ppu, unsigned nametables[4])
 {
-    LOG("PPU render background: %d\n", y);
+    unsigned table;
 
-    if(ppu->background_visible || ppu->sprites_visible)
+    for(table = 0; table < 4; table++)
     {
-        if(y == 0 || ppu->dirty)
+        switch(ppu->state.mirroring)
         {
-            nes_ppu_update_pattern_cache(ppu);
+            case Mirror1ScreenA:
+                nametables[table] = 0;
+                break;
+
+            case Mirror1ScreenB:
+                nametables[table] = 1;
+                break;
+
+            case MirrorVertical:
+                nametables[table] = table & 1;
+                break;
+
+            case MirrorHorizontal:
+            default:
+                nametables[table] = table >> 1;
+                break;
         }
     }
+}
+
+// Renders a line of background as the PPU fetches it: 33 tiles from V
+// across, the first shifted out by the fine X scroll.  Coarse Y 30-31
+// fetch attribute bytes as tiles, as on the PPU.
+static void
+nes_ppu_render_background(NESPPU_t *ppu, unsigned line)
+{
+    unsigned nametables[4];
+    uint8_t pixels[NES_WIDTH + PATTERN_WIDTH];
+    uint16_t V = ppu->state.vram.V;
+    const unsigned fine_y = V >> 12;
+    unsigned tile;
+
+    LOG("PPU render background: %d\n", line);
+
+    nes_ppu_map_nametables(ppu, nametables);
+
+    for(tile = 0; tile <= NES_WIDTH / PATTERN_WIDTH; tile++)
+    {
+        const uint8_t *nametable = (const uint8_t *) &ppu->state.bank2.map.na_tables[nametables[PPU_NAME_TABLE(V)]];
+        const unsigned coarse_x = V & 0x1f;
+        const unsigned coarse_y = (V >> 5) & 0x1f;
+        const uint8_t *sprite_ptr = nes_ppu_pattern(ppu, ppu->bg_pattern_table, nametable[V & 0x3ff]);
+        uint8_t attribute = nametable[offsetof(NameAttributeTable_t, attribute) + (coarse_y / 4) * 8 + (coarse_x / 4)];
+
+        // 2 bits per 16x16 quadrant
+        attribute >>= ((coarse_y & 2) << 1) | (coarse_x & 2);
+
+        ppu->tile->draw(&pixels[tile * PATTERN_WIDTH], 0, sprite_ptr + fine_y * PATTERN_WIDTH, PATTERN_WIDTH, 1,
+                        (attribute & 0x3) << 2, 0, 1, 1);
+
+        // Coarse X, into the next nametable across after 31
+        if(coarse_x == 31)
+            V = (V & ~0x001f) ^ 0x0400;
+        else
+            V++;
+    }
+
+    memcpy(&ppu->frame.nes_screen[NES_WIDTH * line], &pixels[ppu->state.vram.X], NES_WIDTH);
+}
+
+// Brings the background surface up to date for the line, or returns 0 if
+// it can't be used: a bank or pattern table switch mid-frame (eg. under a
+// status bar) is fetched directly, rather than redrawing the surface twice
+// a frame
+static int
+nes_ppu_update_background(NESPPU_t *ppu, unsigned line)
+{
+    NameAttributeTable_t *na_tables = ppu->state.bank2.map.na_tables;
+    unsigned slot, table, i;
 
-    // Render the background
-    if(ppu->background_visible)
+    for(slot = 0; slot < 4; slot++)
     {
-        NESPPUMemoryMap_t *ppu_memory = &ppu->state.bank2.map;
-        unsigned table;
+        const uint8_t *patterns = ppu->patterns[ppu->bg_pattern_table * 4 + slot];
 
-        for(table = 0; table <= 1; table++)
+        if(ppu->background.patterns[slot] != patterns)
         {
-            NameAttributeTable_t *na_table = &ppu_memory->na_tables[table];
-            uint8_t attribute_index;
-            unsigned table_x = table * NES_WIDTH;
+            if(line > 0 && ppu->background.patterns[slot])
+                return 0;
 
-            uint16_t x;
+            ppu->background.patterns[slot] = patterns;
+            memset(&ppu->background.pattern_dirty[slot * NUM_PATTERNS_PER_BANK], 1, NUM_PATTERNS_PER_BANK);
+            ppu->background.patterns_dirty = 1;
+        }
+    }
+
+    if(ppu->background.patterns_dirty)
+    {
+        for(table = 0; table < 2; table++)
+        {
+            for(i = 0; i < NUM_TILES_PER_NAME_TABLE; i++)
+            {
+                ppu->background.tile_dirty[table][i] |= ppu->background.pattern_dirty[na_tables[table].name[i]];
+            }
+        }
 
-            attribute_index = (y / ATTRIBUTE_HEIGHT) * (NES_WIDTH / ATTRIBUTE_WIDTH);
+        memset(ppu->background.pattern_dirty, 0, sizeof(ppu->background.pattern_dirty));
+        ppu->background.patterns_dirty = 0;
+        ppu->background.tiles_dirty = 1;
+    }
 
-            attribute_index--;
-            for(x = 0; x < NES_WIDTH; x += 8)
+    if(ppu->background.tiles_dirty)
+    {
+        for(table = 0; table < 2; table++)
+        {
+            for(i = 0; i < NUM_TILES_PER_NAME_TABLE; i++)
             {
-                if((x % ATTRIBUTE_WIDTH) == 0)
-                {
-                    attribute_index++;
-                }
+                const unsigned x = i % (NES_WIDTH / PATTERN_WIDTH);
+                const unsigned y = i / (NES_WIDTH / PATTERN_WIDTH);
+                uint8_t attribute;
+
+                if(! ppu->background.tile_dirty[table][i])
+                    continue;
+
+                ppu->background.tile_dirty[table][i] = 0;
 
-                uint8_t attribute = na_table->attribute[attribute_index];
-
-                if((x & 31) >= 16)
-                    attribute >>= 2;
-                if((y & 31) >= 16)
-                    attribute >>= 4;
-
-                uint16_t sprite_offset = y * 4 + (x / 8);
-                uint8_t sprite_num = na_table->name[sprite_offset];
-                uint8_t *sprite_ptr = ppu->pattern_cache[ppu->bg_pattern_table][sprite_num];
-
-                nes_ppu_render_pattern8_cached(ppu->gui.nes_background,
-                                               BACKGROUND_WIDTH,
-                                               table_x,
-                                               sprite_ptr, 0,
-                                               x, y, 0,
-                                               attribute & 0x3,
-                                               0,
-                                               0,
-                                               1,
-                                               1);
+                // 2 bits per 16x16 quadrant
+                attribute = na_tables[table].attribute[(y / 4) * 8 + (x / 4)];
+                attribute >>= ((y & 2) << 1) | (x & 2);
+
+                ppu->tile->draw(&ppu->background.pixels[table][y * PATTERN_HEIGHT][x * PATTERN_WIDTH], NES_WIDTH,
+                                nes_ppu_pattern(ppu, ppu->bg_pattern_table, na_tables[table].name[i]), PATTERN_WIDTH,
+                                PATTERN_HEIGHT, (attribute & 0x3) << 2, 0, 1, 1);
             }
         }
+
+        ppu->background.tiles_dirty = 0;
     }
+
+    return 1;
 }
 
-void
-nes_ppu_render_foreground(NESPPU_t *ppu)
+// Copies the line out of the background surface, from V and the fine X
+// scroll as nes_ppu_render_background() fetches it, for coarse Y 0-29
+static void
+nes_ppu_compose_background(NESPPU_t *ppu, unsigned line)
+{
+    unsigned nametables[4];
+    const uint16_t V = ppu->state.vram.V;
+    const unsigned x = ((V & 0x1f) << 3) | ppu->state.vram.X;
+    const unsigned y = (((V >> 5) & 0x1f) << 3) | (V >> 12);
+    uint8_t *dst = &ppu->frame.nes_screen[NES_WIDTH * line];
+
+    nes_ppu_map_nametables(ppu, nametables);
+
+    // The rest of the line from the nametable across
+    memcpy(dst, &ppu->background.pixels[nametables[PPU_NAME_TABLE(V)]][y][x], NES_WIDTH - x);
+    memcpy(dst + NES_WIDTH - x, &ppu->background.pixels[nametables[PPU_NAME_TABLE(V) ^ 1]][y][0], x);
+}
+
+// Fine Y, then coarse Y: from row 29 into the next nametable down, and
+// from 31 (attribute rows) back to 0 in the same one
+static inline void
+nes_ppu_increment_y(NESPPU_t *ppu)
 {
-    // Render the foreground sprites
-    if(ppu->sprites_visible && ! ppu->options.hide_sprites)
+    uint16_t V = ppu->state.vram.V;
+
+    if((V & 0x7000) != 0x7000)
     {
-        int sprite_num = NUM_SPRITES;
-        NESPPUSprite_t *sprite = &ppu->state.spr_ram.sprites[NUM_SPRITES - 1];
-        int sprite_pattern_table = ppu->spr_pattern_table;
+        V += 0x1000;
+    }
+    else
+    {
+        unsigned coarse_y = (V >> 5) & 0x1f;
+
+        V &= ~0x7000;
+
+        if(coarse_y == 29)
+        {
+            coarse_y = 0;
+            V ^= 0x0800;
+        }
+        else if(coarse_y == 31)
+        {
+            coarse_y = 0;
+        }
+        else
+        {
+            coarse_y++;
+        }
+
+        V = (V & ~0x03e0) | (coarse_y << 5);
+    }
+
+    ppu->state.vram.V = V;
+}
 
-        LOG("Rendering sprites\n");
+// Buckets OAM by the lines each sprite covers, in OAM order as the PPU
+// finds them, up to the per-line limit
+static void
+nes_ppu_evaluate_sprites(NESPPU_t *ppu)
+{
+    const unsigned sprite_height = PATTERN_HEIGHT << ppu->sprite_height_16;
+    const unsigned limit = ppu->options.no_sprite_limit ? NUM_SPRITES : MAX_SPRITES_PER_SCANLINE;
+    unsigned sprite_num;
 
-        do
+    memset(ppu->scanline_sprites.mask, 0, sizeof(ppu->scanline_sprites.mask));
+    memset(ppu->scanline_sprites.count, 0, sizeof(ppu->scanline_sprites.count));
+
+    for(sprite_num = 0; sprite_num < NUM_SPRITES; sprite_num++)
+    {
+        const NESPPUSprite_t *sprite = &ppu->state.spr_ram.sprites[sprite_num];
+        unsigned top = sprite->y_coord_minus_1 + NES_PPU_SPRITE_YOFFSET;
+        unsigned line;
+
+        for(line = top; line < top + sprite_height && line < NES_HEIGHT; line++)
         {
-            if(PPU_SPRITE_VISIBLE(ppu, sprite)
-               // FIXME: this should take into account hflip and x
-               && ! (ppu->sprite_clipping && sprite->x_coord <= 1)
-                )
+            if(ppu->scanline_sprites.count[line]++ < limit)
             {
-                uint8_t upper_color = sprite->attributes & SPRITE_PALETTE;
-                uint8_t flip_h = sprite->attributes & SPRITE_FLIP_H;
-                uint8_t flip_v = sprite->attributes & SPRITE_FLIP_V;
-                uint8_t priority = (sprite->attributes & SPRITE_PRIORITY) == 0;
+                ppu->scanline_sprites.mask[line] |= (uint64_t) 1 << sprite_num;
+            }
+        }
+    }
 
-                uint8_t *sprite_ptr;
+    ppu->scanline_sprites.dirty = 0;
+}
 
-                if(ppu->sprite_height_16)
-                {
-                    sprite_ptr = ppu->pattern_cache[sprite->tile_index & 1][sprite->tile_index & ~1];
-                }
-                else
-                {
-                    sprite_ptr = ppu->pattern_cache[sprite_pattern_table][sprite->tile_index];
-                }
+// Composites the line's sprites over its background
+static void
+nes_ppu_render_sprites(NESPPU_t *ppu, unsigned line)
+{
+    uint64_t mask = ppu->scanline_sprites.mask[line];
+    uint8_t *pixels = &ppu->frame.nes_screen[NES_WIDTH * line];
+    const unsigned sprite_height = PATTERN_HEIGHT << ppu->sprite_height_16;
+    int sprite_num;
+
+    LOG("Rendering sprites: %d\n", line);
+
+    // Highest index first, so that lower ones are drawn over it
+    for(sprite_num = NUM_SPRITES - 1; mask; sprite_num--)
+    {
+        const NESPPUSprite_t *sprite = &ppu->state.spr_ram.sprites[sprite_num];
+
+        if(! (mask & ((uint64_t) 1 << sprite_num)))
+            continue;
+
+        mask &= ~((uint64_t) 1 << sprite_num);
 
-                if(ppu->options.sprite0_negative && sprite_num == 1)
-                    upper_color = ~upper_color;
-
-                nes_ppu_render_pattern8_cached(ppu->gui.nes_screen,
-                                               NES_WIDTH,
-                                               0,
-                                               sprite_ptr, PALETTE_SIZE,
-                                               sprite->x_coord, sprite->y_coord_minus_1 + NES_PPU_SPRITE_YOFFSET, ppu->sprite_height_16,
-                                               upper_color,
-                                               flip_h, flip_v,
-                                               priority,
-                                               0);
+        if(PPU_SPRITE_VISIBLE(ppu, sprite)
+           // FIXME: this should take into account hflip and x
+           && ! (ppu->sprite_clipping && sprite->x_coord <= 1)
+            )
+        {
+            uint8_t upper_color = sprite->attributes & SPRITE_PALETTE;
+            uint8_t flip_h = sprite->attributes & SPRITE_FLIP_H;
+            uint8_t priority = (sprite->attributes & SPRITE_PRIORITY) == 0;
+            unsigned row = line - (sprite->y_coord_minus_1 + NES_PPU_SPRITE_YOFFSET);
+
+            const uint8_t *sprite_ptr;
+
+            if(ppu->sprite_height_16)
+            {
+                sprite_ptr = nes_ppu_pattern(ppu, sprite->tile_index & 1, sprite->tile_index & ~1);
             }
-            --sprite;
-        } while(--sprite_num > 0);
+            else
+            {
+                sprite_ptr = nes_ppu_pattern(ppu, ppu->spr_pattern_table, sprite->tile_index);
+            }
+
+            // An 8x16 sprite's two patterns are consecutive
+            if(sprite->attributes & SPRITE_FLIP_V)
+                row = sprite_height - 1 - row;
+            sprite_ptr += row * PATTERN_WIDTH;
+
+            if(ppu->options.sprite0_negative && sprite_num == 0)
+                upper_color = ~upper_color;
+
+            upper_color = PALETTE_SIZE | (upper_color << 2);
+
+            if(sprite->x_coord + PATTERN_WIDTH <= NES_WIDTH)
+            {
+                ppu->tile->draw(&pixels[sprite->x_coord], NES_WIDTH, sprite_ptr, PATTERN_WIDTH, 1,
+                                upper_color, flip_h, priority, 0);
+            }
+            else
+            {
+                nes_ppu_tile_draw_clipped(&pixels[sprite->x_coord], NES_WIDTH, sprite_ptr, PATTERN_WIDTH, 1,
+                                          NES_WIDTH - sprite->x_coord, upper_color, flip_h, priority, 0);
+            }
+        }
     }
 }
 
@@ -1271,189 +1550,52 @@ nes_ppu_render_scanline(NESPPU_t *ppu)
             }
         }
 
-        int scroll_x = (int) ((ppu->state.vram.V & 0x1f) << 3) | ppu->state.vram.X;
-        int scroll_y = (int) (((ppu->state.vram.V >> 5) & 0x1f) << 3) | (ppu->state.vram.V >> 12);
-        int v = (ppu->state.vram.V >> 11) & 1;
-        int h = (ppu->state.vram.V >> 10) & 1;
-
-        switch(ppu->state.mirroring)
-        {
-            case MirrorHorizontal:
-                if(v)
-                    scroll_y |= 256;
-                break;
-
-            case MirrorVertical:
-                if(h)
-                    scroll_x |= 256;
-                break;
-
-            default:
-                break;
-        }
-
-        if((line % PATTERN_HEIGHT) == 0)
+        if(clock_vram && ppu->dirty)
         {
-            _nes_ppu_render_background(ppu, line);
+            nes_ppu_update_pattern_cache(ppu);
         }
 
-        if(! ppu->background_visible)
+        if(ppu->scanline_sprites.dirty)
         {
-            memset(&ppu->gui.nes_screen[NES_WIDTH * line], 0, BACKGROUND_WIDTH);
-            return;
+            nes_ppu_evaluate_sprites(ppu);
         }
 
-#if 0
+        // The PPU finds the next line's sprites during this one, and sets
+        // the flag on a 9th, drawn or not
+        if(clock_vram && line + 1 < NES_HEIGHT &&
+           ppu->scanline_sprites.count[line + 1] > MAX_SPRITES_PER_SCANLINE)
         {
-            static int last_scroll_x = 0;
-            static int last_scroll_y = 0;
-            static PPUMirroring_t last_mirroring = 0;
-            static int last_bg_table = 0;
-            static int last_sprite_height = 0;
-            static int last_one_screen = 0;
-
-            if(scroll_x != last_scroll_x || scroll_y != last_scroll_y ||
-               ppu->mirroring != last_mirroring ||
-               ppu->bg_pattern_table != last_bg_table ||
-               ppu->sprite_height_16 != last_sprite_height ||
-               ppu->one_screen != last_one_screen)
-            {
-                last_scroll_x = scroll_x;
-                last_scroll_y = scroll_y;
-                last_mirroring = ppu->mirroring;
-                last_bg_table = ppu->bg_pattern_table;
-                last_sprite_height = ppu->sprite_height_16;
-                last_one_screen = ppu->one_screen;
-
-                NOTIFY("scroll: %3d %3d tbl=%d %s %d @ %d\n",
-                       scroll_x, scroll_y,
-                       ppu->bg_pattern_table,
-                       PPU_MIRRORING_STR[ppu->mirroring],
-                       8 << ppu->sprite_height_16,
-                       ppu->scanline);
-            }
+            ppu->status.bits.scanline_sprite_count = 1;
         }
-#endif
-
-        int src_line = scroll_y++;
 
-        if((scroll_y & 255) == 240)
+        if(ppu->background_visible)
         {
-            // Vertical offsets 240-255 (aka Tile Rows 30-31) will cause garbage Tile numbers to
-            // be fetched from the Attribute Table (instead of from Name Table), after line 255 it
-            // will wrap to line 0, but without producing a carry-out to the Name Table Address.
-            scroll_y += 16;
-            v = !v;
-        }
-
-        if(clock_vram)
-        {
-            ppu->state.vram.V =
-                (ppu->state.vram.V & 0x041f) |
-                ((scroll_y & 7) << 12) |
-                (((scroll_y >> 3) & 0x1f) << 5);
+            if(((ppu->state.vram.V >> 5) & 0x1f) < NES_HEIGHT / PATTERN_HEIGHT && nes_ppu_update_background(ppu, line))
+                nes_ppu_compose_background(ppu, line);
+            else
+                nes_ppu_render_background(ppu, line);
 
-            if(v)
+            if(ppu->background_clipping)
             {
-                ppu->state.vram.V |= (1 << 11);
+                // Clip the left 8 BG pixels with the transparent color
+                memset(&ppu->frame.nes_screen[NES_WIDTH * line], 0, 8);
             }
-            if(h)
-            {
-                ppu->state.vram.V |= (1 << 10);
-            }
-        }
-
-        scroll_y &= 511;
 
-        int offset_x = 0;
-        int len;
-
-        switch(ppu->state.mirroring)
-        {
-            case MirrorVertical:
-                // Vertical mirroring (horizontal scrolling ROMs)
-
-                if(src_line >= 256)
-                {
-                    src_line -= 256;
-                    scroll_x += 256;
-                }
-
-                src_line &= 255;
-                //scroll_x &= 511;
-
-                if(src_line >= 240)
-                {
-                    // FIXME: See wavy-stretch-demo.nes to debug this
-                    printf("wat: %d <= %d!\n", line, src_line);
-                    src_line = 240;
-                }
-
-                len = (BACKGROUND_WIDTH - scroll_x);
-                break;
-
-            case MirrorHorizontal:
-                // Horizontal mirroring (vertical scrolling ROMs)
-
-                //scroll_x &= 255;
-
-                if(src_line >= 256)
-                {
-                    scroll_x += 256;
-                }
-                src_line &= 255;
-
-                scroll_x &= 511;
-
-                if(src_line >= 240)
-                {
-                    INFO("clamping: %d %d\n", src_line, scroll_x);
-                    //src_line -= 240;
-                    src_line = 0;
-                }
-
-                offset_x = (scroll_x & 256);
-
-                len = NES_WIDTH - (scroll_x & 255);
-                break;
-
-            case Mirror1ScreenB:
-                offset_x = 256;
-                scroll_x &= 255;
-                scroll_x |= 256;
-                // fallthrough
-            case Mirror1ScreenA:
-            default:
-                len = NES_WIDTH - (scroll_x & 255);
-                break;
+            nes_ppu_check_sprite0_collision(ppu);
         }
-
-        if(len > NES_WIDTH)
-            len = NES_WIDTH;
-
-        memcpy(&ppu->gui.nes_screen[NES_WIDTH * line],
-               &ppu->gui.nes_background[BACKGROUND_WIDTH * src_line + scroll_x],
-               len);
-
-        if(len < NES_WIDTH)
+        else
         {
-            memcpy(&ppu->gui.nes_screen[NES_WIDTH * line + len],
-                   &ppu->gui.nes_background[BACKGROUND_WIDTH * src_line + offset_x],
-                   (NES_WIDTH - len));
+            memset(&ppu->frame.nes_screen[NES_WIDTH * line], 0, NES_WIDTH);
         }
 
-        if(ppu->background_clipping)
+        if(ppu->sprites_visible && ! ppu->options.hide_sprites)
         {
-            // Clip the left 8 BG pixels with the transparent color
-            memset(&ppu->gui.nes_screen[NES_WIDTH * line], 0, 8);
+            nes_ppu_render_sprites(ppu, line);
         }
 
-        nes_ppu_check_sprite0_collision(ppu);
-
-        if(line == (NES_HEIGHT - 1))
+        if(clock_vram)
         {
-            // FIXME: force re-render if cache dirty
-            nes_ppu_render_foreground(ppu);
+            nes_ppu_increment_y(ppu);
         }
 
         if(ppu->options.sync_every_nth_scanline > 0 && (line % ppu->options.sync_every_nth_scanline) == 0)
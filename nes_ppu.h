@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include "display.h"
 #include "n6502.h" // So that we can track CPU cycles
+#include "nes_scheduler.h"
 
 #define OLDPPU
 
@@ -14,12 +15,15 @@
 #define SPR_RAM_SIZE      256
 
 #define NUM_SPRITES       64
+#define MAX_SPRITES_PER_SCANLINE 8
 #define PATTERN_HEIGHT    8
 #define PATTERN_WIDTH     8
 
 #define PPU_PATTERN_SIZE  16
 #define NUM_PATTERNS_PER_TABLE (0x1000 / PPU_PATTERN_SIZE)
+#define NUM_PATTERNS_PER_BANK  (1024 / PPU_PATTERN_SIZE) // Per 1K slot in bank[]
 #define CACHED_PATTERN_SIZE    (PATTERN_WIDTH * PATTERN_HEIGHT)
+#define NUM_TILES_PER_NAME_TABLE ((NES_WIDTH / PATTERN_WIDTH) * (NES_HEIGHT / PATTERN_HEIGHT))
 
 #define NES_WIDTH         256
 #define NES_HEIGHT        240
@@ -173,34 +177,99 @@ typedef enum
 
 extern const char *PPU_MIRRORING_STR[4];
 
-#define BACKGROUND_WIDTH (NES_WIDTH * 2)
-
+// Frontend side of the PPU: its windows, and the NES palette mapped to the
+// display's pixel format.  Owned by the NES frontend (see NESGUI_t); the PPU
+// runs without it.
 typedef struct
 {
-    struct
+    uint32_t screen_palette[NES_PPU_PALETTE_SIZE];
+
+    Window_t nes_window;
+    Window_t ppu_info_window;
+    Window_t palette_window;
+    Window_t sprites_window;
+    Window_t background_window;
+} NESPPUGUI_t;
+
+// Laid out hot to cold: the flags and registers touched on every register
+// access and scanline, then OAM, VRAM and the pattern caches, and the frame
+// buffers last.
+typedef struct
+{
+    uint8_t in_vblank;
+
+    uint8_t nmi_on_vblank;
+    uint8_t sprite_height_16;
+    uint8_t spr_pattern_table;
+    uint8_t bg_pattern_table;
+
+    uint8_t background_color;
+    uint8_t background_black;
+    uint8_t background_red;
+    uint8_t background_green;
+    uint8_t background_blue;
+    uint8_t sprites_visible;
+    uint8_t background_visible;
+    uint8_t sprite_clipping;
+    uint8_t background_clipping;
+    uint8_t monochrome;
+
+    union
     {
-        uint8_t nes_screen[NES_WIDTH * NES_HEIGHT];
-        uint8_t nes_background[BACKGROUND_WIDTH * NES_HEIGHT]; // East/west background; FIXME: North/south background
+        uint8_t word;
+        struct
+        {
+            unsigned __reserved            : 4;
 
-        uint32_t screen_palette[NES_PPU_PALETTE_SIZE];
+            unsigned vram_write_flag       : 1;
+            unsigned scanline_sprite_count : 1;
+            unsigned sprite0_collision     : 1;
+            unsigned vblank                : 1;
+        } bits;
+    } status;
 
-        Window_t nes_window;
-        Window_t ppu_info_window;
-        Window_t palette_window;
-        Window_t sprites_window;
-        Window_t background_window;
-    } gui;
+    unsigned scanline;
+    int64_t scanline_start_ppu_cycle;
 
     struct
     {
-        PPUMirroring_t mirroring; // FIXME: this should be moved into NES struct
-        unsigned pal; // 0 = NTSC, 1 = PAL
-        uint8_t four_screen;
+        int x;
+        int y;
+        int index;
 
+        int hit;
+    } sprite0;
+
+    uint8_t *bank[8];
+
+    N6502_t *cpu;
+    NESScheduler_t *sched;
+
+    // Saved and restored as a whole: registers and OAM first, then VRAM
+    struct
+    {
         PPUControl1Reg_t control1;
         PPUControl2Reg_t control2;
 
+        struct
+        {
+            uint16_t V; // active VRAM address
+            uint16_t T; // VRAM address latch
+            uint16_t X; // fine X scroll register
+            uint8_t S;
+
+            uint8_t read_buffer;
+            uint8_t increment;
+
+            uint8_t first_write;
+        } vram;
+
         uint8_t spr_ram_address;
+
+        PPUMirroring_t mirroring; // FIXME: this should be moved into NES struct
+        unsigned pal; // 0 = NTSC, 1 = PAL
+        uint8_t four_screen;
+
         int bank_mapping[8];
 
         union
@@ -217,74 +286,32 @@ typedef struct
         } bank2;
 
         uint8_t builtin_bank[8][1024];
-
-        struct
-        {
-            uint16_t V; // active VRAM address
-            uint16_t T; // VRAM address latch
-            uint16_t X; // fine X scroll register
-            uint8_t S;
-
-            uint8_t read_buffer;
-            uint8_t increment;
-
-            uint8_t first_write;
-        } vram;
     } state;
 
     unsigned num_vrom_banks;
     uint8_t *vrom_banks;
     uint8_t has_vrom;
 
-    uint8_t *bank[8];
-
-    uint8_t in_vblank;
-
-    uint8_t nmi_on_vblank;
-    uint8_t sprite_height_16;
-    uint8_t spr_pattern_table;
-    uint8_t bg_pattern_table;
-
-    uint8_t background_color;
-    uint8_t background_black;
-    uint8_t background_red;
-    uint8_t background_green;
-    uint8_t background_blue;
-    uint8_t sprites_visible;
-    uint8_t background_visible;
-    uint8_t sprite_clipping;
-    uint8_t background_clipping;
-    uint8_t monochrome;
-
     unsigned last_frame_ms;
 
-    unsigned scanline;
-    int64_t scanline_start_ppu_cycle;
-
     unsigned frame_count;
 
-#ifndef OLDPPU
+    // OAM bucketed by the lines each sprite covers: a bit per sprite, up to
+    // the per-line limit, and how many there were in all.  Evaluated again
+    // on the next line once OAM or the sprite size changes (dirty).
     struct
     {
-        int index[16];
-        int count;
+        uint64_t mask[NES_HEIGHT];
+        uint8_t count[NES_HEIGHT];
+        unsigned dirty;
     } scanline_sprites;
-#endif
-
-    struct
-    {
-        int x;
-        int y;
-        int index;
-
-        int hit;
-    } sprite0;
 
     struct
     {
         unsigned display_width;
         unsigned display_height;
         unsigned display_windowed;
+        unsigned display_fullscreen;
         unsigned enable_scanlines;
 
         int sprite_clip_right; // HACK for Blargg PPU testing
@@ -300,34 +327,61 @@ typedef struct
         unsigned paused;
 
         unsigned enable_paddle; // FIXME: move to input.c
+        const char *tile_kernels; // NULL: the best the CPU supports
+        unsigned no_sprite_limit; // Draw every sprite on a line, not only the first 8
     } options;
 
-    uint8_t pattern_cache[2][NUM_PATTERNS_PER_TABLE][CACHED_PATTERN_SIZE];
-    uint8_t pattern_dirty[2][NUM_PATTERNS_PER_TABLE];
+    const struct NESPPUTileKernels *tile;
+
+    // Patterns decoded to a byte per pixel, for each 1K slot of bank[]: into
+    // vrom_patterns, which the ROM image decodes once for every NES sharing it,
+    // or into ram_patterns for the builtin CHR RAM.  A bank switch only
+    // repoints the slot.  A CHR RAM pattern is decoded again once a $2007
+    // write changes it and marks it in pattern_dirty; dirty is set while any
+    // are marked.
+    const uint8_t *patterns[8];
+    const uint8_t *vrom_patterns; // As vrom_banks, CACHED_PATTERN_SIZE per pattern
+    uint8_t ram_patterns[8][NUM_PATTERNS_PER_BANK][CACHED_PATTERN_SIZE];
+    uint8_t pattern_dirty[8][NUM_PATTERNS_PER_BANK];
     unsigned dirty;
 
-    union
+    // The two nametables drawn whole from the background pattern table, to
+    // copy lines out of; the mirroring maps all four quadrants of the
+    // 512x480 nametable space onto them.  Only the tiles marked in
+    // tile_dirty are redrawn: by $2007 writes to their name or attribute
+    // bytes, or through pattern_dirty by CHR RAM updates and bank switches.
+    struct
     {
-        uint8_t word;
-        struct
-        {
-            unsigned __reserved            : 4;
+        const uint8_t *patterns[4]; // The patterns[] slots drawn from; NULL to redraw all
+        uint8_t pattern_dirty[NUM_PATTERNS_PER_TABLE];
+        uint8_t tile_dirty[2][NUM_TILES_PER_NAME_TABLE];
+        unsigned patterns_dirty;
+        unsigned tiles_dirty;
 
-            unsigned vram_write_flag       : 1;
-            unsigned scanline_sprite_count : 1;
-            unsigned sprite0_collision     : 1;
-            unsigned vblank                : 1;
-        } bits;
-    } status;
+        uint8_t pixels[2][NES_HEIGHT][NES_WIDTH];
+    } background;
 
+    // Rendered output
+    struct
+    {
+        uint8_t nes_screen[NES_WIDTH * NES_HEIGHT];
+    } frame;
+
+    // NULL when running headless
+    NESPPUGUI_t *gui;
     Display_t *display;
-    N6502_t *cpu;
 } NESPPU_t;
 
-void nes_ppu_init(NESPPU_t *ppu, Display_t *display, N6502_t *cpu);
+void nes_ppu_init(NESPPU_t *ppu, N6502_t *cpu, NESScheduler_t *sched);
+#ifndef HEADLESS
+void nes_ppu_gui_init(NESPPU_t *ppu, NESPPUGUI_t *gui, Display_t *display);
+#endif
 void nes_ppu_reset(NESPPU_t *ppu);
 void nes_ppu_restore(NESPPU_t *ppu);
 
+// Decodes num_patterns of 2bpp CHR into CACHED_PATTERN_SIZE bytes each
+void nes_ppu_decode_patterns(uint8_t *dst, const uint8_t *chr, size_t num_patterns);
+
 void nes_ppu_select_vrom_bank(NESPPU_t *ppu, unsigned vrom_dest, unsigned vrom_src, unsigned size_kb);
 
 void nes_ppu_update_status(NESPPU_t *ppu);
@@ -335,6 +389,9 @@ void nes_ppu_render(NESPPU_t *ppu);
 void nes_ppu_latch_joypads(NESPPU_t *ppu, uint8_t *pad1, uint8_t *pad2, uint8_t *mousedown);
 void nes_ppu_render_scanline(NESPPU_t *ppu);
 
+// The last frame as 0x00RRGGBB, NES_WIDTH x NES_HEIGHT
+void nes_ppu_frame_rgb(const NESPPU_t *ppu, uint32_t *pixels);
+
 void nes_ppu_reg_write(NESPPU_t *ppu, uint16_t addr, uint8_t data);
 uint8_t nes_ppu_read_vram(NESPPU_t *ppu);
 
@@ -0,0 +1,303 @@
+#include <string.h>
+
+#include "nes_ppu_tile.h"
+
+// GCC 4.9 and clang can build SSE2/AVX2 functions without -msse2/-mavx2, so
+// one binary carries every set and picks at run time
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define TILE_X86
+#include <immintrin.h>
+
+#define TILE_SSE2 __attribute__((target("sse2")))
+#define TILE_AVX2 __attribute__((target("avx2")))
+#endif
+
+#define TILE_WIDTH  8
+#define TILE_HEIGHT 8
+
+// --------------------------------------------------------------------------------
+// Scalar: a pixel at a time
+
+static void
+tile_decode_scalar(uint8_t *dst, const uint8_t *chr, size_t num_patterns)
+{
+    size_t i;
+
+    for(i = 0; i < num_patterns; i++)
+    {
+        unsigned x, y;
+
+        for(y = 0; y < TILE_HEIGHT; y++)
+        {
+            uint8_t line0 = chr[y];
+            uint8_t line1 = chr[y + TILE_HEIGHT];
+
+            for(x = 0; x < TILE_WIDTH; x++)
+            {
+                *dst++ = ((line1 & 0x80) >> 6) | (line0 >> 7);
+                line0 <<= 1;
+                line1 <<= 1;
+            }
+        }
+
+        chr += 2 * TILE_HEIGHT;
+    }
+}
+
+void
+nes_ppu_tile_draw_clipped(uint8_t *dst, unsigned stride, const uint8_t *src, int src_step,
+                          unsigned rows, unsigned width,
+                          uint8_t color, int flip_h, int priority, int is_bg)
+{
+    unsigned x, y;
+
+    for(y = 0; y < rows; y++)
+    {
+        for(x = 0; x < width; x++)
+        {
+            uint8_t pixel = src[flip_h ? TILE_WIDTH - 1 - x : x];
+
+            // Only render non-transparent pixels
+            if(pixel)
+            {
+                if(priority || dst[x] == 0)
+                    dst[x] = color | pixel;
+            }
+            else if(is_bg)
+            {
+                dst[x] = 0;
+            }
+        }
+
+        src += src_step;
+        dst += stride;
+    }
+}
+
+static void
+tile_draw_scalar(uint8_t *dst, unsigned stride, const uint8_t *src, int src_step, unsigned rows,
+                 uint8_t color, int flip_h, int priority, int is_bg)
+{
+    nes_ppu_tile_draw_clipped(dst, stride, src, src_step, rows, TILE_WIDTH, color, flip_h, priority, is_bg);
+}
+
+#ifdef TILE_X86
+
+// --------------------------------------------------------------------------------
+// SSE2: a 16 byte register holds two rows
+
+// A bit per byte, pixel 0 (bit 7) first, for two rows
+#define TILE_BITS_SSE2 _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1)
+
+// Rows of pixels from rows of plane bytes repeated 8 times each
+TILE_SSE2 static inline __m128i
+tile_pixels_sse2(__m128i plane0, __m128i plane1)
+{
+    const __m128i bits = TILE_BITS_SSE2;
+    __m128i lo = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(plane0, bits), bits), _mm_set1_epi8(1));
+    __m128i hi = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(plane1, bits), bits), _mm_set1_epi8(2));
+
+    return _mm_or_si128(lo, hi);
+}
+
+TILE_SSE2 static void
+tile_decode_sse2(uint8_t *dst, const uint8_t *chr, size_t num_patterns)
+{
+    size_t i;
+
+    for(i = 0; i < num_patterns; i++)
+    {
+        // Each plane byte 8 times over: b0 b0 b1 b1.. then b0 x4 b1 x4.. then
+        // b0 x8 b1 x8 (rows 0-1), b2 x8 b3 x8 (rows 2-3) and so on
+        __m128i p0 = _mm_loadl_epi64((const __m128i *) chr);
+        __m128i p1 = _mm_loadl_epi64((const __m128i *) (chr + TILE_HEIGHT));
+        __m128i p0_x2 = _mm_unpacklo_epi8(p0, p0);
+        __m128i p1_x2 = _mm_unpacklo_epi8(p1, p1);
+        __m128i p0_lo = _mm_unpacklo_epi16(p0_x2, p0_x2);
+        __m128i p0_hi = _mm_unpackhi_epi16(p0_x2, p0_x2);
+        __m128i p1_lo = _mm_unpacklo_epi16(p1_x2, p1_x2);
+        __m128i p1_hi = _mm_unpackhi_epi16(p1_x2, p1_x2);
+        __m128i *out = (__m128i *) dst;
+
+        _mm_storeu_si128(out + 0, tile_pixels_sse2(_mm_unpacklo_epi32(p0_lo, p0_lo), _mm_unpacklo_epi32(p1_lo, p1_lo)));
+        _mm_storeu_si128(out + 1, tile_pixels_sse2(_mm_unpackhi_epi32(p0_lo, p0_lo), _mm_unpackhi_epi32(p1_lo, p1_lo)));
+        _mm_storeu_si128(out + 2, tile_pixels_sse2(_mm_unpacklo_epi32(p0_hi, p0_hi), _mm_unpacklo_epi32(p1_hi, p1_hi)));
+        _mm_storeu_si128(out + 3, tile_pixels_sse2(_mm_unpackhi_epi32(p0_hi, p0_hi), _mm_unpackhi_epi32(p1_hi, p1_hi)));
+
+        chr += 2 * TILE_HEIGHT;
+        dst += TILE_WIDTH * TILE_HEIGHT;
+    }
+}
+
+// draw() on whole registers: the pixels of src that land in dst
+TILE_SSE2 static inline __m128i
+tile_blend_sse2(__m128i dst, __m128i src, __m128i color, int priority, int is_bg)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i transparent = _mm_cmpeq_epi8(src, zero);
+    __m128i write = priority ? _mm_xor_si128(transparent, _mm_set1_epi8(-1))
+                             : _mm_andnot_si128(transparent, _mm_cmpeq_epi8(dst, zero));
+    __m128i keep = _mm_andnot_si128(is_bg ? _mm_or_si128(write, transparent) : write, dst);
+
+    return _mm_or_si128(_mm_and_si128(_mm_or_si128(src, color), write), keep);
+}
+
+TILE_SSE2 static void
+tile_draw_sse2(uint8_t *dst, unsigned stride, const uint8_t *src, int src_step, unsigned rows,
+               uint8_t color, int flip_h, int priority, int is_bg)
+{
+    const __m128i colors = _mm_set1_epi8(color);
+    unsigned y;
+
+    for(y = 0; y < rows; y++)
+    {
+        __m128i pixels;
+
+        if(flip_h)
+        {
+            // No byte shuffle before SSSE3: reverse the row as a 64-bit word
+            uint64_t row;
+
+            memcpy(&row, src, sizeof(row));
+            row = __builtin_bswap64(row);
+            pixels = _mm_loadl_epi64((const __m128i *) &row);
+        }
+        else
+        {
+            pixels = _mm_loadl_epi64((const __m128i *) src);
+        }
+
+        _mm_storel_epi64((__m128i *) dst,
+                         tile_blend_sse2(_mm_loadl_epi64((const __m128i *) dst), pixels, colors, priority, is_bg));
+
+        src += src_step;
+        dst += stride;
+    }
+}
+
+// --------------------------------------------------------------------------------
+// AVX2: four rows a register to decode, and a byte shuffle to flip
+
+TILE_AVX2 static inline __m256i
+tile_pixels_avx2(__m256i plane0, __m256i plane1)
+{
+    const __m256i bits = _mm256_broadcastsi128_si256(TILE_BITS_SSE2);
+    __m256i lo = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(plane0, bits), bits), _mm256_set1_epi8(1));
+    __m256i hi = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(plane1, bits), bits), _mm256_set1_epi8(2));
+
+    return _mm256_or_si256(lo, hi);
+}
+
+TILE_AVX2 static void
+tile_decode_avx2(uint8_t *dst, const uint8_t *chr, size_t num_patterns)
+{
+    // Plane bytes 0-3 then 4-7, 8 times each, from the plane in both lanes
+    const __m256i rows0_3 = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                             2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i rows4_7 = _mm256_add_epi8(rows0_3, _mm256_set1_epi8(4));
+    size_t i;
+
+    for(i = 0; i < num_patterns; i++)
+    {
+        __m256i p0 = _mm256_broadcastq_epi64(_mm_loadl_epi64((const __m128i *) chr));
+        __m256i p1 = _mm256_broadcastq_epi64(_mm_loadl_epi64((const __m128i *) (chr + TILE_HEIGHT)));
+        __m256i *out = (__m256i *) dst;
+
+        _mm256_storeu_si256(out + 0, tile_pixels_avx2(_mm256_shuffle_epi8(p0, rows0_3), _mm256_shuffle_epi8(p1, rows0_3)));
+        _mm256_storeu_si256(out + 1, tile_pixels_avx2(_mm256_shuffle_epi8(p0, rows4_7), _mm256_shuffle_epi8(p1, rows4_7)));
+
+        chr += 2 * TILE_HEIGHT;
+        dst += TILE_WIDTH * TILE_HEIGHT;
+    }
+}
+
+// Two rows at a time: the destination rows are a stride apart, which leaves
+// nothing for a 256-bit register to do
+TILE_AVX2 static void
+tile_draw_avx2(uint8_t *dst, unsigned stride, const uint8_t *src, int src_step, unsigned rows,
+               uint8_t color, int flip_h, int priority, int is_bg)
+{
+    const __m128i colors = _mm_set1_epi8(color);
+    const __m128i reverse = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    unsigned y;
+
+    for(y = 0; y + 1 < rows; y += 2)
+    {
+        __m128i pixels = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) src),
+                                            _mm_loadl_epi64((const __m128i *) (src + src_step)));
+        __m128i under = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) dst),
+                                           _mm_loadl_epi64((const __m128i *) (dst + stride)));
+        __m128i out;
+
+        if(flip_h)
+            pixels = _mm_shuffle_epi8(pixels, reverse);
+
+        out = tile_blend_sse2(under, pixels, colors, priority, is_bg);
+        _mm_storel_epi64((__m128i *) dst, out);
+        _mm_storel_epi64((__m128i *) (dst + stride), _mm_unpackhi_epi64(out, out));
+
+        src += 2 * src_step;
+        dst += 2 * stride;
+    }
+
+    if(y < rows)
+    {
+        __m128i pixels = _mm_loadl_epi64((const __m128i *) src);
+
+        if(flip_h)
+            pixels = _mm_shuffle_epi8(pixels, reverse);
+
+        _mm_storel_epi64((__m128i *) dst,
+                         tile_blend_sse2(_mm_loadl_epi64((const __m128i *) dst), pixels, colors, priority, is_bg));
+    }
+}
+
+static int
+tile_has_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+static int
+tile_has_sse2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+#endif
+
+// --------------------------------------------------------------------------------
+
+static const struct
+{
+    NESPPUTileKernels_t kernels;
+    int (*supported)(void); // NULL: always
+} TILE_KERNELS[] =
+{
+    // Best first
+#ifdef TILE_X86
+    { {"avx2",   tile_decode_avx2,   tile_draw_avx2},   tile_has_avx2 },
+    { {"sse2",   tile_decode_sse2,   tile_draw_sse2},   tile_has_sse2 },
+#endif
+    { {"scalar", tile_decode_scalar, tile_draw_scalar}, NULL },
+};
+
+const NESPPUTileKernels_t *
+nes_ppu_tile_kernels(const char *name)
+{
+    unsigned i;
+
+    for(i = 0; i < sizeof(TILE_KERNELS) / sizeof(TILE_KERNELS[0]); i++)
+    {
+        if(name && strcmp(name, TILE_KERNELS[i].kernels.name) != 0)
+            continue;
+
+        if(! TILE_KERNELS[i].supported || TILE_KERNELS[i].supported())
+            return &TILE_KERNELS[i].kernels;
+    }
+
+    return NULL;
+}
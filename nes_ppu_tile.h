@@ -0,0 +1,40 @@
+#ifndef __nes_ppu_tile_h__
+#define __nes_ppu_tile_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// PPU tile kernels: the per-pixel inner loops of pattern decoding and of
+// background and sprite drawing, in scalar, SSE2 and AVX2 versions.  The best
+// set the CPU supports is picked at run time (CPUID); every set gives the same
+// pixels, so --tile-kernels can force a slower one to check the others.
+//
+// A decoded pattern is 8 rows of 8 bytes, each pixel 0-3 (see
+// CACHED_PATTERN_SIZE); 8x16 sprites are two consecutive patterns.
+typedef struct NESPPUTileKernels
+{
+    const char *name;
+
+    // num_patterns of 2bpp CHR, 16 bytes each, to decoded patterns
+    void (*decode)(uint8_t *dst, const uint8_t *chr, size_t num_patterns);
+
+    // Draws rows rows of 8 decoded pixels from src (src_step bytes apart:
+    // negative to flip vertically) into dst, stride bytes apart.  Each
+    // non-zero pixel is ORed with color (the palette offset and attribute);
+    // it only covers a non-zero dst pixel if priority is set.  Zero pixels
+    // clear dst if is_bg, and leave it alone otherwise.
+    void (*draw)(uint8_t *dst, unsigned stride, const uint8_t *src, int src_step, unsigned rows,
+                 uint8_t color, int flip_h, int priority, int is_bg);
+} NESPPUTileKernels_t;
+
+// NULL for the best the CPU supports; otherwise "scalar", "sse2" or "avx2",
+// or NULL if there is no such set or the CPU lacks it
+const NESPPUTileKernels_t *nes_ppu_tile_kernels(const char *name);
+
+// Draws the first width (< 8) pixels of each row, as draw() does all 8, for
+// tiles running off the right edge of the screen
+void nes_ppu_tile_draw_clipped(uint8_t *dst, unsigned stride, const uint8_t *src, int src_step,
+                               unsigned rows, unsigned width,
+                               uint8_t color, int flip_h, int priority, int is_bg);
+
+#endif
@@ -0,0 +1,306 @@
+#include "nes_rom.h"
+#include "nes_ppu.h"
+#include "common.h"
+#include "cond_lock.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#include <windows.h>
+#endif
+
+#define INES_TRAINER_SIZE 512
+#define INES_PRG_BANK     (16*1024)
+#define INES_CHR_BANK     (8*1024)
+
+static struct
+{
+    CondLock_t lock; // Initialised by the first open (nes_rom_cache_init())
+    NESRomImage_t *images;
+} rom_cache;
+
+// --------------------------------------------------------------------------------
+
+#ifndef WIN32
+
+static const uint8_t *
+nes_rom_map(const char *path, size_t size, int *mapped)
+{
+    void *data;
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0)
+        return NULL;
+
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(data == MAP_FAILED)
+        return NULL;
+
+    *mapped = 1;
+    return data;
+}
+
+static void
+nes_rom_unmap(const uint8_t *data, size_t size, int mapped)
+{
+    if(mapped)
+        munmap((void *) data, size);
+    else
+        free((void *) data);
+}
+
+#else
+
+static const uint8_t *
+nes_rom_map(const char *path, size_t size, int *mapped)
+{
+    FILE *fp = fopen(path, "rb");
+    uint8_t *data;
+
+    if(! fp)
+        return NULL;
+
+    data = malloc(size);
+    if(data && fread(data, size, 1, fp) != 1)
+    {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(fp);
+
+    *mapped = 0;
+    return data;
+}
+
+static void
+nes_rom_unmap(const uint8_t *data, size_t size, int mapped)
+{
+    free((void *) data);
+}
+
+#endif
+
+// --------------------------------------------------------------------------------
+
+static int
+nes_rom_parse(NESRomImage_t *rom)
+{
+    const iNES_t *ines = (const iNES_t *) rom->data;
+    size_t offset = sizeof(iNES_t);
+
+    if(rom->size < sizeof(iNES_t) || memcmp(INES_HEADER, ines->file_id, sizeof(INES_HEADER)) != 0)
+        return 0;
+
+    rom->ines = *ines;
+
+    if(ines->rom_control_byte1 & 4)
+        offset += INES_TRAINER_SIZE;
+
+    rom->prg_size = ines->num_16k_prg_rom_banks * INES_PRG_BANK;
+    rom->chr_size = ines->num_8k_vrom_banks * INES_CHR_BANK;
+
+    if(offset + rom->prg_size + rom->chr_size > rom->size)
+        return 0;
+
+    rom->prg = rom->data + offset;
+    rom->chr = rom->chr_size ? rom->prg + rom->prg_size : NULL;
+
+    return 1;
+}
+
+// The CRC only narrows the search: an image is only shared with the same bytes
+static NESRomImage_t *
+nes_rom_find(const uint8_t *data, uint32_t crc, size_t size)
+{
+    NESRomImage_t *rom;
+
+    for(rom = rom_cache.images; rom; rom = rom->next)
+    {
+        if(rom->crc == crc && rom->size == size && memcmp(rom->data, data, size) == 0)
+            return rom;
+    }
+
+    return NULL;
+}
+
+// Takes ownership of data
+static NESRomImage_t *
+nes_rom_insert(const uint8_t *data, size_t size, int mapped)
+{
+    NESRomImage_t *rom;
+    uint32_t crc = crc32_update(0, data, size);
+
+    cond_lock(&rom_cache.lock);
+
+    // A copy of a ROM that is already loaded
+    rom = nes_rom_find(data, crc, size);
+    if(rom)
+    {
+        rom->refs++;
+        cond_unlock(&rom_cache.lock);
+
+        nes_rom_unmap(data, size, mapped);
+        return rom;
+    }
+
+    rom = calloc(1, sizeof(*rom));
+    ASSERT(rom, "Failed to allocate a ROM image\n");
+
+    rom->refs = 1;
+    rom->crc = crc;
+    rom->size = size;
+    rom->data = data;
+    rom->mapped = mapped;
+
+    if(! nes_rom_parse(rom))
+    {
+        cond_unlock(&rom_cache.lock);
+
+        nes_rom_unmap(data, size, mapped);
+        free(rom);
+        return NULL;
+    }
+
+    rom->next = rom_cache.images;
+    rom_cache.images = rom;
+
+    cond_unlock(&rom_cache.lock);
+
+    NOTIFY("ROM image %08X: %zu bytes %s\n", crc, size, mapped ? "mapped" : "read");
+
+    return rom;
+}
+
+static void
+nes_rom_cache_init_lock(void)
+{
+    cond_init(&rom_cache.lock);
+    rom_cache.lock.init = 1;
+}
+
+// Exactly once, however many threads open their first ROM at the same time
+static void
+nes_rom_cache_init(void)
+{
+#ifndef WIN32
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    pthread_once(&once, nes_rom_cache_init_lock);
+#else
+    static volatile LONG once = 0; // 1 while initialising, 2 when done
+
+    if(InterlockedCompareExchange(&once, 1, 0) == 0)
+    {
+        nes_rom_cache_init_lock();
+        InterlockedExchange(&once, 2);
+    }
+
+    while(once != 2)
+        Sleep(0);
+#endif
+}
+
+NESRomImage_t *
+nes_rom_open(const char *path)
+{
+    struct stat st;
+    const uint8_t *data;
+    int mapped = 0;
+
+    nes_rom_cache_init();
+
+    if(stat(path, &st) != 0 || st.st_size <= 0)
+        return NULL;
+
+    // Even the same path again is hashed and compared: it may have been
+    // replaced by another file since, which leaves loaded images mapping
+    // the old one
+    data = nes_rom_map(path, st.st_size, &mapped);
+    if(! data)
+        return NULL;
+
+    return nes_rom_insert(data, st.st_size, mapped);
+}
+
+NESRomImage_t *
+nes_rom_open_memory(const void *buf, size_t size)
+{
+    uint8_t *data;
+
+    if(size == 0)
+        return NULL;
+
+    nes_rom_cache_init();
+
+    data = malloc(size);
+    if(! data)
+        return NULL;
+
+    memcpy(data, buf, size);
+
+    return nes_rom_insert(data, size, 0);
+}
+
+void
+nes_rom_release(NESRomImage_t *rom)
+{
+    NESRomImage_t **link;
+
+    if(! rom)
+        return;
+
+    cond_lock(&rom_cache.lock);
+
+    ASSERT(rom->refs > 0, "ROM image %08X released too often\n", rom->crc);
+    if(--rom->refs > 0)
+    {
+        cond_unlock(&rom_cache.lock);
+        return;
+    }
+
+    for(link = &rom_cache.images; *link != rom; link = &(*link)->next)
+        ;
+    *link = rom->next;
+
+    cond_unlock(&rom_cache.lock);
+
+    nes_rom_unmap(rom->data, rom->size, rom->mapped);
+    free(rom->chr_patterns);
+    free(rom);
+}
+
+const uint8_t *
+nes_rom_chr_patterns(NESRomImage_t *rom)
+{
+    const size_t num_patterns = rom->chr_size / PPU_PATTERN_SIZE;
+
+    if(! rom->chr)
+        return NULL;
+
+    cond_lock(&rom_cache.lock);
+
+    if(! rom->chr_patterns)
+    {
+        rom->chr_patterns = malloc(num_patterns * CACHED_PATTERN_SIZE);
+        ASSERT(rom->chr_patterns, "Failed to allocate %zu decoded CHR patterns\n", num_patterns);
+
+        nes_ppu_decode_patterns(rom->chr_patterns, rom->chr, num_patterns);
+        NOTIFY("ROM image %08X: decoded %zu CHR patterns\n", rom->crc, num_patterns);
+    }
+
+    cond_unlock(&rom_cache.lock);
+
+    return rom->chr_patterns;
+}
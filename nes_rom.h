@@ -0,0 +1,54 @@
+#ifndef __nes_rom_h__
+#define __nes_rom_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ines.h"
+
+// Read-only iNES images, shared by every NES in the process
+//
+// A ROM file is mapped read-only rather than copied, so its pages live in the
+// page cache and are shared with other processes too.  Images are kept in a
+// refcounted cache keyed by the CRC-32 of the file: opening a ROM whose bytes
+// are already loaded (by the same path or any other) returns the same image,
+// and the new mapping is dropped.  The PRG and CHR banks
+// point straight into the mapping, so the emulator must never write to them.
+//
+// For the same reason a ROM file must not be modified in place while it is
+// loaded: the running instances would see the new bytes under the old CRC, and
+// a truncated file raises SIGBUS.  Replacing it with a new file (a rename, as
+// most tools do) is safe.
+typedef struct NESRomImage
+{
+    struct NESRomImage *next;
+    unsigned refs;
+
+    uint32_t crc;  // Of the whole file
+    size_t size;
+
+    const uint8_t *data;
+    int mapped; // data is an mmap() rather than a malloc()
+
+    iNES_t ines;
+    const uint8_t *prg;
+    size_t prg_size;
+    const uint8_t *chr; // NULL for CHR RAM carts
+    size_t chr_size;
+
+    // The CHR ROM decoded for the PPU (see nes_rom_chr_patterns())
+    uint8_t *chr_patterns;
+} NESRomImage_t;
+
+// Returns a reference to the image of path, or NULL if it is not a complete
+// iNES file
+NESRomImage_t *nes_rom_open(const char *path);
+// As above for an iNES file already in memory; the buffer is copied
+NESRomImage_t *nes_rom_open_memory(const void *buf, size_t size);
+void nes_rom_release(NESRomImage_t *rom);
+
+// The CHR ROM as the PPU's decoded patterns (nes_ppu_decode_patterns()), or
+// NULL for CHR RAM carts.  Decoded by the first caller, then shared.
+const uint8_t *nes_rom_chr_patterns(NESRomImage_t *rom);
+
+#endif
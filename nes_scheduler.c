@@ -0,0 +1,133 @@
+#include "nes_scheduler.h"
+#include "log.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#define LOG(...) _LOG(NES, __VA_ARGS__)
+
+static inline int
+event_before(const NESEvent_t *a, const NESEvent_t *b)
+{
+    if(a->cycle != b->cycle)
+        return a->cycle < b->cycle;
+
+    return (int32_t) (a->seq - b->seq) < 0;
+}
+
+static void
+sift_up(NESScheduler_t *sched, unsigned i)
+{
+    NESEvent_t event = sched->events[i];
+
+    while(i > 0)
+    {
+        unsigned parent = (i - 1) / 2;
+        if(! event_before(&event, &sched->events[parent]))
+            break;
+
+        sched->events[i] = sched->events[parent];
+        i = parent;
+    }
+
+    sched->events[i] = event;
+}
+
+static void
+sift_down(NESScheduler_t *sched, unsigned i)
+{
+    NESEvent_t event = sched->events[i];
+
+    for(;;)
+    {
+        unsigned child = 2 * i + 1;
+        if(child >= sched->count)
+            break;
+
+        if(child + 1 < sched->count && event_before(&sched->events[child + 1], &sched->events[child]))
+            child++;
+
+        if(! event_before(&sched->events[child], &event))
+            break;
+
+        sched->events[i] = sched->events[child];
+        i = child;
+    }
+
+    sched->events[i] = event;
+}
+
+static void
+remove_at(NESScheduler_t *sched, unsigned i)
+{
+    sched->count--;
+    if(i == sched->count)
+        return;
+
+    sched->events[i] = sched->events[sched->count];
+    sift_down(sched, i);
+    sift_up(sched, i);
+}
+
+void
+nes_sched_init(NESScheduler_t *sched)
+{
+    memset(sched, 0, sizeof(*sched));
+}
+
+void
+nes_sched_add(NESScheduler_t *sched, int64_t cycle, NESEventFunc_t func, void *ptr)
+{
+    NESEvent_t *event;
+
+    ASSERT(sched->count < NES_MAX_EVENTS, "Event queue full\n");
+
+    event = &sched->events[sched->count];
+    event->cycle = cycle;
+    event->seq = sched->seq++;
+    event->func = func;
+    event->ptr = ptr;
+
+    LOG("Scheduled event %p @ cycle %" PRId64 "\n", event->ptr, cycle);
+
+    sift_up(sched, sched->count++);
+}
+
+// Removes every pending event matching func/ptr
+void
+nes_sched_cancel(NESScheduler_t *sched, NESEventFunc_t func, void *ptr)
+{
+    unsigned i = 0;
+
+    while(i < sched->count)
+    {
+        if(sched->events[i].func == func && sched->events[i].ptr == ptr)
+        {
+            remove_at(sched, i);
+            i = 0; // The heap was reshuffled
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+// Fires every event due at or before now, in order; returns the number fired
+int
+nes_sched_run(NESScheduler_t *sched, int64_t now)
+{
+    int fired = 0;
+
+    while(sched->count && sched->events[0].cycle <= now)
+    {
+        NESEvent_t event = sched->events[0];
+
+        // Pop before calling so that the handler may reschedule itself
+        remove_at(sched, 0);
+        event.func(event.ptr);
+        fired++;
+    }
+
+    return fired;
+}
@@ -0,0 +1,41 @@
+#ifndef __nes_scheduler_h__
+#define __nes_scheduler_h__
+
+#include <stdint.h>
+
+#define NES_MAX_EVENTS 16
+
+#define NES_NO_EVENT INT64_MAX
+
+typedef void (*NESEventFunc_t)(void *p);
+
+typedef struct
+{
+    int64_t cycle;    // CPU cycle at (or after) which the event fires
+    uint32_t seq;     // Keeps events due on the same cycle in the order they were added
+    NESEventFunc_t func;
+    void *ptr;
+} NESEvent_t;
+
+// Timed events against the CPU cycle counter, kept as a binary min-heap.  The
+// CPU runs to the next event without checking for it per instruction; an event
+// fires after the first instruction that completes at or past its cycle.
+typedef struct
+{
+    NESEvent_t events[NES_MAX_EVENTS];
+    unsigned count;
+    uint32_t seq;
+} NESScheduler_t;
+
+void nes_sched_init(NESScheduler_t *sched);
+void nes_sched_add(NESScheduler_t *sched, int64_t cycle, NESEventFunc_t func, void *ptr);
+void nes_sched_cancel(NESScheduler_t *sched, NESEventFunc_t func, void *ptr);
+int  nes_sched_run(NESScheduler_t *sched, int64_t now);
+
+static inline int64_t
+nes_sched_next(const NESScheduler_t *sched)
+{
+    return sched->count ? sched->events[0].cycle : NES_NO_EVENT;
+}
+
+#endif
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "nestalgia.h"
+#include "nes.h"
+#include "nes_rom.h"
+#include "input.h"
+#include "log.h"
+
+struct Nestalgia
+{
+    NES_t nes;
+
+    int loaded;
+    const char *error;
+};
+
+Nestalgia_t *
+nestalgia_create(void)
+{
+    Nestalgia_t *emu = calloc(1, sizeof(*emu));
+    NES_t *nes;
+
+    ASSERT(emu, "Could not allocate emulator\n");
+
+    nes = &emu->nes;
+    nes->options.headless = 1;
+    nes->options.title = "libnestalgia";
+    nes->ppu.options.no_vsync = 1;
+    nes->ppu.options.trigger_hack = 1; // As the frontend: for Double Dragon
+    nes->cpu.options.block_cache = 1;
+
+    n6502_init(&nes->cpu);
+    nes_init(nes, 1);
+
+    return emu;
+}
+
+void
+nestalgia_destroy(Nestalgia_t *emu)
+{
+    if(! emu)
+        return;
+
+    nes_quit(&emu->nes);
+    free(emu);
+}
+
+// --------------------------------------------------------------------------------
+
+static int
+nestalgia_load(Nestalgia_t *emu, NESRomImage_t *rom)
+{
+    NES_t *nes = &emu->nes;
+
+    if(! rom)
+    {
+        emu->error = "not a complete iNES image";
+        return -1;
+    }
+
+    emu->error = nes_rom_unsupported(rom);
+    if(emu->error)
+    {
+        nes_rom_release(rom);
+        return -1;
+    }
+
+    if(emu->loaded)
+        nes_unload(nes);
+
+    // No path: SRAM is the owner's to keep
+    nes_load_rom_image(nes, rom, NULL);
+    nes_hard_reset(nes);
+    nes_soft_reset(nes);
+
+    emu->loaded = 1;
+
+    return 0;
+}
+
+int
+nestalgia_load_rom(Nestalgia_t *emu, const char *path)
+{
+    return nestalgia_load(emu, nes_rom_open(path));
+}
+
+int
+nestalgia_load_rom_memory(Nestalgia_t *emu, const void *data, size_t size)
+{
+    return nestalgia_load(emu, nes_rom_open_memory(data, size));
+}
+
+const char *
+nestalgia_error(const Nestalgia_t *emu)
+{
+    return emu->error;
+}
+
+void
+nestalgia_reset(Nestalgia_t *emu)
+{
+    if(emu->loaded)
+        nes_soft_reset(&emu->nes);
+}
+
+// --------------------------------------------------------------------------------
+
+void
+nestalgia_set_joypad(Nestalgia_t *emu, unsigned port, unsigned buttons)
+{
+    if(port >= 2)
+        return;
+
+    // NESTALGIA_BUTTON_* are in the NES shift order too
+    input_set_joypad(&emu->nes, port, buttons);
+}
+
+void
+nestalgia_step_frame(Nestalgia_t *emu)
+{
+    if(emu->loaded)
+        nes_run_frame(&emu->nes);
+}
+
+uint64_t
+nestalgia_frame_count(const Nestalgia_t *emu)
+{
+    return emu->nes.ppu.frame_count;
+}
+
+// --------------------------------------------------------------------------------
+
+void
+nestalgia_frame_rgb(const Nestalgia_t *emu, uint32_t *pixels)
+{
+    nes_ppu_frame_rgb(&emu->nes.ppu, pixels);
+}
+
+size_t
+nestalgia_audio(Nestalgia_t *emu, float *samples, size_t max_samples)
+{
+    AudioBuffer_t *ab = &emu->nes.apu.audio_buffer;
+    size_t num_samples = 0;
+
+    while(num_samples < max_samples && ab->rd_index != ab->wr_index)
+    {
+        samples[num_samples++] = ab->buffer[ab->rd_index];
+        ab->rd_index = (ab->rd_index + 1) % AUDIO_BUFFER_SIZE;
+    }
+
+    return num_samples;
+}
+
+uint8_t *
+nestalgia_ram(Nestalgia_t *emu)
+{
+    return emu->nes.state.ram;
+}
+
+uint8_t *
+nestalgia_sram(Nestalgia_t *emu)
+{
+    return emu->nes.sram;
+}
@@ -0,0 +1,82 @@
+#ifndef __nestalgia_h__
+#define __nestalgia_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// libnestalgia: the emulator core without SDL, a display or main.c
+//
+// Each Nestalgia_t is an independent NES that only runs when stepped.  Nothing
+// is displayed, played or read from the keyboard: the owner sets the joypads,
+// steps a frame, then takes the picture and sound.  Instances share read-only
+// ROM images (nes_rom.h) but nothing else, so different threads may run
+// different instances.  No files are written; battery-backed SRAM is reached
+// through nestalgia_sram().
+//
+//     Nestalgia_t *emu = nestalgia_create();
+//     if(nestalgia_load_rom(emu, "smb.nes") == 0)
+//     {
+//         for(;;)
+//         {
+//             nestalgia_set_joypad(emu, 0, NESTALGIA_BUTTON_RIGHT);
+//             nestalgia_step_frame(emu);
+//             nestalgia_frame_rgb(emu, pixels);
+//             num_samples = nestalgia_audio(emu, samples, 1024);
+//         }
+//     }
+//     nestalgia_destroy(emu);
+
+#define NESTALGIA_WIDTH       256
+#define NESTALGIA_HEIGHT      240
+#define NESTALGIA_SAMPLE_RATE 44100 // Mono float samples, 0 to 1 (the APU mixer output)
+#define NESTALGIA_RAM_SIZE    0x0800
+#define NESTALGIA_SRAM_SIZE   0x2000
+
+// Joypad buttons, in the order the NES shifts them out
+#define NESTALGIA_BUTTON_A      (1 << 0)
+#define NESTALGIA_BUTTON_B      (1 << 1)
+#define NESTALGIA_BUTTON_SELECT (1 << 2)
+#define NESTALGIA_BUTTON_START  (1 << 3)
+#define NESTALGIA_BUTTON_UP     (1 << 4)
+#define NESTALGIA_BUTTON_DOWN   (1 << 5)
+#define NESTALGIA_BUTTON_LEFT   (1 << 6)
+#define NESTALGIA_BUTTON_RIGHT  (1 << 7)
+
+typedef struct Nestalgia Nestalgia_t;
+
+// Never NULL: like the rest of the core, it aborts if out of memory
+Nestalgia_t *nestalgia_create(void);
+void nestalgia_destroy(Nestalgia_t *emu);
+
+// Load a cartridge in place of the current one and reset.  Return 0, or -1 if
+// the file is not a complete iNES image or uses a mapper or feature the core
+// does not support (see nestalgia_error()).  The memory buffer is copied.
+int nestalgia_load_rom(Nestalgia_t *emu, const char *path);
+int nestalgia_load_rom_memory(Nestalgia_t *emu, const void *data, size_t size);
+const char *nestalgia_error(const Nestalgia_t *emu);
+
+// Press the reset button
+void nestalgia_reset(Nestalgia_t *emu);
+
+// NESTALGIA_BUTTON_* held on joypad port 0 or 1, from the next frame on.  Any
+// other port is ignored.
+void nestalgia_set_joypad(Nestalgia_t *emu, unsigned port, unsigned buttons);
+
+// Run one video frame (1/60s of NES time) as fast as the host allows
+void nestalgia_step_frame(Nestalgia_t *emu);
+uint64_t nestalgia_frame_count(const Nestalgia_t *emu);
+
+// The last frame, NESTALGIA_WIDTH x NESTALGIA_HEIGHT pixels as 0x00RRGGBB
+void nestalgia_frame_rgb(const Nestalgia_t *emu, uint32_t *pixels);
+
+// Copy up to max_samples of the audio produced since the last call (about
+// 735 a frame) and return how many there were.  Only the newest 11024
+// samples (just under a quarter of a second) are kept; older ones are
+// dropped if the caller falls behind.
+size_t nestalgia_audio(Nestalgia_t *emu, float *samples, size_t max_samples);
+
+// The 2K of work RAM at $0000 and the cartridge SRAM at $6000, live
+uint8_t *nestalgia_ram(Nestalgia_t *emu);
+uint8_t *nestalgia_sram(Nestalgia_t *emu);
+
+#endif
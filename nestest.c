@@ -0,0 +1,214 @@
+#include "nestest.h"
+#include "n6502_trace.h"
+#include "log.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+// nestest runs in automation mode from here, and leaves its result codes in
+// $02/$03 (00 means every test passed)
+#define NESTEST_START_PC   0xc000
+#define NESTEST_RESULT     0x02
+
+// Roughly 26K cycles of code, so it finishes within the first frame
+#define NESTEST_MAX_FRAMES 10
+
+// Golden lines shown before a divergence
+#define NESTEST_CONTEXT    8
+
+typedef struct
+{
+    const char *text; // The full golden line
+    uint16_t pc;
+    uint8_t  A, X, Y, P, S;
+    int      dot, scanline;
+} NESTestLine_t;
+
+typedef struct
+{
+    NES_t *nes;
+
+    char *log;
+    NESTestLine_t *lines;
+    uint32_t num_lines;
+
+    uint32_t checked;
+    int failed;
+} NESTest_t;
+
+// --------------------------------------------------------------------------------
+
+static uint32_t
+nestest_count_lines(const char *text)
+{
+    uint32_t n = 0;
+
+    for(; *text; text++)
+    {
+        if(*text == '\n')
+            n++;
+    }
+
+    return n;
+}
+
+static void
+nestest_load_log(NESTest_t *test, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    long size;
+    char *line;
+    char *next;
+
+    ASSERT(fp, "Could not open '%s'\n", path);
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    test->log = malloc(size + 1);
+    ASSERT(test->log, "Failed to allocate %ld bytes\n", size);
+    ASSERT(fread(test->log, 1, size, fp) == (size_t) size, "Could not read '%s'\n", path);
+    test->log[size] = 0;
+    fclose(fp);
+
+    test->lines = malloc((nestest_count_lines(test->log) + 1) * sizeof(NESTestLine_t));
+    ASSERT(test->lines, "Failed to allocate the nestest lines\n");
+
+    for(line = test->log; *line; line = next)
+    {
+        NESTestLine_t *l = &test->lines[test->num_lines];
+        const char *regs;
+        unsigned pc, a, x, y, p, s;
+
+        next = line + strcspn(line, "\r\n");
+        if(*next)
+        {
+            *next++ = 0;
+            next += strspn(next, "\r\n");
+        }
+
+        if(*line == 0)
+            continue;
+
+        regs = strstr(line, "A:");
+        ASSERT(regs && sscanf(line, "%4x", &pc) == 1 &&
+               sscanf(regs, "A:%x X:%x Y:%x P:%x SP:%x CYC:%d SL:%d",
+                      &a, &x, &y, &p, &s, &l->dot, &l->scanline) == 7,
+               "Bad nestest line %u: %s\n", test->num_lines + 1, line);
+
+        l->text = line;
+        l->pc = pc;
+        l->A = a;
+        l->X = x;
+        l->Y = y;
+        l->P = p;
+        l->S = s;
+        test->num_lines++;
+    }
+}
+
+static int
+nestest_matches(const NESTestLine_t *l, const N6502TraceRecord_t *rec)
+{
+    return l->pc == rec->pc &&
+           l->A == rec->A && l->X == rec->X && l->Y == rec->Y &&
+           l->P == rec->P && l->S == rec->S &&
+           l->dot == rec->dot && l->scanline == rec->scanline;
+}
+
+// Trace sink: checks each instruction as it comes out of the CPU trace ring
+static void
+nestest_check(void *ptr, const N6502TraceRecord_t *records, uint32_t count)
+{
+    NESTest_t *test = (NESTest_t *) ptr;
+    uint32_t i;
+
+    for(i = 0; i < count && ! test->failed && test->checked < test->num_lines; i++)
+    {
+        const NESTestLine_t *l = &test->lines[test->checked];
+        char line[N6502_TRACE_LINE_SIZE];
+        uint32_t j;
+
+        if(nestest_matches(l, &records[i]))
+        {
+            // Nothing past the end of the log is meaningful (the final RTS
+            // returns into whatever is on the stack)
+            if(++test->checked == test->num_lines)
+                test->nes->cpu.stopped = 1;
+
+            continue;
+        }
+
+        NOTIFY("nestest: diverged at line %u\n", test->checked + 1);
+
+        j = (test->checked > NESTEST_CONTEXT) ? test->checked - NESTEST_CONTEXT : 0;
+        for(; j < test->checked; j++)
+        {
+            NOTIFY("  %5u  %s\n", j + 1, test->lines[j].text);
+        }
+
+        n6502_trace_format(&records[i], line, sizeof(line));
+        NOTIFY("expect %5u  %s\n", test->checked + 1, l->text);
+        NOTIFY("actual %5u  %s\n", test->checked + 1, line);
+
+        test->failed = 1;
+        test->nes->cpu.stopped = 1;
+    }
+}
+
+int
+nestest_run(NES_t *nes, const char *rom_path, const char *log_path)
+{
+    NESTest_t test;
+    unsigned frame_num;
+
+    memset(&test, 0, sizeof(test));
+    test.nes = nes;
+    nestest_load_log(&test, log_path);
+
+    nes_init(nes, 1);
+    nes_load_rom(nes, rom_path);
+    nes_hard_reset(nes);
+    nes_soft_reset(nes);
+    nes->cpu.regs.PC = nes->options.reset_pc ? nes->options.reset_pc : NESTEST_START_PC;
+
+    // Check each instruction as it is about to run, so that the CPU stops at the
+    // first divergence
+    n6502_trace_attach(&nes->cpu, 1, nestest_check, &test);
+    n6502_select_core(&nes->cpu);
+
+    for(frame_num = 0; frame_num < NESTEST_MAX_FRAMES; frame_num++)
+    {
+        if(test.failed || test.checked == test.num_lines)
+            break;
+
+        nes_run_frame(nes);
+    }
+
+    n6502_trace_close(&nes->cpu);
+
+    if(! test.failed && test.checked < test.num_lines)
+    {
+        NOTIFY("nestest: only reached line %u of %u in %u frames\n",
+               test.checked, test.num_lines, NESTEST_MAX_FRAMES);
+        test.failed = 1;
+    }
+
+    if(! test.failed)
+    {
+        NOTIFY("nestest PASSED: %u instructions (result %02X %02X)\n", test.num_lines,
+               nes->state.ram[NESTEST_RESULT], nes->state.ram[NESTEST_RESULT + 1]);
+    }
+    else
+    {
+        NOTIFY("nestest FAILED\n");
+    }
+
+    free(test.lines);
+    free(test.log);
+
+    return test.failed;
+}
@@ -0,0 +1,12 @@
+#ifndef __NESTEST_H__
+#define __NESTEST_H__
+
+#include "nes.h"
+
+#define NESTEST_DEFAULT_LOG "test/nestest/nestest.log"
+
+// Runs the nestest ROM in automation mode (from $C000) and checks every
+// instruction against a golden nestest.log; returns 0 if they all match
+int nestest_run(NES_t *nes, const char *rom_path, const char *log_path);
+
+#endif
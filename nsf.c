@@ -147,7 +147,7 @@ nsf_init(NSF_t *nsf, NES_t *nes, int song)
     LOG("NSF Init Song %d\n", song);
     ASSERT(song >= 1 && song <= nsf->Total_songs, "Bad song: %d", song);
 
-    cpu->regs.P.word = 0x04;
+    n6502_set_p(&cpu->regs, 0x04);
 
     cpu->regs.A = song - 1;
     cpu->regs.X = 0; // FIXME: NTSC
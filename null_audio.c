@@ -0,0 +1,31 @@
+#include "audio.h"
+#include "audio_buffer.h"
+
+// No audio device: the APU's samples stay in its AudioBuffer_t, where the
+// owner may read them (see nestalgia_audio()); once the ring is full the
+// oldest are dropped.  Nothing ever waits on the buffer, so the emulator is
+// never held back.  The headless platform always uses it; the others when
+// run with --headless.
+
+static void
+null_audio_open(AudioBuffer_t *audio_buffer)
+{
+    audio_buffer_init(audio_buffer);
+}
+
+static void
+null_audio_pause(int paused)
+{
+}
+
+static void
+null_audio_close(void)
+{
+}
+
+const AudioDescriptor_t NULL_AUDIO =
+{
+    null_audio_open,
+    null_audio_pause,
+    null_audio_close
+};
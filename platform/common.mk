@@ -44,7 +44,35 @@ DEPS += $(HEADERS)
 
 OUTPUT := $(BUILD_DIR)/$(NAME)
 
-all : TAGS $(OUTPUT) $(LOCAL_DIR)
+# Host tools: no SDL, only the sources they need
+TRACEDUMP := $(BUILD_DIR)/n6502_tracedump
+TRACEDUMP_OBJECTS := $(patsubst %.c,$(BUILD_DIR)/%.o,tools/n6502_tracedump.c n6502_trace.c)
+RECOMPILE := $(BUILD_DIR)/n6502_recompile
+RECOMPILE_OBJECTS := $(patsubst %.c,$(BUILD_DIR)/%.o,tools/n6502_recompile.c common/common.c)
+
+# libnestalgia (nestalgia.h): the core on the headless platform, without SDL,
+# the GUI or main.c, for embedding
+LIB_BUILD_DIR   := $(BUILD_DIR)/lib
+LIB_SOURCES     := $(filter-out ./main.c ./nes_gui.c ./nes_rom_chooser.c, $(wildcard $(addsuffix /*.c, . common mapper c64)))
+LIB_SOURCES     += $(wildcard platform/headless/*.c)
+LIB_OBJECTS     := $(patsubst %.c,$(LIB_BUILD_DIR)/%.o,$(LIB_SOURCES))
+LIB_CFLAGS      := $(filter-out $(C_INCDIRS), $(CFLAGS)) $(addprefix -I, $(COMMON_DIRS) platform/headless) -DHEADLESS -fPIC
+LIB_LDFLAGS     := -lpthread -ldl
+LIBNESTALGIA    := $(BUILD_DIR)/libnestalgia.a
+LIBNESTALGIA_SO := $(BUILD_DIR)/libnestalgia.so
+
+# The emulator on the same headless platform: no SDL, display or audio device,
+# for servers and test farms (the SDL build does the same with --headless)
+HEADLESS         := $(BUILD_DIR)/$(NAME)-headless
+HEADLESS_OBJECTS := $(LIB_BUILD_DIR)/main.o $(LIB_OBJECTS)
+
+DEPS += $(wildcard platform/headless/*.h)
+
+all : TAGS $(OUTPUT) $(TRACEDUMP) $(RECOMPILE) $(LOCAL_DIR)
+
+lib : $(LIBNESTALGIA) $(LIBNESTALGIA_SO)
+
+headless : $(HEADLESS)
 
 $(shell mkdir -p $(BUILD_DIR))
 
@@ -53,6 +81,11 @@ $(BUILD_DIR)/%.o : %.c $(DEPS)
 	$(info [ CC ] $@)
 	$(QUIET) $(CC) $(CFLAGS) -c $< -o $@
 
+$(LIB_BUILD_DIR)/%.o : %.c $(DEPS)
+	@mkdir -p $(dir $@)
+	$(info [ CC ] $@)
+	$(QUIET) $(CC) $(LIB_CFLAGS) -c $< -o $@
+
 $(BUILD_DIR)/%.o : %.rc $(DEPS)
 	@mkdir -p $(dir $@)
 	$(info [ RC ] $@)
@@ -62,6 +95,26 @@ $(OUTPUT) : $(DEPS) $(OBJECTS)
 	$(info [ LD ] $@)
 	$(QUIET) $(CC) $(LDFLAGS) -lSDLmain $(OBJECTS) -o $@
 
+$(LIBNESTALGIA) : $(DEPS) $(LIB_OBJECTS)
+	$(info [ AR ] $@)
+	$(QUIET) $(AR) rcs $@ $(LIB_OBJECTS)
+
+$(LIBNESTALGIA_SO) : $(DEPS) $(LIB_OBJECTS)
+	$(info [ LD ] $@)
+	$(QUIET) $(CC) -shared $(LIB_OBJECTS) $(LIB_LDFLAGS) -o $@
+
+$(HEADLESS) : $(DEPS) $(HEADLESS_OBJECTS)
+	$(info [ LD ] $@)
+	$(QUIET) $(CC) -rdynamic $(HEADLESS_OBJECTS) $(LIB_LDFLAGS) -o $@
+
+$(TRACEDUMP) : $(DEPS) $(TRACEDUMP_OBJECTS)
+	$(info [ LD ] $@)
+	$(QUIET) $(CC) $(TRACEDUMP_OBJECTS) -o $@
+
+$(RECOMPILE) : $(DEPS) $(RECOMPILE_OBJECTS)
+	$(info [ LD ] $@)
+	$(QUIET) $(CC) $(RECOMPILE_OBJECTS) -o $@
+
 $(LOCAL_DIR) : $(BUILD_DIR)
 	$(QUIET) ln -sf $(PLATFORM) $(LOCAL_DIR)
 
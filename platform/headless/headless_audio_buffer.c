@@ -0,0 +1,41 @@
+#include <stddef.h>
+
+#include "audio_buffer.h"
+
+// Written and read by the thread running the NES, so there is nothing to lock
+// or wait for
+
+void
+audio_buffer_init(AudioBuffer_t *buffer)
+{
+    buffer->lock = NULL;
+    buffer->cond = NULL;
+
+    buffer->rd_index = 0;
+    buffer->wr_index = 0;
+}
+
+void
+audio_buffer_destroy(AudioBuffer_t *buffer)
+{
+}
+
+void
+audio_buffer_lock(AudioBuffer_t *buffer)
+{
+}
+
+void
+audio_buffer_unlock(AudioBuffer_t *buffer)
+{
+}
+
+void
+audio_buffer_signal(AudioBuffer_t *buffer)
+{
+}
+
+void
+audio_buffer_wait(AudioBuffer_t *buffer)
+{
+}
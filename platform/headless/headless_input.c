@@ -0,0 +1,31 @@
+#include "nes.h"
+#include "input.h"
+
+#include <time.h>
+
+// No events: nes->input is set by the owner (see nestalgia_set_joypad()), or
+// by an --input script
+void
+input_update(NES_t *nes)
+{
+    input_script_update(nes);
+}
+
+unsigned
+input_time_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void
+input_delay(unsigned delay_ms)
+{
+    struct timespec delay;
+
+    delay.tv_sec = delay_ms / 1000;
+    delay.tv_nsec = (delay_ms % 1000) * 1000000;
+    nanosleep(&delay, NULL);
+}
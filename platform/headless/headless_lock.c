@@ -0,0 +1,39 @@
+#include "cond_lock.h"
+
+void
+cond_init(CondLock_t *lock)
+{
+    pthread_cond_init(&lock->cond, NULL);
+    pthread_mutex_init(&lock->mutex, NULL);
+}
+
+void
+cond_destroy(CondLock_t *lock)
+{
+    pthread_cond_destroy(&lock->cond);
+    pthread_mutex_destroy(&lock->mutex);
+}
+
+void
+cond_lock(CondLock_t *lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+}
+
+void
+cond_unlock(CondLock_t *lock)
+{
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+void
+cond_signal(CondLock_t *lock)
+{
+    pthread_cond_signal(&lock->cond);
+}
+
+void
+cond_wait(CondLock_t *lock)
+{
+    pthread_cond_wait(&lock->cond, &lock->mutex);
+}
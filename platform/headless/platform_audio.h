@@ -0,0 +1,8 @@
+#ifndef __platform_audio_h__
+#define __platform_audio_h__
+
+#include "audio.h"
+
+#define AUDIO_DESCRIPTOR  NULL_AUDIO
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef __platform_cond_lock_h__
+#define __platform_cond_lock_h__
+
+#include <pthread.h>
+
+typedef struct
+{
+    int init;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    void *data;
+} CondLock_t;
+
+#endif
@@ -8,7 +8,8 @@ CC       := gcc
 #CC       := clang
 #CFLAGS   := -g -DBPP32 $(OPT_FLAGS)
 CFLAGS   := -g $(OPT_FLAGS)
-LDFLAGS  := -lreadline -lSDL
+# -rdynamic: translated PRG ROM modules (n6502_aot.c) link against the binary
+LDFLAGS  := -rdynamic -lreadline -lSDL -ldl -lpthread
 SOURCES  := $(wildcard platform/sdl/*.c)
 INC_DIRS := platform/sdl
 DEPS     := platform/$(PLATFORM).mk
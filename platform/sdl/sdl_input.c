@@ -1,5 +1,6 @@
 #include "nes.h"
 #include "input.h"
+#include "nes_gui.h"
 
 #include <SDL/SDL.h>
 
@@ -18,7 +19,7 @@ static void
 set_fullscreen(NES_t *nes, int fullscreen)
 {
     nes_pause(nes, 1);
-    display_fullscreen(&nes->gui.display, fullscreen);
+    display_fullscreen(&nes->gui->display, fullscreen);
     nes_pause(nes, 0);
 }
 
@@ -41,7 +42,7 @@ input_process_global_key(NES_t *nes, int key, SDLMod mod, int keypressed)
         if(ctrl)
         {
             // First check if the menubar can handle Ctrl+xxx keys
-            if(menubar_key_accelerator(&nes->gui.display.menubar, key))
+            if(nes->gui && menubar_key_accelerator(&nes->gui->display.menubar, key))
             {
                 return 1;
             }
@@ -71,11 +72,15 @@ input_process_global_key(NES_t *nes, int key, SDLMod mod, int keypressed)
                 return 1;
 
             case SDLK_BACKQUOTE:
-                set_fullscreen(nes, ! nes->gui.display.fullscreen);
-                return 1;
+                if(nes->gui)
+                {
+                    set_fullscreen(nes, ! nes->gui->display.fullscreen);
+                    return 1;
+                }
+                break;
 
             case SDLK_TAB:
-                if(alt)
+                if(alt && nes->gui)
                 {
                     set_fullscreen(nes, 0);
                     return 1;
@@ -102,12 +107,12 @@ static void
 input_key(NES_t *nes, int key, SDLMod mod, int keypressed)
 {
     NESPPU_t *ppu = &nes->ppu;
-    Window_t *top_window = nes->gui.display.top_window;
+    Window_t *top_window = nes->gui ? nes->gui->display.top_window : NULL;
 
     if(input_process_global_key(nes, key, mod, keypressed))
         return;
 
-    if(top_window == &ppu->gui.nes_window)
+    if(top_window && top_window == &nes->gui->ppu.nes_window)
     {
         switch(key)
         {
@@ -225,7 +230,8 @@ input_update(NES_t *nes)
     SDL_Event event;
     NESPPU_t *ppu = &nes->ppu;
 
-    while(SDL_PollEvent(&event))
+    // --headless never opens a window, so there are no events to poll
+    while(nes->gui && SDL_PollEvent(&event))
     {
         switch(event.type)
         {
@@ -267,75 +273,9 @@ input_update(NES_t *nes)
             }
         }
     }
-}
 
-void
-input_latch_joypads(NES_t *nes)
-{
-    uint8_t *pad1 = &nes->joypad_latch1;
-    uint8_t *pad2 = &nes->joypad_latch2;
-    uint8_t *mousedown = &nes->paddle_buttondown;
-
-    *pad1 =
-        ((nes->input.key[0].right & nes->input.key[0].mask.right) << 7) |
-        ((nes->input.key[0].left  & nes->input.key[0].mask.left ) << 6) |
-        ((nes->input.key[0].down  & nes->input.key[0].mask.down ) << 5) |
-        ((nes->input.key[0].up    & nes->input.key[0].mask.up   ) << 4) |
-        (nes->input.key[0].start  << 3) |
-        (nes->input.key[0].select << 2) |
-        (nes->input.key[0].b      << 1) |
-        (nes->input.key[0].a      << 0);
-
-    *pad2 =
-        (nes->input.key[1].right  << 7) |
-        (nes->input.key[1].left   << 6) |
-        (nes->input.key[1].down   << 5) |
-        (nes->input.key[1].up     << 4) |
-        (nes->input.key[1].start  << 3) |
-        (nes->input.key[1].select << 2) |
-        (nes->input.key[1].b      << 1) |
-        (nes->input.key[1].a      << 0);
-
-#if 1
-    if(nes->ppu.options.enable_paddle)
-    {
-        /*
-        Paddle support
-
-        The paddle position is read via D1 of $4017; the read data is inverted (0=1, 1=0). The first value read is
-        the MSB, and the 8th value read is (obviously) the LSB. Valid value ranges are 98 to 242, where 98 represents
-        the paddle being turned completely counter-clockwise.
-
-        For example, if %01101011 is read, the value would be NOT'd, making %10010100 which is 146. The paddle also
-        contains one button, which is read via D1 of $4016. A value of 1 specifies that the button is being pressed.
-        */
-
-        static const int NES_PADDLE_MAX = 242;
-        static const int NES_PADDLE_MIN = 98;
-
-        static const int NES_PADDLE_RANGE = NES_PADDLE_MAX - NES_PADDLE_MIN + 1;
-
-#define NES_WINDOW_WIDTH 512
-        float pos = (float) (nes->input.mousex * 3/2 - 30) / (NES_WINDOW_WIDTH * 3/4);
-        if(pos > 1.0) pos = 1.0;
-        if(pos < 0) pos = 0.0;
-
-        unsigned v = (unsigned) (pos * NES_PADDLE_RANGE) + NES_PADDLE_MIN;
-        // Bit reversal
-        v = ((v & 0x01) << 7) |
-            ((v & 0x02) << 5) |
-            ((v & 0x04) << 3) |
-            ((v & 0x08) << 1) |
-            ((v & 0x10) >> 1) |
-            ((v & 0x20) >> 3) |
-            ((v & 0x40) >> 5) |
-            ((v & 0x80) >> 7);
-        *pad2 = ~v;
-        *mousedown = nes->input.mousedown;
-    }
-#else
-    (void) mousedown;
-#endif
+    // A script overrides the keyboard on the frames it changes the buttons
+    input_script_update(nes);
 }
 
 unsigned
@@ -0,0 +1,223 @@
+/**
+ * Builds dma_stop.nes: sprite DMA part way through a basic block must not let
+ * the rest of the block run past the next event.
+ *
+ * Each of TRIALS frames waits for NMI, burns a little more time than the last,
+ * then runs one straight-line block:
+ *
+ *     LDA #0 / STA FLAG / STA CNT / LDA #2 / STA $4014 / INC CNT x 10 / JMP
+ *
+ * The 513 cycles of DMA carry the block past the next VBlank for some of the
+ * trials, and the NMI handler records how far CNT had got.  An exact core takes
+ * the NMI at the first instruction boundary past VBlank, so as the trials slide
+ * VBlank through the INCs every count from 0 to 10 shows up.  A core that only
+ * checks the block's static cycles before entering it finishes the block first
+ * and only ever records 0 or 10.
+ *
+ * The result is reported through the Blargg SRAM protocol (nes --blargg=1).
+ *
+ * Usage: mkdma OUT.nes
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ORG        0xC000
+#define PRG_SIZE   0x4000
+#define CHR_SIZE   0x2000
+
+#define TRIALS     64
+#define NUM_INCS   10
+
+// Zero page
+#define FLAG       0x00 // Set by NMI
+#define CNT        0x01
+#define TRIAL      0x02
+
+#define TABLE      0x0300 // CNT at NMI, per trial
+
+// From NMI to a block that meets the next VBlank about a third of the way in
+#define DELAY_OUTER  22
+#define DELAY_EXTRA  151
+
+static uint8_t prg[PRG_SIZE];
+static unsigned here;
+
+static void
+emit(const uint8_t *bytes, unsigned count)
+{
+    memcpy(&prg[here], bytes, count);
+    here += count;
+}
+
+#define B(...) emit((const uint8_t[]) {__VA_ARGS__}, sizeof((const uint8_t[]) {__VA_ARGS__}))
+
+static uint16_t
+pc(void)
+{
+    return ORG + here;
+}
+
+static void
+branch(uint8_t op, uint16_t target)
+{
+    B(op, (uint8_t) (target - (pc() + 2)));
+}
+
+static void
+jmp(uint16_t target)
+{
+    B(0x4C, target & 0xff, target >> 8);
+}
+
+// X iterations of DEX/BNE
+static void
+delay_x(uint8_t x)
+{
+    uint16_t loop;
+
+    B(0xA2, x);             // LDX #x
+    loop = pc();
+    B(0xCA);                // DEX
+    branch(0xD0, loop);     // BNE
+}
+
+static void
+message(const char *str)
+{
+    unsigned i;
+
+    for(i = 0; i <= strlen(str); i++)
+    {
+        B(0xA9, (uint8_t) str[i]);                                  // LDA #c
+        B(0x8D, (0x6004 + i) & 0xff, (0x6004 + i) >> 8);           // STA $6004+i
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char header[16] = {'N', 'E', 'S', 0x1a, 1, 1, 0, 0};
+    uint16_t reset, nmi, trial, wait, outer, fine, block, wait2, check, skip, pass, fail;
+    uint16_t fix_pass, fix_fail, fix_skip;
+    unsigned i;
+    FILE *fp;
+
+    if(argc != 2)
+    {
+        fprintf(stderr, "Usage: %s OUT.nes\n", argv[0]);
+        return 1;
+    }
+
+    memset(prg, 0xEA, sizeof(prg));
+
+    reset = pc();
+    B(0x78, 0xD8, 0xA2, 0xFF, 0x9A);            // SEI / CLD / LDX #$FF / TXS
+    B(0xA9, 0x00, 0x8D, 0x00, 0x20);            // LDA #0 / STA $2000
+    B(0x8D, 0x01, 0x20);                        // STA $2001: rendering stays off
+    for(i = 0; i < 2; i++)
+    {
+        wait = pc();
+        B(0x2C, 0x02, 0x20);                    // BIT $2002
+        branch(0x10, wait);                     // BPL
+    }
+    B(0xA9, 0x00, 0x85, TRIAL, 0x85, CNT);      // LDA #0 / STA TRIAL / STA CNT
+    B(0xA9, 0x80, 0x8D, 0x00, 0x20);            // LDA #$80 / STA $2000: NMI on
+
+    // Start every trial straight after an NMI
+    trial = pc();
+    B(0xA9, 0x00, 0x85, FLAG);                  // LDA #0 / STA FLAG
+    wait = pc();
+    B(0xA5, FLAG);                              // LDA FLAG
+    branch(0xF0, wait);                         // BEQ
+
+    B(0xA0, DELAY_OUTER);                       // LDY #outer
+    outer = pc();
+    delay_x(0);
+    B(0x88);                                    // DEY
+    branch(0xD0, outer);                        // BNE
+    delay_x(DELAY_EXTRA);
+
+    // Five more cycles a trial
+    B(0xA6, TRIAL, 0xE8);                       // LDX TRIAL / INX
+    fine = pc();
+    B(0xCA);                                    // DEX
+    branch(0xD0, fine);                         // BNE
+
+    block = pc();
+    B(0xA9, 0x00, 0x85, FLAG, 0x85, CNT);       // LDA #0 / STA FLAG / STA CNT
+    B(0xA9, 0x02, 0x8D, 0x14, 0x40);            // LDA #2 / STA $4014
+    for(i = 0; i < NUM_INCS; i++)
+        B(0xE6, CNT);                           // INC CNT
+    jmp(pc() + 3);
+    (void) block;
+
+    wait2 = pc();
+    B(0xA5, FLAG);                              // LDA FLAG
+    branch(0xF0, wait2);                        // BEQ
+
+    B(0xE6, TRIAL, 0xA5, TRIAL, 0xC9, TRIALS);  // INC TRIAL / LDA TRIAL / CMP #TRIALS
+    B(0xF0, 0x03);                              // BEQ +3
+    jmp(trial);
+
+    // Pass if any trial took the NMI part way through the INCs
+    B(0xA9, 0x00, 0x8D, 0x00, 0x20);            // LDA #0 / STA $2000: NMI off
+    B(0xA2, 0x00);                              // LDX #0
+    check = pc();
+    B(0xBD, TABLE & 0xff, TABLE >> 8);          // LDA TABLE,X
+    fix_skip = pc();
+    B(0xF0, 0x00);                              // BEQ skip
+    B(0xC9, NUM_INCS);                          // CMP #NUM_INCS
+    fix_pass = pc();
+    B(0x90, 0x00);                              // BCC pass
+    skip = pc();
+    prg[fix_skip - ORG + 1] = (uint8_t) (skip - (fix_skip + 2));
+    B(0xE8, 0xE0, TRIALS);                      // INX / CPX #TRIALS
+    branch(0xD0, check);                        // BNE
+    fix_fail = pc();
+    jmp(0);
+
+    pass = pc();
+    prg[fix_pass - ORG + 1] = (uint8_t) (pass - (fix_pass + 2));
+    message("DMA block stopped at VBlank");
+    B(0xA9, 0x00, 0x8D, 0x00, 0x60);            // LDA #0 / STA $6000: passed
+    B(0x4C, pc() & 0xff, pc() >> 8);
+
+    fail = pc();
+    prg[fix_fail - ORG + 1] = fail & 0xff;
+    prg[fix_fail - ORG + 2] = fail >> 8;
+    message("DMA block ran past VBlank");
+    B(0xA9, 0x01, 0x8D, 0x00, 0x60);            // LDA #1 / STA $6000: failed
+    B(0x4C, pc() & 0xff, pc() >> 8);
+
+    // Record how far the block had got
+    nmi = pc();
+    B(0x48, 0x8A, 0x48);                        // PHA / TXA / PHA
+    B(0xA6, TRIAL, 0xA5, CNT);                  // LDX TRIAL / LDA CNT
+    B(0x9D, TABLE & 0xff, TABLE >> 8);          // STA TABLE,X
+    B(0xA9, 0x01, 0x85, FLAG);                  // LDA #1 / STA FLAG
+    B(0x68, 0xAA, 0x68, 0x40);                  // PLA / TAX / PLA / RTI
+
+    prg[PRG_SIZE - 6] = nmi & 0xff;
+    prg[PRG_SIZE - 5] = nmi >> 8;
+    prg[PRG_SIZE - 4] = reset & 0xff;
+    prg[PRG_SIZE - 3] = reset >> 8;
+    prg[PRG_SIZE - 2] = nmi & 0xff;
+    prg[PRG_SIZE - 1] = nmi >> 8;
+
+    fp = fopen(argv[1], "wb");
+    if(! fp)
+    {
+        fprintf(stderr, "Could not open %s\n", argv[1]);
+        return 1;
+    }
+
+    fwrite(header, sizeof(header), 1, fp);
+    fwrite(prg, sizeof(prg), 1, fp);
+    for(i = 0; i < CHR_SIZE; i++)
+        fputc(0, fp);
+    fclose(fp);
+
+    return 0;
+}
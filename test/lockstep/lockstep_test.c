@@ -0,0 +1,155 @@
+/**
+ * Lockstep must catch a core that runs past the next event.
+ *
+ * A bare CPU runs "LDA #2 / STA $4014 / INC $00 x 10 / JMP" out of ROM, where
+ * the $4014 write adds 513 cycles as the NES sprite DMA does, with an event
+ * scheduled a little further on each run.  Under lockstep, the block cache core
+ * must match the reference, and a core that ignores event_cycle must not.
+ *
+ * Usage: lockstep_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "n6502.h"
+#include "n6502_lockstep.h"
+
+#define RAM_SIZE     0x0800
+#define ROM_BASE     0x8000
+#define DMA_REG      0x4014
+#define DMA_CYCLES   513
+
+#define NUM_RUNS     400
+
+typedef struct
+{
+    N6502_t cpu;
+    N6502PageTable_t pages;
+    uint8_t ram[RAM_SIZE];
+    uint8_t rom[0x10000 - ROM_BASE];
+} Test_t;
+
+static N6502Core_t real_core;
+
+static uint8_t
+test_read(void *ctx, uint16_t addr)
+{
+    return 0xff;
+}
+
+static void
+test_write(void *ctx, uint16_t addr, uint8_t data)
+{
+    Test_t *test = (Test_t *) ctx;
+
+    if(addr == DMA_REG)
+        test->cpu.cycle += DMA_CYCLES;
+}
+
+// As a block core would without a check after the DMA: runs to the budget
+static void
+overrunning_core(N6502_t *cpu, int64_t last_cycle, int hard_limit,
+                 int64_t max_instructions, int until_stopped)
+{
+    const int64_t event_cycle = cpu->event_cycle;
+
+    cpu->event_cycle = INT64_MAX;
+    real_core(cpu, last_cycle, hard_limit, max_instructions, until_stopped);
+    cpu->event_cycle = event_cycle;
+}
+
+static void
+test_init(Test_t *test)
+{
+    static const uint8_t program[] =
+    {
+        0xA9, 0x02,             // LDA #2
+        0x8D, 0x14, 0x40,       // STA $4014
+        0xE6, 0x00, 0xE6, 0x00, 0xE6, 0x00, 0xE6, 0x00, 0xE6, 0x00, // INC $00 x 10
+        0xE6, 0x00, 0xE6, 0x00, 0xE6, 0x00, 0xE6, 0x00, 0xE6, 0x00,
+        0x4C, 0x00, 0x80,       // JMP $8000
+    };
+    N6502_t *cpu = &test->cpu;
+    unsigned page;
+
+    memset(test, 0, sizeof(*test));
+    memcpy(test->rom, program, sizeof(program));
+    test->rom[0xfffc - ROM_BASE] = ROM_BASE & 0xff;
+    test->rom[0xfffd - ROM_BASE] = ROM_BASE >> 8;
+
+    for(page = 0; page < RAM_SIZE >> 8; page++)
+    {
+        test->pages.read[page] = test->ram + (page << 8);
+        test->pages.write[page] = test->ram + (page << 8);
+    }
+    for(page = ROM_BASE >> 8; page < N6502_NUM_PAGES; page++)
+        test->pages.read[page] = test->rom + ((page << 8) - ROM_BASE);
+
+    cpu->options.block_cache = 1;
+    n6502_init(cpu);
+    cpu->read_mem = test_read;
+    cpu->write_mem = test_write;
+    cpu->mem_ctx = test;
+    cpu->pages = &test->pages;
+    n6502_reset(cpu);
+}
+
+// Runs with the given core (NULL: the one n6502_select_core() picked); returns
+// non-zero if lockstep reported a divergence
+static int
+test_run(N6502Core_t core, unsigned chunk)
+{
+    static Test_t test;
+    N6502_t *cpu = &test.cpu;
+    unsigned i;
+    int diverged;
+
+    test_init(&test);
+    real_core = cpu->core;
+    if(core)
+        cpu->core = core;
+
+    n6502_lockstep_attach(cpu, chunk);
+
+    // Sweep the event across the block
+    for(i = 0; i < NUM_RUNS && ! n6502_lockstep_diverged(cpu); i++)
+    {
+        cpu->event_cycle = cpu->cycle + 20 + i;
+        n6502_run(cpu, 2000, 0);
+    }
+
+    diverged = n6502_lockstep_detach(cpu);
+    n6502_block_cache_destroy(cpu);
+
+    return diverged;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const unsigned CHUNKS[] = {1, N6502_LOCKSTEP_CHUNK, 64};
+    int failed = 0;
+    unsigned i;
+
+    for(i = 0; i < sizeof(CHUNKS) / sizeof(CHUNKS[0]); i++)
+    {
+        if(test_run(NULL, CHUNKS[i]))
+        {
+            printf("FAIL: block cache core diverged (chunk %u)\n", CHUNKS[i]);
+            failed = 1;
+        }
+
+        if(! test_run(overrunning_core, CHUNKS[i]))
+        {
+            printf("FAIL: core that ignores the next event was not caught (chunk %u)\n", CHUNKS[i]);
+            failed = 1;
+        }
+    }
+
+    printf("%s\n", failed ? "Lockstep test FAILED" : "Lockstep test PASSED");
+
+    return failed;
+}
@@ -0,0 +1,144 @@
+/**
+ * Every set of PPU tile kernels must give the same pixels as the scalar one.
+ *
+ * decode() is run over every pair of plane bytes.  draw() is run over random
+ * tiles and backgrounds with each combination of flip_h, priority and is_bg,
+ * for odd and even row counts (the AVX2 kernel draws rows in pairs) and for
+ * both vertical directions.  Each result is compared with the scalar set's,
+ * including the bytes around the tile.
+ *
+ * Usage: tiles_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nes_ppu_tile.h"
+
+#define TILE_SIZE    8
+#define PATTERN_SIZE (TILE_SIZE * TILE_SIZE)
+#define CHR_SIZE     16
+
+// Each pattern row is one pair of plane bytes
+#define NUM_PATTERNS (256 * 256 / TILE_SIZE)
+
+#define MAX_ROWS     16 // 8x16 sprites
+#define STRIDE       40 // Room either side of the tile
+#define DST_OFFSET   16
+#define DST_SIZE     (STRIDE * (MAX_ROWS + 2))
+#define NUM_TRIALS   200
+
+static int
+test_decode(const NESPPUTileKernels_t *ref, const NESPPUTileKernels_t *kernels)
+{
+    static uint8_t chr[NUM_PATTERNS * CHR_SIZE];
+    static uint8_t expected[NUM_PATTERNS * PATTERN_SIZE];
+    static uint8_t actual[NUM_PATTERNS * PATTERN_SIZE];
+    unsigned pair;
+
+    for(pair = 0; pair < 256 * 256; pair++)
+    {
+        uint8_t *pattern = chr + (pair / TILE_SIZE) * CHR_SIZE;
+
+        pattern[pair % TILE_SIZE] = pair & 0xff;
+        pattern[pair % TILE_SIZE + TILE_SIZE] = pair >> 8;
+    }
+
+    ref->decode(expected, chr, NUM_PATTERNS);
+    kernels->decode(actual, chr, NUM_PATTERNS);
+
+    if(memcmp(expected, actual, sizeof(actual)) != 0)
+    {
+        printf("FAIL: %s decode differs from %s\n", kernels->name, ref->name);
+        return 0;
+    }
+
+    return 1;
+}
+
+static int
+test_draw(const NESPPUTileKernels_t *ref, const NESPPUTileKernels_t *kernels)
+{
+    static const unsigned ROWS[] = {1, 2, 7, 8, 15, 16};
+    uint8_t src[MAX_ROWS * TILE_SIZE];
+    uint8_t background[DST_SIZE];
+    uint8_t expected[DST_SIZE];
+    uint8_t actual[DST_SIZE];
+    unsigned trial, flags, r, i;
+
+    for(trial = 0; trial < NUM_TRIALS; trial++)
+    {
+        for(i = 0; i < sizeof(src); i++)
+            src[i] = rand() & 3;
+
+        // About a quarter of the background is transparent
+        for(i = 0; i < sizeof(background); i++)
+            background[i] = (rand() & 3) ? (rand() & 0x1f) | 1 : 0;
+
+        for(flags = 0; flags < 16; flags++)
+        {
+            const int flip_h = flags & 1;
+            const int priority = (flags >> 1) & 1;
+            const int is_bg = (flags >> 2) & 1;
+            const int flip_v = (flags >> 3) & 1;
+            const uint8_t color = rand() & 0x1c;
+
+            for(r = 0; r < sizeof(ROWS) / sizeof(ROWS[0]); r++)
+            {
+                const unsigned rows = ROWS[r];
+                const uint8_t *first = flip_v ? src + (rows - 1) * TILE_SIZE : src;
+                const int src_step = flip_v ? -TILE_SIZE : TILE_SIZE;
+
+                memcpy(expected, background, sizeof(background));
+                memcpy(actual, background, sizeof(background));
+
+                ref->draw(expected + STRIDE + DST_OFFSET, STRIDE, first, src_step, rows,
+                          color, flip_h, priority, is_bg);
+                kernels->draw(actual + STRIDE + DST_OFFSET, STRIDE, first, src_step, rows,
+                              color, flip_h, priority, is_bg);
+
+                if(memcmp(expected, actual, sizeof(actual)) != 0)
+                {
+                    printf("FAIL: %s draw differs from %s "
+                           "(rows %u, src_step %d, flip_h %d, priority %d, is_bg %d)\n",
+                           kernels->name, ref->name, rows, src_step, flip_h, priority, is_bg);
+                    return 0;
+                }
+            }
+        }
+    }
+
+    return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char *SETS[] = {"sse2", "avx2"};
+    const NESPPUTileKernels_t *ref = nes_ppu_tile_kernels("scalar");
+    int failed = 0;
+    unsigned i;
+
+    srand(1);
+
+    for(i = 0; i < sizeof(SETS) / sizeof(SETS[0]); i++)
+    {
+        const NESPPUTileKernels_t *kernels = nes_ppu_tile_kernels(SETS[i]);
+
+        if(! kernels)
+        {
+            printf("%s: not supported, skipped\n", SETS[i]);
+            continue;
+        }
+
+        if(test_decode(ref, kernels) && test_draw(ref, kernels))
+            printf("%s: matches %s\n", kernels->name, ref->name);
+        else
+            failed = 1;
+    }
+
+    printf("%s\n", failed ? "Tile kernel test FAILED" : "Tile kernel test PASSED");
+
+    return failed;
+}
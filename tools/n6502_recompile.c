@@ -0,0 +1,456 @@
+// Translates the PRG ROM of a mapper 0 (NROM) or mapper 2 (UxROM) cartridge
+// into C for the AOT loader (see n6502_aot.h)
+//
+// Usage: n6502_recompile ROM OUT.c
+//
+// Code is found by following control flow from the vectors; anything reached
+// only through jump tables or pushed return addresses is left to the
+// interpreter.  Build the output against the emulator's sources and name it
+// after the PRG CRC that this prints, eg.
+//
+//   cc -O2 -shared -fPIC -I<src> OUT.c -o <dir>/<CRC>.so
+//   nestalgia --aot <dir> ROM
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "n6502.h"
+#include "ines.h"
+#include "common.h"
+
+// Logging vars
+FILE *debug_fp = NULL;
+FILE *info_fp = NULL;
+uint32_t log_zone_mask = 0;
+
+#define IO_BASE        0x2000 // Below is work RAM, always in the page table
+#define PRG_BANK_SIZE  0x4000
+#define PRG_BASE       0x8000
+#define FIXED_BASE     0xc000
+
+// Same limit as the block cache, so that a block still fits in the time left
+// before the next event often enough to be entered
+#define MAX_INSNS      16
+
+#define NO_BANK        (-1) // Reached from the fixed bank: could be any bank
+
+typedef struct
+{
+    const char *name; // Handler
+    AddressingMode_t mode;
+    unsigned cycles;
+    unsigned extra_cycles;
+} RecompileOp_t;
+
+#define GEN_OP(OP, UNDOCUMENTED, MODE, CYCLES, A, NAME, DESC) [OP] = {#NAME, MODE, CYCLES, A},
+static const RecompileOp_t OPS[256] =
+{
+#include "n6502_opcodes.h"
+};
+#undef GEN_OP
+
+typedef struct
+{
+    uint16_t pc;
+    int bank; // Switchable bank the code was reached in (mapper 2), or NO_BANK
+} Target_t;
+
+typedef struct
+{
+    uint16_t pc;
+    uint32_t offset;
+    unsigned count;
+    unsigned cycles_before_last;
+    unsigned cycles_through_last;
+    int32_t branch_pc;
+} Block_t;
+
+static struct
+{
+    unsigned mapper;
+    uint8_t *prg;
+    uint32_t prg_size;
+    unsigned num_banks;
+
+    // One flag per (16K bank, address in the 32K window) pair
+    uint8_t *visited;
+
+    Target_t *work;
+    unsigned num_work;
+    unsigned work_capacity;
+
+    Block_t *blocks;
+    unsigned num_blocks;
+    unsigned blocks_capacity;
+} rc;
+
+static void *
+grow(void *ptr, unsigned *capacity, size_t size)
+{
+    *capacity = *capacity ? *capacity * 2 : 1024;
+    ptr = realloc(ptr, *capacity * size);
+    ASSERT(ptr, "Out of memory\n");
+    return ptr;
+}
+
+// PRG ROM offset of pc as seen from code in bank (mapper 2), or -1 if it is not
+// in ROM
+static int32_t
+rom_offset(uint16_t pc, int bank)
+{
+    if(pc < PRG_BASE)
+        return -1;
+
+    if(rc.mapper == 0)
+        return (pc - PRG_BASE) % rc.prg_size;
+
+    if(pc >= FIXED_BASE)
+        return (rc.num_banks - 1) * PRG_BANK_SIZE + (pc - FIXED_BASE);
+
+    return bank * PRG_BANK_SIZE + (pc - PRG_BASE);
+}
+
+static void
+push(uint16_t pc, int bank)
+{
+    unsigned b;
+
+    if(pc < PRG_BASE)
+        return;
+
+    if(pc >= FIXED_BASE || rc.mapper == 0)
+        bank = 0;
+
+    if(bank == NO_BANK)
+    {
+        // Fixed code calling into the switchable window: try every bank
+        for(b = 0; b < rc.num_banks; b++)
+            push(pc, b);
+
+        return;
+    }
+
+    if(rc.num_work == rc.work_capacity)
+        rc.work = grow(rc.work, &rc.work_capacity, sizeof(Target_t));
+
+    rc.work[rc.num_work].pc = pc;
+    rc.work[rc.num_work].bank = bank;
+    rc.num_work++;
+}
+
+// Successors in the switchable window stay in the same bank, unless the code
+// is in the fixed bank
+static int
+successor_bank(uint16_t pc, int bank)
+{
+    return (rc.mapper == 2 && pc >= FIXED_BASE) ? NO_BANK : bank;
+}
+
+static void
+decode(uint16_t pc, int bank)
+{
+    const int32_t start = rom_offset(pc, bank);
+    const int next_bank = successor_bank(pc, bank);
+    uint32_t key, offset;
+    unsigned cycles = 0;
+    Block_t block;
+
+    if(start < 0)
+        return;
+
+    key = (start / PRG_BANK_SIZE) * 0x8000 + (pc - PRG_BASE);
+    if(rc.visited[key])
+        return;
+    rc.visited[key] = 1;
+
+    memset(&block, 0, sizeof(block));
+    block.pc = pc;
+    block.offset = start;
+    block.branch_pc = -1;
+
+    offset = start;
+
+    while(block.count < MAX_INSNS)
+    {
+        const uint8_t op = rc.prg[offset];
+        const RecompileOp_t *opcode = &OPS[op];
+        const unsigned size = 1 + n6502_operand_bytes(opcode->mode);
+        const uint16_t insn_pc = pc + (offset - start);
+        uint16_t operand = 0;
+
+        if(! opcode->name || op == OP_DEBUG_TRAP)
+            break;
+
+        if((insn_pc & 0xff) + size > N6502_PAGE_SIZE)
+        {
+            // Straddles a page: interpreted, then translated code resumes
+            push(insn_pc + size, next_bank);
+            break;
+        }
+
+        if(size > 1)
+            operand = rc.prg[offset + 1];
+        if(size > 2)
+            operand |= rc.prg[offset + 2] << 8;
+
+        block.cycles_before_last = cycles;
+        block.cycles_through_last = cycles + opcode->cycles;
+        cycles += opcode->cycles + (opcode->extra_cycles ? (opcode->mode == AM_RELATIVE ? 2 : 1) : 0);
+
+        block.count++;
+        offset += size;
+
+        if(opcode->mode == AM_RELATIVE)
+        {
+            block.branch_pc = insn_pc;
+            push(insn_pc + 2 + (int8_t) operand, next_bank);
+            push(insn_pc + 2, next_bank);
+            break;
+        }
+
+        if(op == 0x4C) // JMP
+        {
+            push(operand, next_bank);
+            break;
+        }
+
+        if(op == 0x20) // JSR
+        {
+            push(operand, next_bank);
+            push(insn_pc + 3, next_bank);
+            break;
+        }
+
+        if(op == 0x00) // BRK: RTI comes back past the padding byte
+        {
+            push(insn_pc + 2, next_bank);
+            break;
+        }
+
+        if(op == 0x40 || op == 0x60 || op == 0x6C) // RTI, RTS, JMP ()
+            break;
+
+        if(block.count == MAX_INSNS || (offset - start) + (pc & 0xff) >= N6502_PAGE_SIZE)
+        {
+            push(pc + (offset - start), next_bank);
+            break;
+        }
+    }
+
+    if(block.count == 0)
+        return;
+
+    if(rc.num_blocks == rc.blocks_capacity)
+        rc.blocks = grow(rc.blocks, &rc.blocks_capacity, sizeof(Block_t));
+
+    rc.blocks[rc.num_blocks++] = block;
+}
+
+// Anything that may write outside work RAM, and so reach write_mem: a mapper
+// register (bank switch), or an I/O register that adds cycles (sprite DMA)
+static int
+may_write_bus(const RecompileOp_t *opcode, uint16_t operand)
+{
+    switch(opcode->mode)
+    {
+        case AM_ABS:
+            return operand >= IO_BASE;
+
+        case AM_ABSX:
+        case AM_ABSY:
+        case AM_INDX:
+        case AM_INDY:
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+// Returns the size of the instruction at offset
+static unsigned
+decode_insn(uint32_t offset, const RecompileOp_t **opcode, uint16_t *operand)
+{
+    const unsigned size = 1 + n6502_operand_bytes(OPS[rc.prg[offset]].mode);
+
+    *opcode = &OPS[rc.prg[offset]];
+    *operand = 0;
+
+    if(size > 1)
+        *operand = rc.prg[offset + 1];
+    if(size > 2)
+        *operand |= rc.prg[offset + 2] << 8;
+
+    return size;
+}
+
+// Whether an instruction before the last may write the bus, so the block needs
+// to check for a write part way through
+static int
+block_checks_bus(const Block_t *block)
+{
+    uint32_t offset = block->offset;
+    unsigned i;
+
+    for(i = 0; i + 1 < block->count; i++)
+    {
+        const RecompileOp_t *opcode;
+        uint16_t operand;
+
+        offset += decode_insn(offset, &opcode, &operand);
+
+        if(may_write_bus(opcode, operand))
+            return 1;
+    }
+
+    return 0;
+}
+
+static void
+emit_block(FILE *fp, const Block_t *block)
+{
+    const int checks_bus = block_checks_bus(block);
+    uint32_t offset = block->offset;
+    uint16_t pc = block->pc;
+    unsigned i;
+
+    fprintf(fp, "static unsigned\nblock_%05X_%04X(N6502_t *cpu, N6502Regs_t *regs)\n{\n",
+            block->offset, block->pc);
+
+    if(checks_bus)
+        fprintf(fp, "    const uint32_t bus_writes = cpu->bus_writes;\n\n");
+
+    for(i = 0; i < block->count; i++)
+    {
+        const RecompileOp_t *opcode;
+        uint16_t operand;
+        const unsigned size = decode_insn(offset, &opcode, &operand);
+
+        fprintf(fp, "    regs->PC = 0x%04X; %s(cpu, regs, 0x%04X, 0); cpu->cycle += %u;\n",
+                (uint16_t) (pc + 1), opcode->name, operand, opcode->cycles);
+
+        // Leave through the dispatcher, which re-checks the cycle limits and
+        // the mapping of the next PC
+        if(i + 1 < block->count && may_write_bus(opcode, operand))
+            fprintf(fp, "    if(cpu->bus_writes != bus_writes) return %u;\n", i + 1);
+
+        offset += size;
+        pc += size;
+    }
+
+    fprintf(fp, "    return %u;\n}\n\n", block->count);
+}
+
+static void
+emit(FILE *fp, const char *rom_path, uint32_t crc)
+{
+    unsigned i;
+
+    fprintf(fp, "// Translated from %s (PRG CRC %08X, mapper %u) by n6502_recompile\n\n", rom_path, crc, rc.mapper);
+    fprintf(fp, "#define LOG(...)\n\n");
+    fprintf(fp, "#include \"n6502_ops.h\"\n");
+    fprintf(fp, "#include \"n6502_aot.h\"\n\n");
+
+    for(i = 0; i < rc.num_blocks; i++)
+        emit_block(fp, &rc.blocks[i]);
+
+    fprintf(fp, "static const N6502AotBlockDesc_t BLOCKS[] =\n{\n");
+    for(i = 0; i < rc.num_blocks; i++)
+    {
+        const Block_t *block = &rc.blocks[i];
+
+        fprintf(fp, "    {0x%04X, %u, 0x%05X, %u, %u, %d, block_%05X_%04X},\n",
+                block->pc, block->count, block->offset,
+                block->cycles_before_last, block->cycles_through_last, block->branch_pc,
+                block->offset, block->pc);
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "const N6502AotModule_t n6502_aot_module =\n{\n");
+    fprintf(fp, "    N6502_AOT_VERSION, sizeof(N6502_t), 0x%08X, 0x%X,\n", crc, rc.prg_size);
+    fprintf(fp, "    sizeof(BLOCKS) / sizeof(BLOCKS[0]), BLOCKS,\n};\n");
+}
+
+static uint16_t
+vector(uint16_t addr)
+{
+    const int32_t offset = rom_offset(addr, NO_BANK);
+
+    return rc.prg[offset] | (rc.prg[offset + 1] << 8);
+}
+
+int
+main(int argc, char *argv[])
+{
+    iNES_t ines;
+    uint32_t crc;
+    FILE *fp;
+
+    if(argc != 3)
+    {
+        fprintf(stderr, "Usage: %s ROM OUT.c\n", argv[0]);
+        return 1;
+    }
+
+    fp = fopen(argv[1], "rb");
+    if(fp == NULL || ! ines_load(&ines, fp))
+    {
+        fprintf(stderr, "%s is not an iNES ROM\n", argv[1]);
+        return 1;
+    }
+
+    rc.mapper = ines_mapper_num(&ines);
+    if(rc.mapper != 0 && rc.mapper != 2)
+    {
+        fprintf(stderr, "Mapper %u is not supported (only 0 and 2)\n", rc.mapper);
+        return 1;
+    }
+
+    if(ines.rom_control_byte1 & 4)
+    {
+        fprintf(stderr, "Trainers are not supported\n");
+        return 1;
+    }
+
+    rc.num_banks = ines.num_16k_prg_rom_banks;
+    rc.prg_size = rc.num_banks * PRG_BANK_SIZE;
+    rc.prg = malloc(rc.prg_size);
+    rc.visited = calloc(rc.num_banks, 0x8000);
+    ASSERT(rc.prg && rc.visited, "Out of memory\n");
+
+    if(rc.num_banks == 0 || fread(rc.prg, rc.prg_size, 1, fp) != 1)
+    {
+        fprintf(stderr, "%s: short PRG ROM\n", argv[1]);
+        return 1;
+    }
+    fclose(fp);
+
+    crc = crc32_update(0, rc.prg, rc.prg_size);
+
+    push(vector(NMI_VECTOR), NO_BANK);
+    push(vector(RESET_VECTOR), NO_BANK);
+    push(vector(IRQ_VECTOR), NO_BANK);
+
+    while(rc.num_work > 0)
+    {
+        const Target_t target = rc.work[--rc.num_work];
+        decode(target.pc, target.bank);
+    }
+
+    fp = fopen(argv[2], "w");
+    if(fp == NULL)
+    {
+        fprintf(stderr, "Could not open %s\n", argv[2]);
+        return 1;
+    }
+
+    emit(fp, argv[1], crc);
+    fclose(fp);
+
+    printf("%s: PRG CRC %08X, %u blocks\n", argv[1], crc, rc.num_blocks);
+    printf("Build with: cc -O2 -shared -fPIC -I<src> %s -o <dir>/%08X.so\n", argv[2], crc);
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+// Decodes a binary 6502 trace (nestalgia --trace) into nestest.log format
+//
+// Usage: n6502_tracedump TRACE [> out.log]
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "n6502_trace.h"
+#include "log.h"
+
+// Logging vars
+FILE *debug_fp = NULL;
+FILE *info_fp = NULL;
+uint32_t log_zone_mask = 0;
+
+int
+main(int argc, char *argv[])
+{
+    N6502TraceHeader_t header;
+    N6502TraceRecord_t rec;
+    char line[N6502_TRACE_LINE_SIZE];
+    uint64_t count = 0;
+    FILE *fp;
+
+    if(argc != 2)
+    {
+        fprintf(stderr, "Usage: %s TRACE\n", argv[0]);
+        return 1;
+    }
+
+    fp = fopen(argv[1], "rb");
+    if(fp == NULL)
+    {
+        fprintf(stderr, "Could not open %s\n", argv[1]);
+        return 1;
+    }
+
+    if(fread(&header, sizeof(header), 1, fp) != 1 ||
+       memcmp(header.magic, N6502_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+       header.record_size != sizeof(rec))
+    {
+        fprintf(stderr, "%s is not a %s trace\n", argv[1], N6502_TRACE_MAGIC);
+        fclose(fp);
+        return 1;
+    }
+
+    while(fread(&rec, sizeof(rec), 1, fp) == 1)
+    {
+        n6502_trace_format(&rec, line, sizeof(line));
+        printf("%s\n", line);
+        count++;
+    }
+
+    fclose(fp);
+
+    fprintf(stderr, "%" PRIu64 " instructions\n", count);
+    return 0;
+}